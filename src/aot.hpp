@@ -0,0 +1,1336 @@
+#ifndef __AOT_H__
+#define __AOT_H__
+
+#include "embed.hpp"
+
+#include <inttypes.h>
+
+// NOTE: `main emit` turns a program into C++ with one function per code,
+// running its instructions as straight-line code on the `EvalRegs` that
+// `resume_eval` hands to native code. The instructions themselves, their
+// jump tables and the codes go into the emitted file as static data, linked
+// together at startup without parsing or compiling anything, so the
+// interpreter, allocator and collector it falls back on are the ones from
+// these headers, working on the same instructions.
+#define AOT_TOKENS   (1 << 14)
+#define AOT_STRINGS  (1 << 12)
+#define AOT_BINDINGS (1 << 12)
+#define AOT_UNPACKS  (1 << 10)
+#define AOT_EXPRS    (1 << 14)
+#define AOT_FUNCS    (1 << 8)
+#define AOT_NAMES    (1 << 14)
+#define AOT_RENAMES  (1 << 10)
+#define AOT_FUSIONS  (1 << 8)
+#define AOT_INSTS    (1 << 14)
+#define AOT_JUMPS    (1 << 12)
+#define AOT_CODES    (1 << 8)
+#define AOT_VALUES   (1 << 16)
+#define AOT_CHARS    (1 << 20)
+
+#ifndef AOT_HEAP
+    #define AOT_HEAP (1 << 16)
+#endif
+
+#ifndef AOT_STACK
+    #define AOT_STACK (1 << 12)
+#endif
+
+#ifndef AOT_FRAMES
+    #define AOT_FRAMES (1 << 10)
+#endif
+
+#define AOT_NONE 0xFFFFFFFFu
+#define AOT_STOP 0xFFFFFFFFu
+
+// NOTE: Each instruction belongs to the first code it is reachable from
+// without calling; `placed` marks those already written out.
+template <usize N>
+struct AotLayout {
+    u32            owners[N];
+    bool           placed[N];
+    Buffer<u32, N> work;
+};
+
+struct AotMemory {
+    Tokens<AOT_TOKENS> tokens;
+    ParseMemory<AOT_STRINGS, AOT_BINDINGS, AOT_UNPACKS, AOT_EXPRS, AOT_FUNCS>
+        parse_memory;
+    FuseMemory<AOT_NAMES, AOT_RENAMES, AOT_FUSIONS> fuse_memory;
+    Program<AOT_INSTS, AOT_JUMPS, AOT_CODES>        program;
+    AotLayout<AOT_INSTS>                            layout;
+};
+
+// NOTE: The instructions of an emitted program live in the emitted file, so
+// its `InstMemory` only ever holds the codes and the name `main`.
+struct AotContext {
+    Program<1, 1, AOT_CODES>                               program;
+    EvalMemory<AOT_HEAP, AOT_STACK, AOT_FRAMES, AOT_CODES> context;
+    Buffer<Value, AOT_VALUES>                              values;
+    Buffer<char, AOT_CHARS>                                chars;
+};
+
+// NOTE: One instruction as the emitted file stores it. `value` is the operand,
+// the callee, the constructor tag, the first branch or where the jump table
+// starts in `jumps`; `other` is the tail call depth, the arity, the second
+// branch or where the table's tags start in `jump_tags`. Instructions are
+// referred to by index, with `AOT_NONE` for none.
+struct AotInst {
+    i64 value;
+    u32 other;
+    u32 next;
+    u16 len;
+    u8  low;
+    u8  tag;
+};
+
+// NOTE: Everything the emitted file holds besides its functions: `inst_data`
+// is linked into `insts` at startup; the jump tables and codes already point
+// into `insts`. `packs` are the constructors with a shared nullary node.
+struct AotProgram {
+    ListNode<Inst>*              insts;
+    const AotInst*               inst_data;
+    usize                        len;
+    const ListNode<Inst>* const* jumps;
+    const u8*                    jump_tags;
+    const InstCode*              codes;
+    usize                        codes_len;
+    const u8*                    packs;
+    usize                        packs_len;
+    u32                          main;
+    const EvalNative*            native;
+};
+
+typedef u32 (*AotCode)(EvalRegs*, const ListNode<Inst>*, u32);
+
+// NOTE: Every step below either runs its instruction, spending one unit of
+// budget, or returns false having changed nothing, in which case the emitted
+// code stops and leaves the instruction to the interpreter.
+static u32 aot_stop(EvalRegs* regs, const ListNode<Inst>* insts, u32 index) {
+    regs->next = &insts[index];
+    return AOT_STOP;
+}
+
+#define AOT_STEP(index, step)                    \
+    if (!(step)) {                               \
+        return aot_stop(regs, insts, (index));   \
+    }
+
+static bool aot_can(EvalRegs* regs, usize len, usize push, usize cells) {
+    return (regs->budget != 0) && (len <= regs->stack_len) &&
+           (push <= (regs->stack_cap - regs->stack_len)) &&
+           (cells <= (regs->heap_cap - regs->heap_len));
+}
+
+static void aot_spend(EvalRegs* regs) {
+    --regs->budget;
+}
+
+static Node* aot_follow(Node* node) {
+    while (get_tag(node) == NODE_INDIR) {
+        node = node->body.as_node;
+    }
+    return node;
+}
+
+static Node** aot_peek(EvalRegs* regs, usize offset) {
+    return &regs->stack[regs->stack_len - 1 - offset];
+}
+
+static Node* aot_pop(EvalRegs* regs) {
+    return regs->stack[--regs->stack_len];
+}
+
+static void aot_push(EvalRegs* regs, Node* node) {
+    regs->stack[regs->stack_len++] = node;
+}
+
+static Node* aot_alloc(EvalRegs* regs, usize cells) {
+    Node* node = &regs->heap[regs->heap_len];
+    regs->heap_len += cells;
+    return node;
+}
+
+static bool aot_is_whnf(const Node* node) {
+    return (get_tag(node) == NODE_I64) || (get_tag(node) == NODE_DATA) ||
+           (get_tag(node) == NODE_ARRAY);
+}
+
+static Node* aot_get_i64(EvalRegs* regs, i64 value) {
+    if ((SHARED_I64_LOW <= value) && (value <= SHARED_I64_HIGH)) {
+        return &regs->i64s[value - SHARED_I64_LOW];
+    }
+    Node* node = aot_alloc(regs, 1);
+    node->header = NODE_I64;
+    node->body.as_i64 = value;
+    return node;
+}
+
+static bool aot_push_global(EvalRegs* regs, u32 global) {
+    if (!aot_can(regs, 0, 1, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    aot_push(regs, regs->roots[global]);
+    return true;
+}
+
+static bool aot_push_i64(EvalRegs* regs, i64 value) {
+    if (!aot_can(regs, 0, 1, 1)) {
+        return false;
+    }
+    aot_spend(regs);
+    aot_push(regs, aot_get_i64(regs, value));
+    return true;
+}
+
+static bool aot_push_undef(EvalRegs* regs) {
+    if (!aot_can(regs, 0, 1, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    aot_push(regs, regs->undef);
+    return true;
+}
+
+static bool aot_push_at(EvalRegs* regs, usize offset) {
+    if (!aot_can(regs, offset + 1, 1, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    Node** node = aot_peek(regs, offset);
+    *node = aot_follow(*node);
+    aot_push(regs, *node);
+    return true;
+}
+
+static bool aot_app(EvalRegs* regs) {
+    if (!aot_can(regs, 2, 0, 1)) {
+        return false;
+    }
+    aot_spend(regs);
+    Node* func = aot_pop(regs);
+    Node* arg = aot_pop(regs);
+    Node* node = aot_alloc(regs, 1);
+    set_app(node, func, arg);
+    aot_push(regs, node);
+    return true;
+}
+
+static bool aot_update(EvalRegs* regs, usize offset) {
+    if (!aot_can(regs, offset + 2, 0, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    Node*  value = aot_follow(aot_pop(regs));
+    Node** root = aot_peek(regs, offset);
+    Node*  node = *root;
+    if (node == regs->undef) {
+        *root = value;
+    } else if (node == value) {
+        return true;
+    } else if ((get_tag(value) == NODE_I64) ||
+               ((get_tag(value) == NODE_DATA) && (get_arity(value) == 0)))
+    {
+        *node = *value;
+    } else {
+        set_indir(node, value);
+    }
+    return true;
+}
+
+static bool aot_pop_n(EvalRegs* regs, usize n) {
+    if (!aot_can(regs, n, 0, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    regs->stack_len -= n;
+    return true;
+}
+
+static bool aot_alloc_n(EvalRegs* regs, usize n) {
+    if (!aot_can(regs, 0, n, n)) {
+        return false;
+    }
+    aot_spend(regs);
+    for (usize i = 0; i < n; ++i) {
+        Node* hole = aot_alloc(regs, 1);
+        hole->header = NODE_UNDEF;
+        aot_push(regs, hole);
+    }
+    return true;
+}
+
+static bool aot_slide(EvalRegs* regs, usize n) {
+    if (!aot_can(regs, n + 1, 0, 0)) {
+        return false;
+    }
+    aot_spend(regs);
+    Node* top = aot_pop(regs);
+    regs->stack_len -= n;
+    aot_push(regs, top);
+    return true;
+}
+
+static bool aot_eval(EvalRegs* regs) {
+    if (!aot_can(regs, 1, 0, 0)) {
+        return false;
+    }
+    Node** top = aot_peek(regs, 0);
+    *top = aot_follow(*top);
+    if (!aot_is_whnf(*top)) {
+        return false;
+    }
+    aot_spend(regs);
+    return true;
+}
+
+static bool aot_call(EvalRegs*             regs,
+                     const ListNode<Inst>* next,
+                     u8                    arity,
+                     u32                   depth,
+                     u32                   global) {
+    const usize len = static_cast<usize>(arity) + 1;
+    if ((depth < len) || (!aot_can(regs, len, depth - len, 0)) ||
+        (regs->dump_len == regs->dump_cap))
+    {
+        return false;
+    }
+    aot_spend(regs);
+    regs->dump[regs->dump_len++] = {next,
+                                    regs->stack_len - len,
+                                    regs->producer};
+    regs->producer = global;
+    return true;
+}
+
+static bool aot_tail_call(EvalRegs* regs,
+                          u8        arity,
+                          usize     depth,
+                          u32       callee_depth,
+                          u32       global) {
+    const usize len = static_cast<usize>(arity) + 1;
+    if ((callee_depth < len) || (!aot_can(regs, depth + arity, 0, 0)) ||
+        ((regs->stack_cap - (regs->stack_len - depth)) < (callee_depth - len)))
+    {
+        return false;
+    }
+    aot_spend(regs);
+    Node** args = &regs->stack[regs->stack_len - arity];
+    memmove(args - depth, args, sizeof(Node*) * arity);
+    regs->stack_len -= depth;
+    regs->producer = global;
+    return true;
+}
+
+static bool aot_pack(EvalRegs* regs, u8 tag, u8 arity) {
+    if ((arity == 0) && (get_tag(&regs->packs[tag]) == NODE_DATA)) {
+        if (!aot_can(regs, 0, 1, 0)) {
+            return false;
+        }
+        aot_spend(regs);
+        aot_push(regs, &regs->packs[tag]);
+        return true;
+    }
+    if (!aot_can(regs, arity, arity == 0 ? 1 : 0, NODE_CELLS(arity))) {
+        return false;
+    }
+    aot_spend(regs);
+    Node* node = aot_alloc(regs, NODE_CELLS(arity));
+    node->header = NODE_DATA | (static_cast<usize>(tag) << NODE_PACK_TAG) |
+                   (static_cast<usize>(arity) << NODE_ARITY);
+    Node** fields = get_fields(node);
+    for (u8 i = 0; i < arity; ++i) {
+        fields[i] = aot_pop(regs);
+    }
+    aot_push(regs, node);
+    return true;
+}
+
+// NOTE: The constructor tag to branch on, or -1; the emitted branch spends the
+// budget once it has found the tag in its table.
+static i32 aot_jump(EvalRegs* regs) {
+    if (!aot_can(regs, 1, 0, 0)) {
+        return -1;
+    }
+    const Node* node = aot_follow(*aot_peek(regs, 0));
+    return get_tag(node) == NODE_DATA ? get_pack_tag(node) : -1;
+}
+
+static bool aot_split(EvalRegs* regs, u8 arity) {
+    if (!aot_can(regs, 1, arity == 0 ? 0 : arity - 1u, 0)) {
+        return false;
+    }
+    Node* node = aot_follow(*aot_peek(regs, 0));
+    if ((get_tag(node) != NODE_DATA) || (get_arity(node) != arity)) {
+        return false;
+    }
+    aot_spend(regs);
+    --regs->stack_len;
+    Node** fields = get_fields(node);
+    for (u8 i = arity; i != 0; --i) {
+        aot_push(regs, fields[i - 1]);
+    }
+    return true;
+}
+
+// NOTE: 1 to take the first branch, 0 for the second, or -1.
+static i32 aot_cond(EvalRegs* regs) {
+    if (!aot_can(regs, 1, 0, 0)) {
+        return -1;
+    }
+    const Node* node = aot_follow(*aot_peek(regs, 0));
+    if (get_tag(node) != NODE_I64) {
+        return -1;
+    }
+    aot_spend(regs);
+    --regs->stack_len;
+    return node->body.as_i64 != 0 ? 1 : 0;
+}
+
+static bool aot_binop(EvalRegs* regs, InstTag tag) {
+    if (!aot_can(regs, 2, 0, 1)) {
+        return false;
+    }
+    const Node* left = aot_follow(*aot_peek(regs, 0));
+    const Node* right = aot_follow(*aot_peek(regs, 1));
+    if ((get_tag(left) != NODE_I64) || (get_tag(right) != NODE_I64)) {
+        return false;
+    }
+    const i64 l = left->body.as_i64;
+    const i64 r = right->body.as_i64;
+    i64       value = 0;
+    switch (tag) {
+    case INST_ADD: {
+        value = add_i64(l, r);
+        break;
+    }
+    case INST_SUB: {
+        value = sub_i64(l, r);
+        break;
+    }
+    case INST_MUL: {
+        value = mul_i64(l, r);
+        break;
+    }
+    case INST_DIV: {
+        if (r == 0) {
+            return false;
+        }
+        value = div_i64(l, r);
+        break;
+    }
+    case INST_EQ: {
+        value = l == r;
+        break;
+    }
+    case INST_NE: {
+        value = l != r;
+        break;
+    }
+    case INST_LT: {
+        value = l < r;
+        break;
+    }
+    case INST_LE: {
+        value = l <= r;
+        break;
+    }
+    case INST_GT: {
+        value = l > r;
+        break;
+    }
+    case INST_GE: {
+        value = l >= r;
+        break;
+    }
+    case INST_OR: {
+        value = (l != 0) || (r != 0);
+        break;
+    }
+    case INST_AND: {
+        value = (l != 0) && (r != 0);
+        break;
+    }
+    case INST_UNWIND:
+    case INST_PUSH_GLOBAL:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_CALL:
+    case INST_TAIL_CALL:
+    case INST_PACK:
+    case INST_JUMP:
+    case INST_SPLIT:
+    case INST_COND:
+    case INST_PRIM: {
+        EXIT();
+    }
+    }
+    aot_spend(regs);
+    regs->stack_len -= 2;
+    aot_push(regs, aot_get_i64(regs, value));
+    return true;
+}
+
+// NOTE: Returns an evaluated node to the frame below, within the segment,
+// and gives back the instruction to continue with.
+static u32 aot_unwind(EvalRegs* regs, const ListNode<Inst>* insts, u32 index) {
+    if (!aot_can(regs, 1, 0, 0)) {
+        return aot_stop(regs, insts, index);
+    }
+    Node** top = aot_peek(regs, 0);
+    *top = aot_follow(*top);
+    if ((!aot_is_whnf(*top)) || (regs->dump_len == 0) ||
+        ((regs->dump_len == 1) && (regs->linked != 0)))
+    {
+        return aot_stop(regs, insts, index);
+    }
+    aot_spend(regs);
+    Node*           node = *top;
+    const InstFrame frame = regs->dump[--regs->dump_len];
+    regs->producer = frame.global;
+    regs->stack_len = frame.base;
+    aot_push(regs, node);
+    return static_cast<u32>(frame.insts - insts);
+}
+
+// NOTE: Hands each instruction to the code that owns it until one stops.
+static void aot_run(EvalRegs*             regs,
+                    const ListNode<Inst>* insts,
+                    const u32*            owners,
+                    const AotCode*        codes,
+                    u32                   index) {
+    while (index != AOT_STOP) {
+        if (owners[index] == AOT_NONE) {
+            regs->next = &insts[index];
+            return;
+        }
+        index = codes[owners[index]](regs, insts, index);
+    }
+}
+
+template <usize N, usize J, usize G>
+static void add_successors(const InstMemory<N, J, G>* inst_memory,
+                           AotLayout<N>*              layout,
+                           u32                        owner,
+                           const ListNode<Inst>*      node) {
+    const ListNode<Inst>* successors[1 << 8];
+    usize                 len = 0;
+    const Inst*           inst = &node->value;
+    switch (inst->tag) {
+    case INST_UNWIND:
+    case INST_TAIL_CALL: {
+        break;
+    }
+    case INST_COND: {
+        successors[len++] = inst->body.as_cond.insts[0];
+        successors[len++] = inst->body.as_cond.insts[1];
+        break;
+    }
+    case INST_JUMP: {
+        for (u16 i = 0; i < inst->body.as_jump.len; ++i) {
+            successors[len++] = inst->body.as_jump.insts[i];
+        }
+        break;
+    }
+    case INST_PUSH_GLOBAL:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_CALL:
+    case INST_PACK:
+    case INST_SPLIT:
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_EQ:
+    case INST_NE:
+    case INST_LT:
+    case INST_LE:
+    case INST_GT:
+    case INST_GE:
+    case INST_OR:
+    case INST_AND:
+    case INST_PRIM: {
+        successors[len++] = node->next;
+        break;
+    }
+    }
+    for (usize i = 0; i < len; ++i) {
+        if (!successors[i]) {
+            continue;
+        }
+        const usize index =
+            static_cast<usize>(successors[i] - inst_memory->insts.items);
+        if (layout->owners[index] == AOT_NONE) {
+            layout->owners[index] = owner;
+            *alloc(&layout->work) = static_cast<u32>(index);
+        }
+    }
+}
+
+// NOTE: Control passes within a code by `goto`, and to another code through
+// `aot_run`.
+template <usize N, usize J, usize G>
+static void put_transfer(File*                      out,
+                         const InstMemory<N, J, G>* inst_memory,
+                         AotLayout<N>*              layout,
+                         u32                        owner,
+                         const ListNode<Inst>*      node) {
+    const u32 index = static_cast<u32>(node - inst_memory->insts.items);
+    if (layout->owners[index] == owner) {
+        fprintf(out, "goto i%u;\n", index);
+        if (!layout->placed[index]) {
+            *alloc(&layout->work) = index;
+        }
+    } else {
+        fprintf(out, "return %u;\n", index);
+    }
+}
+
+static void put_i64(File* out, i64 value) {
+    if (value == INT64_MIN) {
+        fprintf(out, "INT64_MIN");
+    } else {
+        fprintf(out, "INT64_C(%" PRId64 ")", value);
+    }
+}
+
+static const char* get_binop(InstTag tag) {
+    switch (tag) {
+    case INST_ADD: {
+        return "INST_ADD";
+    }
+    case INST_SUB: {
+        return "INST_SUB";
+    }
+    case INST_MUL: {
+        return "INST_MUL";
+    }
+    case INST_DIV: {
+        return "INST_DIV";
+    }
+    case INST_EQ: {
+        return "INST_EQ";
+    }
+    case INST_NE: {
+        return "INST_NE";
+    }
+    case INST_LT: {
+        return "INST_LT";
+    }
+    case INST_LE: {
+        return "INST_LE";
+    }
+    case INST_GT: {
+        return "INST_GT";
+    }
+    case INST_GE: {
+        return "INST_GE";
+    }
+    case INST_OR: {
+        return "INST_OR";
+    }
+    case INST_AND: {
+        return "INST_AND";
+    }
+    case INST_UNWIND:
+    case INST_PUSH_GLOBAL:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_CALL:
+    case INST_TAIL_CALL:
+    case INST_PACK:
+    case INST_JUMP:
+    case INST_SPLIT:
+    case INST_COND:
+    case INST_PRIM: {
+        break;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: Writes instruction `index` and returns the one it falls through to,
+// if that still has to be written.
+template <usize N, usize J, usize G>
+static const ListNode<Inst>* put_inst(File*                      out,
+                                      const InstMemory<N, J, G>* inst_memory,
+                                      AotLayout<N>*              layout,
+                                      u32                        owner,
+                                      u32                        index) {
+    const ListNode<Inst>* node = &inst_memory->insts.items[index];
+    const Inst*           inst = &node->value;
+    fprintf(out, "i%u:\n    ", index);
+    switch (inst->tag) {
+    case INST_UNWIND: {
+        fprintf(out, "return aot_unwind(regs, insts, %u);\n", index);
+        return null;
+    }
+    case INST_PUSH_GLOBAL: {
+        fprintf(out,
+                "AOT_STEP(%u, aot_push_global(regs, %u));\n",
+                index,
+                inst->body.as_global);
+        break;
+    }
+    case INST_PUSH_INT: {
+        fprintf(out, "AOT_STEP(%u, aot_push_i64(regs, ", index);
+        put_i64(out, inst->body.as_i64);
+        fprintf(out, "));\n");
+        break;
+    }
+    case INST_PUSH_UNDEF: {
+        fprintf(out, "AOT_STEP(%u, aot_push_undef(regs));\n", index);
+        break;
+    }
+    case INST_PUSH:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE: {
+        const char* step = inst->tag == INST_PUSH     ? "aot_push_at"
+                           : inst->tag == INST_UPDATE ? "aot_update"
+                           : inst->tag == INST_POP    ? "aot_pop_n"
+                           : inst->tag == INST_ALLOC  ? "aot_alloc_n"
+                                                      : "aot_slide";
+        fprintf(out,
+                "AOT_STEP(%u, %s(regs, %" PRId64 "u));\n",
+                index,
+                step,
+                inst->body.as_i64);
+        break;
+    }
+    case INST_APP: {
+        fprintf(out, "AOT_STEP(%u, aot_app(regs));\n", index);
+        break;
+    }
+    case INST_EVAL: {
+        fprintf(out, "AOT_STEP(%u, aot_eval(regs));\n", index);
+        break;
+    }
+    case INST_CALL: {
+        const InstCode* callee =
+            &inst_memory->codes.items[inst->body.as_call.global];
+        fprintf(out,
+                "AOT_STEP(%u, aot_call(regs, &insts[%u], %u, %u, %u));\n    ",
+                index,
+                static_cast<u32>(node->next - inst_memory->insts.items),
+                callee->arity,
+                callee->depth,
+                inst->body.as_call.global);
+        put_transfer(out, inst_memory, layout, owner, callee->insts);
+        if (!layout->placed[node->next - inst_memory->insts.items]) {
+            *alloc(&layout->work) =
+                static_cast<u32>(node->next - inst_memory->insts.items);
+        }
+        return null;
+    }
+    case INST_TAIL_CALL: {
+        const InstCode* callee =
+            &inst_memory->codes.items[inst->body.as_call.global];
+        fprintf(out,
+                "AOT_STEP(%u, aot_tail_call(regs, %u, %u, %u, %u));\n    ",
+                index,
+                callee->arity,
+                inst->body.as_call.depth,
+                callee->depth,
+                inst->body.as_call.global);
+        put_transfer(out, inst_memory, layout, owner, callee->insts);
+        return null;
+    }
+    case INST_PACK: {
+        fprintf(out,
+                "AOT_STEP(%u, aot_pack(regs, %u, %u));\n",
+                index,
+                inst->body.as_pack.tag,
+                inst->body.as_pack.arity);
+        break;
+    }
+    case INST_JUMP: {
+        const InstJump* jump = &inst->body.as_jump;
+        fprintf(out, "switch (aot_jump(regs)) {\n");
+        for (u16 i = 0; i < jump->len; ++i) {
+            if (!jump->insts[i]) {
+                continue;
+            }
+            fprintf(out,
+                    "    case %u:\n        aot_spend(regs);\n        ",
+                    jump->tags ? jump->tags[i] : jump->low + i);
+            put_transfer(out, inst_memory, layout, owner, jump->insts[i]);
+        }
+        fprintf(out,
+                "    default:\n        return aot_stop(regs, insts, %u);\n"
+                "    }\n",
+                index);
+        return null;
+    }
+    case INST_SPLIT: {
+        fprintf(out,
+                "AOT_STEP(%u, aot_split(regs, %" PRId64 "));\n",
+                index,
+                inst->body.as_i64);
+        break;
+    }
+    case INST_COND: {
+        fprintf(out, "switch (aot_cond(regs)) {\n    case 1:\n        ");
+        put_transfer(out,
+                     inst_memory,
+                     layout,
+                     owner,
+                     inst->body.as_cond.insts[0]);
+        fprintf(out, "    case 0:\n        ");
+        put_transfer(out,
+                     inst_memory,
+                     layout,
+                     owner,
+                     inst->body.as_cond.insts[1]);
+        fprintf(out,
+                "    default:\n        return aot_stop(regs, insts, %u);\n"
+                "    }\n",
+                index);
+        return null;
+    }
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_EQ:
+    case INST_NE:
+    case INST_LT:
+    case INST_LE:
+    case INST_GT:
+    case INST_GE:
+    case INST_OR:
+    case INST_AND: {
+        fprintf(out,
+                "AOT_STEP(%u, aot_binop(regs, %s));\n",
+                index,
+                get_binop(inst->tag));
+        break;
+    }
+    case INST_PRIM: {
+        fprintf(out, "return aot_stop(regs, insts, %u);\n", index);
+        if (node->next &&
+            (!layout->placed[node->next - inst_memory->insts.items]))
+        {
+            *alloc(&layout->work) =
+                static_cast<u32>(node->next - inst_memory->insts.items);
+        }
+        return null;
+    }
+    }
+    if (!node->next) {
+        return null;
+    }
+    const u32 next = static_cast<u32>(node->next - inst_memory->insts.items);
+    if ((layout->owners[next] != owner) || layout->placed[next]) {
+        fprintf(out, "    ");
+        put_transfer(out, inst_memory, layout, owner, node->next);
+        return null;
+    }
+    return node->next;
+}
+
+template <usize N, usize J, usize G>
+static u32 get_inst_index(const InstMemory<N, J, G>* inst_memory,
+                          const ListNode<Inst>*      node) {
+    return node ? static_cast<u32>(node - inst_memory->insts.items)
+                : AOT_NONE;
+}
+
+template <usize N, usize J, usize G>
+static void put_node(File*                      out,
+                     const InstMemory<N, J, G>* inst_memory,
+                     const ListNode<Inst>*      node) {
+    if (node) {
+        fprintf(out, "&aot_insts[%u]", get_inst_index(inst_memory, node));
+    } else {
+        fprintf(out, "null");
+    }
+}
+
+template <usize N, usize J, usize G>
+static void put_inst_data(File*                      out,
+                          const InstMemory<N, J, G>* inst_memory,
+                          const ListNode<Inst>*      node) {
+    const Inst* inst = &node->value;
+    i64         value = inst->body.as_i64;
+    u32         other = 0;
+    u16         len = 0;
+    u8          low = 0;
+    switch (inst->tag) {
+    case INST_PUSH_GLOBAL: {
+        value = inst->body.as_global;
+        break;
+    }
+    case INST_CALL:
+    case INST_TAIL_CALL: {
+        value = inst->body.as_call.global;
+        other = inst->body.as_call.depth;
+        break;
+    }
+    case INST_PACK: {
+        value = inst->body.as_pack.tag;
+        other = inst->body.as_pack.arity;
+        break;
+    }
+    case INST_COND: {
+        value = get_inst_index(inst_memory, inst->body.as_cond.insts[0]);
+        other = get_inst_index(inst_memory, inst->body.as_cond.insts[1]);
+        break;
+    }
+    case INST_JUMP: {
+        const InstJump* jump = &inst->body.as_jump;
+        value = jump->insts - inst_memory->jumps.items;
+        other = jump->tags ? static_cast<u32>(jump->tags -
+                                              inst_memory->tags.items)
+                           : AOT_NONE;
+        len = jump->len;
+        low = jump->low;
+        break;
+    }
+    case INST_UNWIND:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_SPLIT:
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_EQ:
+    case INST_NE:
+    case INST_LT:
+    case INST_LE:
+    case INST_GT:
+    case INST_GE:
+    case INST_OR:
+    case INST_AND:
+    case INST_PRIM: {
+        break;
+    }
+    }
+    fprintf(out, "    {");
+    put_i64(out, value);
+    fprintf(out,
+            ", %uu, %uu, %u, %u, %u},\n",
+            other,
+            get_inst_index(inst_memory, node->next),
+            len,
+            low,
+            inst->tag);
+}
+
+// NOTE: Writes all the static data the emitted functions run against, in the
+// shape `AotProgram` describes. Arrays that would be empty get one unused
+// element, since C++ has no empty arrays.
+template <usize N, usize J, usize G>
+static void put_data(File*                      out,
+                     const InstMemory<N, J, G>* inst_memory,
+                     const NodeShared*          shared,
+                     const AotLayout<N>*        layout) {
+    const usize len = inst_memory->insts.len;
+    fprintf(out,
+            "static ListNode<Inst> aot_insts[%zu];\n\n"
+            "static const AotInst aot_inst_data[] = {\n",
+            len);
+    for (usize i = 0; i < len; ++i) {
+        put_inst_data(out, inst_memory, &inst_memory->insts.items[i]);
+    }
+    fprintf(out, "};\n\nstatic const ListNode<Inst>* const aot_jumps[] = {\n");
+    for (usize i = 0; i < inst_memory->jumps.len; ++i) {
+        fprintf(out, "    ");
+        put_node(out, inst_memory, inst_memory->jumps.items[i]);
+        fprintf(out, ",\n");
+    }
+    if (inst_memory->jumps.len == 0) {
+        fprintf(out, "    null,\n");
+    }
+    fprintf(out, "};\n\nstatic const u8 aot_jump_tags[] = {\n");
+    for (usize i = 0; i < inst_memory->tags.len; ++i) {
+        fprintf(out, "    %u,\n", inst_memory->tags.items[i]);
+    }
+    if (inst_memory->tags.len == 0) {
+        fprintf(out, "    0,\n");
+    }
+    fprintf(out, "};\n\nstatic const InstCode aot_inst_codes[] = {\n");
+    for (usize i = 0; i < inst_memory->codes.len; ++i) {
+        const InstCode* code = &inst_memory->codes.items[i];
+        fprintf(out, "    {");
+        put_node(out, inst_memory, code->insts);
+        fprintf(out,
+                ", {%u, %u, %u}, %u, %uu},\n",
+                code->select.tag,
+                code->select.arity,
+                code->select.field,
+                code->arity,
+                code->depth);
+    }
+    usize packs = 0;
+    fprintf(out, "};\n\nstatic const u8 aot_packs[] = {\n");
+    for (usize i = 0; i < (1 << 8); ++i) {
+        if (get_tag(&shared->packs[i]) == NODE_DATA) {
+            fprintf(out, "    %zu,\n", i);
+            ++packs;
+        }
+    }
+    if (packs == 0) {
+        fprintf(out, "    0,\n");
+    }
+    fprintf(out, "};\n\nstatic const void* const aot_entries[] = {\n");
+    for (usize i = 0; i < len; ++i) {
+        if (layout->owners[i] == AOT_NONE) {
+            fprintf(out, "    null,\n");
+        } else {
+            fprintf(out, "    &aot_owners[%zu],\n", i);
+        }
+    }
+    fprintf(out,
+            "};\n\n"
+            "static void run(EvalRegs* regs, const void* entry) {\n"
+            "    aot_run(regs,\n"
+            "            aot_insts,\n"
+            "            aot_owners,\n"
+            "            aot_codes,\n"
+            "            static_cast<u32>(static_cast<const u32*>(entry) -\n"
+            "                             aot_owners));\n"
+            "}\n\n"
+            "static const EvalNative aot_native = {aot_insts,\n"
+            "                                      aot_entries,\n"
+            "                                      %zu,\n"
+            "                                      run};\n\n"
+            "static const AotProgram aot_program = {aot_insts,\n"
+            "                                       aot_inst_data,\n"
+            "                                       %zu,\n"
+            "                                       aot_jumps,\n"
+            "                                       aot_jump_tags,\n"
+            "                                       aot_inst_codes,\n"
+            "                                       %zu,\n"
+            "                                       aot_packs,\n"
+            "                                       %zu,\n"
+            "                                       %uu,\n"
+            "                                       &aot_native};\n\n",
+            len,
+            len,
+            inst_memory->codes.len,
+            packs,
+            get_global(inst_memory, GET_STRING("main")));
+}
+
+template <usize N, usize J, usize G>
+static void put_name(File*                      out,
+                     const InstMemory<N, J, G>* inst_memory,
+                     u32                        global) {
+    for (usize i = 0; i < G; ++i) {
+        const Item<String, u32>* item = &inst_memory->globals.items[i];
+        if (item->alive && (item->value == global)) {
+            fprintf(out,
+                    "// %.*s\n",
+                    static_cast<i32>(item->key.len),
+                    item->key.chars);
+            return;
+        }
+    }
+    fprintf(out, "// #%u\n", global);
+}
+
+// NOTE: Writes the program as a C++ file and returns the number of functions
+// in it, one for each code.
+template <usize N, usize J, usize G>
+static usize emit_aot(File*                      out,
+                      const InstMemory<N, J, G>* inst_memory,
+                      const NodeShared*          shared,
+                      AotLayout<N>*              layout) {
+    const usize len = inst_memory->insts.len;
+    u32         codes[G];
+    usize       funcs = 0;
+    for (usize i = 0; i < len; ++i) {
+        layout->owners[i] = AOT_NONE;
+        layout->placed[i] = false;
+    }
+    layout->work.len = 0;
+    for (usize i = 0; i < inst_memory->codes.len; ++i) {
+        const ListNode<Inst>* insts = inst_memory->codes.items[i].insts;
+        if ((!insts) ||
+            (layout->owners[insts - inst_memory->insts.items] != AOT_NONE))
+        {
+            continue;
+        }
+        const u32 owner = static_cast<u32>(funcs);
+        codes[funcs++] = static_cast<u32>(i);
+        layout->owners[insts - inst_memory->insts.items] = owner;
+        *alloc(&layout->work) =
+            static_cast<u32>(insts - inst_memory->insts.items);
+        while (layout->work.len != 0) {
+            const u32 index = layout->work.items[--layout->work.len];
+            add_successors(inst_memory,
+                           layout,
+                           owner,
+                           &inst_memory->insts.items[index]);
+        }
+    }
+    EXIT_IF(funcs == 0);
+    fprintf(out,
+            "// NOTE: Written by `main emit`; build it with the headers "
+            "from src/.\n"
+            "#include \"aot.hpp\"\n\n");
+    for (usize f = 0; f < funcs; ++f) {
+        const u32 owner = static_cast<u32>(f);
+        put_name(out, inst_memory, codes[f]);
+        fprintf(out,
+                "static u32 code_%u(EvalRegs*             regs,\n"
+                "                   const ListNode<Inst>* insts,\n"
+                "                   u32                   entry) {\n"
+                "    switch (entry) {\n",
+                codes[f]);
+        for (usize i = 0; i < len; ++i) {
+            if (layout->owners[i] == owner) {
+                fprintf(out, "    case %zu:\n        goto i%zu;\n", i, i);
+            }
+        }
+        fprintf(out,
+                "    default:\n"
+                "        return aot_stop(regs, insts, entry);\n"
+                "    }\n");
+        const ListNode<Inst>* entry = inst_memory->codes.items[codes[f]].insts;
+        *alloc(&layout->work) =
+            static_cast<u32>(entry - inst_memory->insts.items);
+        while (layout->work.len != 0) {
+            u32 index = layout->work.items[--layout->work.len];
+            while (!layout->placed[index]) {
+                layout->placed[index] = true;
+                const ListNode<Inst>* next =
+                    put_inst(out, inst_memory, layout, owner, index);
+                if (!next) {
+                    break;
+                }
+                index = static_cast<u32>(next - inst_memory->insts.items);
+            }
+        }
+        fprintf(out, "}\n\n");
+    }
+    fprintf(out, "static const AotCode aot_codes[] = {\n");
+    for (usize f = 0; f < funcs; ++f) {
+        fprintf(out, "    code_%u,\n", codes[f]);
+    }
+    fprintf(out, "};\n\nstatic const u32 aot_owners[] = {\n");
+    for (usize i = 0; i < len; ++i) {
+        fprintf(out, "    %uu,\n", layout->owners[i]);
+    }
+    fprintf(out, "};\n\n");
+    put_data(out, inst_memory, shared, layout);
+    fprintf(out,
+            "i32 main(i32 argc, const char** argv) {\n"
+            "    EXIT_IF(2 < argc);\n"
+            "    return run_aot(&aot_program, argc == 2 ? argv[1] : null);\n"
+            "}\n");
+    return funcs;
+}
+
+static ListNode<Inst>* get_node(ListNode<Inst>* insts, u32 index) {
+    return index == AOT_NONE ? null : &insts[index];
+}
+
+// NOTE: Fills in `program->insts` from `inst_data`, one instruction at a time.
+static void load_aot(const AotProgram* program) {
+    ListNode<Inst>* insts = program->insts;
+    for (usize i = 0; i < program->len; ++i) {
+        const AotInst* data = &program->inst_data[i];
+        Inst*          inst = &insts[i].value;
+        inst->tag = static_cast<InstTag>(data->tag);
+        switch (inst->tag) {
+        case INST_PUSH_GLOBAL: {
+            inst->body.as_global = static_cast<u32>(data->value);
+            break;
+        }
+        case INST_CALL:
+        case INST_TAIL_CALL: {
+            inst->body.as_call = {static_cast<u32>(data->value), data->other};
+            break;
+        }
+        case INST_PACK: {
+            inst->body.as_pack = {static_cast<u8>(data->value),
+                                  static_cast<u8>(data->other)};
+            break;
+        }
+        case INST_COND: {
+            inst->body.as_cond.insts[0] =
+                get_node(insts, static_cast<u32>(data->value));
+            inst->body.as_cond.insts[1] = get_node(insts, data->other);
+            break;
+        }
+        case INST_JUMP: {
+            inst->body.as_jump = {
+                &program->jumps[data->value],
+                data->other == AOT_NONE ? null
+                                        : &program->jump_tags[data->other],
+                data->len,
+                data->low,
+            };
+            break;
+        }
+        case INST_UNWIND:
+        case INST_PUSH_INT:
+        case INST_PUSH_UNDEF:
+        case INST_PUSH:
+        case INST_APP:
+        case INST_UPDATE:
+        case INST_POP:
+        case INST_ALLOC:
+        case INST_SLIDE:
+        case INST_EVAL:
+        case INST_SPLIT:
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+        case INST_EQ:
+        case INST_NE:
+        case INST_LT:
+        case INST_LE:
+        case INST_GT:
+        case INST_GE:
+        case INST_OR:
+        case INST_AND:
+        case INST_PRIM: {
+            inst->body.as_i64 = data->value;
+            break;
+        }
+        }
+        insts[i].next = get_node(insts, data->next);
+    }
+}
+
+// NOTE: The emitted program's `main`: links the emitted instructions, sets up
+// the codes and shared nodes they refer to, and evaluates `main` with the
+// emitted functions as its native code, reading `input`, if given, through
+// `input_from`.
+static i32 run_aot(const AotProgram* aot, const char* input) {
+    AotContext* memory =
+        reinterpret_cast<AotContext*>(calloc(1, sizeof(AotContext)));
+    EXIT_IF(!memory);
+    EXIT_IF(AOT_CODES < aot->codes_len);
+    load_aot(aot);
+    InstMemory<1, 1, AOT_CODES>* inst_memory = &memory->program.inst_memory;
+    memcpy(alloc(&inst_memory->codes, aot->codes_len),
+           aot->codes,
+           sizeof(InstCode) * aot->codes_len);
+    insert(&inst_memory->globals, GET_STRING("main"), aot->main);
+    set_shared_i64s(&memory->program.shared);
+    for (usize i = 0; i < aot->packs_len; ++i) {
+        set_shared_pack(&memory->program.shared, aot->packs[i]);
+    }
+    memory->context.native = aot->native;
+    set_globals(&memory->context, inst_memory, &memory->program.shared);
+    memory->context.input = map_input(input);
+    const Value* value = call(&memory->context,
+                              &memory->program,
+                              &memory->values,
+                              GET_STRING("main"),
+                              null,
+                              0);
+    if (!value) {
+        EXIT_WITH(FAILURE);
+    }
+    put_value(&memory->chars, value);
+    printf("%.*s\n",
+           static_cast<i32>(memory->chars.len),
+           memory->chars.items);
+    unmap_input(&memory->context.input);
+    free(memory);
+    return EXIT_SUCCESS;
+}
+
+// NOTE: The emitted file is only built by hand, so this checks its shape: one
+// function per code, every instruction a code can reach owned by one of them,
+// and one row of static data per instruction.
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G>
+static void test_aot(Tokens<T>*                  tokens,
+                     ParseMemory<S, B, U, E, F>* parse_memory,
+                     InstMemory<I, J, G>*        inst_memory,
+                     NodeShared*                 shared,
+                     AotLayout<I>*               layout) {
+    const String source =
+        GET_STRING("fib n { if (n < 2) n (fib (n - 1) + fib (n - 2)) }\n"
+                   "last xs {\n"
+                   "  unpack xs { 1 = 0; 2 y ys = y + last ys }\n"
+                   "}\n"
+                   "main { fib 10 + last (pack 2 2 7 (pack 1 0)) }");
+    set_tokens(source, tokens);
+    parse_program(tokens, parse_memory);
+    compile_program(inst_memory, &parse_memory->funcs);
+    memset(shared, 0, sizeof(NodeShared));
+    set_shared_packs(shared, &parse_memory->funcs);
+    File* out = tmpfile();
+    EXIT_IF(!out);
+    const usize funcs = emit_aot(out, inst_memory, shared, layout);
+    EXIT_IF((funcs < 3) || (inst_memory->codes.len < funcs));
+    for (usize i = 0; i < inst_memory->codes.len; ++i) {
+        const ListNode<Inst>* insts = inst_memory->codes.items[i].insts;
+        if (insts) {
+            EXIT_IF(layout->owners[insts - inst_memory->insts.items] ==
+                    AOT_NONE);
+        }
+    }
+    for (usize i = 0; i < inst_memory->insts.len; ++i) {
+        EXIT_IF((layout->owners[i] != AOT_NONE) && (!layout->placed[i]));
+    }
+    rewind(out);
+    char  line[1 << 8];
+    usize defs = 0;
+    usize rows = 0;
+    bool  data = false;
+    while (fgets(line, sizeof(line), out)) {
+        if (!strncmp(line, "static u32 code_", 16)) {
+            ++defs;
+        }
+        if (!strcmp(line, "static const AotInst aot_inst_data[] = {\n")) {
+            data = true;
+        } else if (!strcmp(line, "};\n")) {
+            data = false;
+        } else if (data) {
+            ++rows;
+        }
+    }
+    EXIT_IF(defs != funcs);
+    EXIT_IF(rows != inst_memory->insts.len);
+    EXIT_IF(fclose(out) != 0);
+    fprintf(stderr, ".\n");
+}
+
+#endif
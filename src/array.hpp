@@ -0,0 +1,264 @@
+#ifndef __ARRAY_H__
+#define __ARRAY_H__
+
+#include "inst.hpp"
+
+#ifdef __AVX2__
+    #include <immintrin.h>
+#endif
+
+static String get_prim_name(Prim prim) {
+    switch (prim) {
+    case PRIM_FILL: {
+        return GET_STRING("array_fill");
+    }
+    case PRIM_RANGE: {
+        return GET_STRING("array_range");
+    }
+    case PRIM_LEN: {
+        return GET_STRING("array_len");
+    }
+    case PRIM_GET: {
+        return GET_STRING("array_get");
+    }
+    case PRIM_SLICE: {
+        return GET_STRING("array_slice");
+    }
+    case PRIM_ADD: {
+        return GET_STRING("array_add");
+    }
+    case PRIM_SUB: {
+        return GET_STRING("array_sub");
+    }
+    case PRIM_MUL: {
+        return GET_STRING("array_mul");
+    }
+    case PRIM_SUM: {
+        return GET_STRING("array_sum");
+    }
+    case PRIM_EQ: {
+        return GET_STRING("array_eq");
+    }
+    case PRIM_INPUT: {
+        return GET_STRING("input_from");
+    }
+    }
+    EXIT();
+}
+
+static u8 get_prim_arity(Prim prim) {
+    switch (prim) {
+    case PRIM_LEN:
+    case PRIM_SUM:
+    case PRIM_INPUT: {
+        return 1;
+    }
+    case PRIM_FILL:
+    case PRIM_RANGE:
+    case PRIM_GET:
+    case PRIM_ADD:
+    case PRIM_SUB:
+    case PRIM_MUL:
+    case PRIM_EQ: {
+        return 2;
+    }
+    case PRIM_SLICE: {
+        return 3;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: Element arithmetic wraps, matching what the vector lanes do.
+static i64 add_i64(i64 a, i64 b) {
+    return static_cast<i64>(static_cast<u64>(a) + static_cast<u64>(b));
+}
+
+static i64 sub_i64(i64 a, i64 b) {
+    return static_cast<i64>(static_cast<u64>(a) - static_cast<u64>(b));
+}
+
+static i64 mul_i64(i64 a, i64 b) {
+    return static_cast<i64>(static_cast<u64>(a) * static_cast<u64>(b));
+}
+
+// NOTE: The one quotient that does not fit, `INT64_MIN / -1`, wraps back to
+// `INT64_MIN`. Dividing by zero is left to the caller.
+static i64 div_i64(i64 a, i64 b) {
+    if (b == -1) {
+        return sub_i64(0, a);
+    }
+    return a / b;
+}
+
+#ifdef __AVX2__
+
+static __m256i load(const i64* i64s) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i64s));
+}
+
+static void store(i64* i64s, __m256i x) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(i64s), x);
+}
+
+static __m256i mul_i64x4(__m256i a, __m256i b) {
+    const __m256i lo = _mm256_mul_epu32(a, b);
+    const __m256i hi =
+        _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                         _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+}
+
+#endif
+
+static void fill_i64s(i64* out, usize len, i64 value) {
+    usize i = 0;
+#ifdef __AVX2__
+    const __m256i x = _mm256_set1_epi64x(value);
+    for (; (i + 4) <= len; i += 4) {
+        store(&out[i], x);
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i] = value;
+    }
+}
+
+static void range_i64s(i64* out, usize len, i64 low) {
+    usize i = 0;
+#ifdef __AVX2__
+    const __m256i step = _mm256_set1_epi64x(4);
+    __m256i       x = _mm256_add_epi64(_mm256_set1_epi64x(low),
+                                       _mm256_set_epi64x(3, 2, 1, 0));
+    for (; (i + 4) <= len; i += 4) {
+        store(&out[i], x);
+        x = _mm256_add_epi64(x, step);
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i] = add_i64(low, static_cast<i64>(i));
+    }
+}
+
+static void add_i64s(i64* out, const i64* a, const i64* b, usize len) {
+    usize i = 0;
+#ifdef __AVX2__
+    for (; (i + 4) <= len; i += 4) {
+        store(&out[i], _mm256_add_epi64(load(&a[i]), load(&b[i])));
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i] = add_i64(a[i], b[i]);
+    }
+}
+
+static void sub_i64s(i64* out, const i64* a, const i64* b, usize len) {
+    usize i = 0;
+#ifdef __AVX2__
+    for (; (i + 4) <= len; i += 4) {
+        store(&out[i], _mm256_sub_epi64(load(&a[i]), load(&b[i])));
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i] = sub_i64(a[i], b[i]);
+    }
+}
+
+static void mul_i64s(i64* out, const i64* a, const i64* b, usize len) {
+    usize i = 0;
+#ifdef __AVX2__
+    for (; (i + 4) <= len; i += 4) {
+        store(&out[i], mul_i64x4(load(&a[i]), load(&b[i])));
+    }
+#endif
+    for (; i < len; ++i) {
+        out[i] = mul_i64(a[i], b[i]);
+    }
+}
+
+static i64 sum_i64s(const i64* a, usize len) {
+    usize i = 0;
+    i64   sum = 0;
+#ifdef __AVX2__
+    __m256i x = _mm256_setzero_si256();
+    for (; (i + 4) <= len; i += 4) {
+        x = _mm256_add_epi64(x, load(&a[i]));
+    }
+    i64 lanes[4];
+    store(lanes, x);
+    sum = add_i64(add_i64(lanes[0], lanes[1]), add_i64(lanes[2], lanes[3]));
+#endif
+    for (; i < len; ++i) {
+        sum = add_i64(sum, a[i]);
+    }
+    return sum;
+}
+
+static bool eq_i64s(const i64* a, const i64* b, usize len) {
+    usize i = 0;
+#ifdef __AVX2__
+    for (; (i + 4) <= len; i += 4) {
+        const __m256i x = _mm256_cmpeq_epi64(load(&a[i]), load(&b[i]));
+        if (_mm256_movemask_epi8(x) != -1) {
+            return false;
+        }
+    }
+#endif
+    for (; i < len; ++i) {
+        if (a[i] != b[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void test_i64s() {
+    i64 a[13];
+    i64 b[13];
+    i64 c[13];
+    for (usize len = 0; len <= 13; ++len) {
+        range_i64s(a, len, -3);
+        fill_i64s(b, len, 1 << 20);
+        for (usize i = 0; i < len; ++i) {
+            EXIT_IF(a[i] != (static_cast<i64>(i) - 3));
+            EXIT_IF(b[i] != (1 << 20));
+        }
+        add_i64s(c, a, b, len);
+        for (usize i = 0; i < len; ++i) {
+            EXIT_IF(c[i] != (a[i] + b[i]));
+        }
+        sub_i64s(c, a, b, len);
+        for (usize i = 0; i < len; ++i) {
+            EXIT_IF(c[i] != (a[i] - b[i]));
+        }
+        mul_i64s(c, a, b, len);
+        for (usize i = 0; i < len; ++i) {
+            EXIT_IF(c[i] != (a[i] * b[i]));
+        }
+        i64 sum = 0;
+        for (usize i = 0; i < len; ++i) {
+            sum += a[i];
+        }
+        EXIT_IF(sum_i64s(a, len) != sum);
+        EXIT_IF(!eq_i64s(a, a, len));
+        EXIT_IF((len != 0) && eq_i64s(a, b, len));
+        if (len != 0) {
+            for (usize i = 0; i < len; ++i) {
+                c[i] = a[i];
+            }
+            ++c[len - 1];
+            EXIT_IF(eq_i64s(a, c, len));
+        }
+    }
+    {
+        const i64 x[] = {-1, 1LL << 40, -(1LL << 33) + 7, 3};
+        const i64 y[] = {-1, 1LL << 20, 1LL << 31, -5};
+        mul_i64s(c, x, y, 4);
+        for (usize i = 0; i < 4; ++i) {
+            EXIT_IF(c[i] != mul_i64(x[i], y[i]));
+        }
+    }
+    fprintf(stderr, ".\n");
+}
+
+#endif
@@ -16,9 +16,38 @@ static T* alloc(Buffer<T, N>* buffer) {
 }
 
 template <typename T, usize N>
-static T get(const Buffer<T, N>* buffer, usize i) {
-    EXIT_IF(buffer->len <= i);
-    return buffer->items[i];
+static T* alloc(Buffer<T, N>* buffer, usize n) {
+    EXIT_IF(N < (buffer->len + n));
+    T* items = &buffer->items[buffer->len];
+    buffer->len += n;
+    return items;
+}
+
+template <typename T>
+struct Span {
+    T*    items;
+    usize len;
+};
+
+// NOTE: Children are collected on the side and copied in once complete, so
+// any nodes allocated while building them cannot interleave with the span.
+template <typename T, usize N>
+static Span<T> get_span(Buffer<T, N>* buffer, const T* items, usize len) {
+    Span<T> span = {alloc(buffer, len), len};
+    for (usize i = 0; i < len; ++i) {
+        span.items[i] = items[i];
+    }
+    return span;
+}
+
+template <typename T>
+static bool contains(const Span<T>* span, T value) {
+    for (usize i = 0; i < span->len; ++i) {
+        if (span->items[i] == value) {
+            return true;
+        }
+    }
+    return false;
 }
 
 #endif
@@ -0,0 +1,1268 @@
+#ifndef __COMPILE_H__
+#define __COMPILE_H__
+
+#include "array.hpp"
+#include "parse.hpp"
+
+#define CAP_LOCALS   (1 << 5)
+#define JUMP_DENSITY 2
+
+#define GLOBAL_IF    (BINOP_AND + 1)
+#define GLOBAL_PRIMS (GLOBAL_IF + 1)
+#define GLOBAL_FUNCS (GLOBAL_PRIMS + PRIM_INPUT + 1)
+
+enum CompileMode {
+    COMPILE_LAZY = 0,
+    COMPILE_STRICT,
+    COMPILE_TAIL,
+};
+
+// NOTE: `depth` counts the stack items above the redex root at the point the
+// local was pushed, so `PUSH (depth - local->depth)` reaches it from anywhere
+// deeper in the same frame. A join point is never pushed; `join` is its code,
+// entered with `depth` items on the stack.
+struct Local {
+    String          name;
+    u32             depth;
+    ListNode<Inst>* join;
+    const Local*    next;
+};
+
+static const Local* find_local(const Local* local, String name) {
+    for (; local; local = local->next) {
+        if (local->name == name) {
+            return local;
+        }
+    }
+    return null;
+}
+
+static bool is_if(const Local* locals, const Spine* spine) {
+    return is_var(spine->head, GET_STRING("if")) && (spine->len == 3) &&
+           (!find_local(locals, GET_STRING("if")));
+}
+
+// NOTE: Whether every free occurrence of `name` in `expr` is a bare variable
+// whose value is the value of `expr`, through the `if`, `let` and `unpack`
+// cases that `compile_strict` and `compile_tail` carry their mode into.
+static bool is_tail_only(const Expr* expr, String name, bool shadows_if) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        const Spine spine = get_spine(expr);
+        if ((!shadows_if) && is_var(spine.head, GET_STRING("if")) &&
+            (spine.len == 3))
+        {
+            return (!is_free(spine.args[0], name)) &&
+                   is_tail_only(spine.args[1], name, shadows_if) &&
+                   is_tail_only(spine.args[2], name, shadows_if);
+        }
+        return !is_free(expr, name);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        bool                     bound = false;
+        for (usize i = 0; i < bindings->len; ++i) {
+            bound = bound || (bindings->items[i].name == name);
+            shadows_if =
+                shadows_if || (bindings->items[i].name == GET_STRING("if"));
+        }
+        if (bound && (expr->tag == EXPR_LETREC)) {
+            return true;
+        }
+        for (usize i = 0; i < bindings->len; ++i) {
+            if (is_free(bindings->items[i].expr, name)) {
+                return false;
+            }
+        }
+        return bound || is_tail_only(expr->body.as_let.expr, name, shadows_if);
+    }
+    case EXPR_UNPACK: {
+        if (is_free(expr->body.as_unpack.expr, name)) {
+            return false;
+        }
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        for (usize i = 0; i < branches->len; ++i) {
+            const ExprBranch* branch = &branches->items[i];
+            if ((!contains(&branch->args, name)) &&
+                (!is_tail_only(branch->expr,
+                               name,
+                               shadows_if ||
+                                   contains(&branch->args, GET_STRING("if")))))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    case EXPR_BINOP: {
+        return !is_free(expr, name);
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        return true;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: A binding of a strict or tail `let` that is only ever entered from
+// tail positions of the body (and, for `letrec`, not seen by any binding)
+// never escapes, so instead of allocating a thunk for it, its code runs in
+// place of the jump with the result going straight to the `let`'s own
+// continuation.
+static bool is_join(const Local* locals, const Expr* expr, usize index) {
+    const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+    const String             name = bindings->items[index].name;
+    bool                     shadows_if = find_local(locals, GET_STRING("if"));
+    for (usize i = 0; i < bindings->len; ++i) {
+        if ((i != index) && (bindings->items[i].name == name)) {
+            return false;
+        }
+        if ((expr->tag == EXPR_LETREC) &&
+            is_free(bindings->items[i].expr, name))
+        {
+            return false;
+        }
+        shadows_if =
+            shadows_if || (bindings->items[i].name == GET_STRING("if"));
+    }
+    return is_tail_only(expr->body.as_let.expr, name, shadows_if);
+}
+
+static bool is_saturated_pack(const Spine* spine) {
+    return (spine->head->tag == EXPR_PACK) &&
+           (spine->head->body.as_pack[1] == spine->len);
+}
+
+static InstTag get_inst_tag(BinOp binop) {
+    switch (binop) {
+    case BINOP_ADD: {
+        return INST_ADD;
+    }
+    case BINOP_SUB: {
+        return INST_SUB;
+    }
+    case BINOP_MUL: {
+        return INST_MUL;
+    }
+    case BINOP_DIV: {
+        return INST_DIV;
+    }
+    case BINOP_LT: {
+        return INST_LT;
+    }
+    case BINOP_LE: {
+        return INST_LE;
+    }
+    case BINOP_GT: {
+        return INST_GT;
+    }
+    case BINOP_GE: {
+        return INST_GE;
+    }
+    case BINOP_EQ: {
+        return INST_EQ;
+    }
+    case BINOP_NE: {
+        return INST_NE;
+    }
+    case BINOP_OR: {
+        return INST_OR;
+    }
+    case BINOP_AND: {
+        return INST_AND;
+    }
+    }
+    EXIT();
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* get_inst(InstMemory<N, J, G>* memory,
+                                InstTag              tag,
+                                i64                  value,
+                                ListNode<Inst>*      next) {
+    ListNode<Inst>* node = alloc(&memory->insts);
+    memory->depths[node - memory->insts.items] = 0;
+    node->value.tag = tag;
+    node->value.body.as_i64 = value;
+    node->next = next;
+    return node;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* get_return(InstMemory<N, J, G>* memory, u32 depth) {
+    ListNode<Inst>* next = get_inst(memory, INST_UNWIND, 0, null);
+    if (depth != 0) {
+        next = get_inst(memory, INST_POP, depth, next);
+    }
+    return get_inst(memory, INST_UPDATE, depth, next);
+}
+
+template <usize N, usize J, usize G>
+static u32 get_global(const InstMemory<N, J, G>* memory, String name) {
+    const u32* index = lookup(&memory->globals, name);
+    if (!index) {
+        print(stderr, name);
+        fprintf(stderr, "\n");
+        EXIT_WITH("unknown global");
+    }
+    return *index;
+}
+
+template <usize N, usize J, usize G>
+static bool is_prim(InstMemory<N, J, G>* memory,
+                    const Local*         locals,
+                    const Spine*         spine,
+                    Prim*                prim) {
+    if ((spine->head->tag != EXPR_VAR) ||
+        find_local(locals, spine->head->body.as_var))
+    {
+        return false;
+    }
+    const u32* index = lookup(&memory->globals, spine->head->body.as_var);
+    if ((!index) || (*index < GLOBAL_PRIMS) || (GLOBAL_FUNCS <= *index)) {
+        return false;
+    }
+    *prim = static_cast<Prim>(*index - GLOBAL_PRIMS);
+    return get_prim_arity(*prim) == spine->len;
+}
+
+// NOTE: A call to a known global with exactly as many arguments as it takes,
+// which can enter its code with the arguments on the stack instead of going
+// through an application spine. Arity zero is left alone so a global constant
+// is still updated in place and shared.
+template <usize N, usize J, usize G>
+static bool is_call(InstMemory<N, J, G>* memory,
+                    const Local*         locals,
+                    const Spine*         spine,
+                    u32*                 global) {
+    if ((spine->len == 0) || (spine->head->tag != EXPR_VAR) ||
+        find_local(locals, spine->head->body.as_var))
+    {
+        return false;
+    }
+    const u32* index = lookup(&memory->globals, spine->head->body.as_var);
+    if ((!index) || (*index < GLOBAL_FUNCS)) {
+        return false;
+    }
+    *global = *index;
+    return memory->codes.items[*index].arity == spine->len;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* get_call(InstMemory<N, J, G>* memory,
+                                InstTag              tag,
+                                u32                  global,
+                                u32                  depth,
+                                ListNode<Inst>*      next) {
+    ListNode<Inst>* node = get_inst(memory, tag, 0, next);
+    node->value.body.as_call = {global, depth};
+    return node;
+}
+
+// NOTE: Walks the code from `node`, entered with `height` items in the frame,
+// and returns the most it ever holds. Every path into a shared continuation
+// arrives with the same height, so each instruction is visited only once.
+template <usize N, usize J, usize G>
+static u32 get_depth(InstMemory<N, J, G>*  memory,
+                     const ListNode<Inst>* node,
+                     u32                   height) {
+    u32 depth = height;
+    for (; node; node = node->next) {
+        u32* seen = &memory->depths[node - memory->insts.items];
+        if (*seen != 0) {
+            EXIT_IF(*seen != height);
+            break;
+        }
+        *seen = height;
+        const Inst* inst = &node->value;
+        switch (inst->tag) {
+        case INST_UNWIND:
+        case INST_EVAL:
+        case INST_TAIL_CALL: {
+            break;
+        }
+        case INST_PUSH_GLOBAL:
+        case INST_PUSH_INT:
+        case INST_PUSH_UNDEF:
+        case INST_PUSH: {
+            ++height;
+            break;
+        }
+        case INST_POP:
+        case INST_SLIDE: {
+            height -= static_cast<u32>(inst->body.as_i64);
+            break;
+        }
+        case INST_ALLOC: {
+            height += static_cast<u32>(inst->body.as_i64);
+            break;
+        }
+        case INST_CALL: {
+            height -= memory->codes.items[inst->body.as_call.global].arity;
+            break;
+        }
+        case INST_PACK: {
+            height = (height + 1) - inst->body.as_pack.arity;
+            break;
+        }
+        case INST_JUMP: {
+            const InstJump* jump = &inst->body.as_jump;
+            for (u16 i = 0; i < jump->len; ++i) {
+                if (jump->insts[i]) {
+                    const u32 branch =
+                        get_depth(memory, jump->insts[i], height);
+                    depth = depth < branch ? branch : depth;
+                }
+            }
+            break;
+        }
+        case INST_SPLIT: {
+            height = (height - 1) + static_cast<u32>(inst->body.as_i64);
+            break;
+        }
+        case INST_COND: {
+            --height;
+            for (u8 i = 0; i < 2; ++i) {
+                const u32 branch =
+                    get_depth(memory, inst->body.as_cond.insts[i], height);
+                depth = depth < branch ? branch : depth;
+            }
+            break;
+        }
+        case INST_APP:
+        case INST_UPDATE:
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+        case INST_EQ:
+        case INST_NE:
+        case INST_LT:
+        case INST_LE:
+        case INST_GT:
+        case INST_GE:
+        case INST_OR:
+        case INST_AND: {
+            --height;
+            break;
+        }
+        case INST_PRIM: {
+            height = (height + 1) -
+                     get_prim_arity(static_cast<Prim>(inst->body.as_i64));
+            break;
+        }
+        }
+        depth = depth < height ? height : depth;
+    }
+    return depth;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_expr(InstMemory<N, J, G>*,
+                                    const Local*,
+                                    u32,
+                                    CompileMode,
+                                    const Expr*,
+                                    ListNode<Inst>*);
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_pack(InstMemory<N, J, G>* memory,
+                                    const Local*         locals,
+                                    u32                  depth,
+                                    const Spine*         spine,
+                                    ListNode<Inst>*      next) {
+    ListNode<Inst>* code = get_inst(memory, INST_PACK, 0, next);
+    code->value.body.as_pack.tag = spine->head->body.as_pack[0];
+    code->value.body.as_pack.arity = spine->head->body.as_pack[1];
+    for (usize i = 0; i < spine->len; ++i) {
+        code = compile_expr(memory,
+                            locals,
+                            depth + static_cast<u32>(spine->len - 1 - i),
+                            COMPILE_LAZY,
+                            spine->args[i],
+                            code);
+    }
+    return code;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_join(InstMemory<N, J, G>* memory,
+                                    u32                  depth,
+                                    const Local*         local) {
+    if (depth == local->depth) {
+        return local->join;
+    }
+    return get_inst(memory, INST_POP, depth - local->depth, local->join);
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_let(InstMemory<N, J, G>* memory,
+                                   const Local*         locals,
+                                   u32                  depth,
+                                   CompileMode          mode,
+                                   const Expr*          expr,
+                                   ListNode<Inst>*      next) {
+    Local       bindings[CAP_LOCALS];
+    const Expr* exprs[CAP_LOCALS];
+    u32         len = 0;
+    usize       joins[CAP_LOCALS];
+    u32         joins_len = 0;
+    for (usize i = 0; i < expr->body.as_let.bindings.len; ++i) {
+        const ExprBinding* binding = &expr->body.as_let.bindings.items[i];
+        if ((mode != COMPILE_LAZY) && is_join(locals, expr, i)) {
+            EXIT_IF(CAP_LOCALS <= joins_len);
+            joins[joins_len++] = i;
+            continue;
+        }
+        EXIT_IF(CAP_LOCALS <= len);
+        bindings[len].name = binding->name;
+        bindings[len].depth = depth + len + 1;
+        bindings[len].join = null;
+        bindings[len].next = len == 0 ? locals : &bindings[len - 1];
+        exprs[len++] = binding->expr;
+    }
+    const Local* inner = len == 0 ? locals : &bindings[len - 1];
+    if ((mode != COMPILE_TAIL) && (len != 0)) {
+        next = get_inst(memory, INST_SLIDE, len, next);
+    }
+    Local        points[CAP_LOCALS];
+    const Local* body = inner;
+    for (u32 i = 0; i < joins_len; ++i) {
+        const ExprBinding* binding =
+            &expr->body.as_let.bindings.items[joins[i]];
+        points[i].name = binding->name;
+        points[i].depth = depth + len;
+        points[i].join = compile_expr(memory,
+                                      expr->tag == EXPR_LET ? locals : inner,
+                                      depth + len,
+                                      mode,
+                                      binding->expr,
+                                      next);
+        points[i].next = body;
+        body = &points[i];
+    }
+    ListNode<Inst>* code = compile_expr(memory,
+                                        body,
+                                        depth + len,
+                                        mode,
+                                        expr->body.as_let.expr,
+                                        next);
+    if (expr->tag == EXPR_LET) {
+        for (u32 i = len; i != 0; --i) {
+            code = compile_expr(memory,
+                                locals,
+                                depth + i - 1,
+                                COMPILE_LAZY,
+                                exprs[i - 1],
+                                code);
+        }
+        return code;
+    }
+    for (u32 i = len; i != 0; --i) {
+        code = compile_expr(memory,
+                            inner,
+                            depth + len,
+                            COMPILE_LAZY,
+                            exprs[i - 1],
+                            get_inst(memory, INST_UPDATE, len - i, code));
+    }
+    return get_inst(memory, INST_ALLOC, len, code);
+}
+
+template <usize N, usize J, usize G>
+static InstJump get_table(InstMemory<N, J, G>*         memory,
+                          const ListNode<Inst>* const* insts,
+                          const u8*                    tags,
+                          u16                          len) {
+    InstJump jump = {};
+    if (len == 0) {
+        return jump;
+    }
+    u8 low = tags[0];
+    u8 high = tags[0];
+    for (u16 i = 1; i < len; ++i) {
+        low = tags[i] < low ? tags[i] : low;
+        high = high < tags[i] ? tags[i] : high;
+    }
+    const u16 range = static_cast<u16>((high - low) + 1);
+    if (range <= (JUMP_DENSITY * len)) {
+        const ListNode<Inst>** table = alloc(&memory->jumps, range);
+        for (u16 i = 0; i < range; ++i) {
+            table[i] = null;
+        }
+        for (u16 i = 0; i < len; ++i) {
+            EXIT_IF(table[tags[i] - low]);
+            table[tags[i] - low] = insts[i];
+        }
+        jump.insts = table;
+        jump.len = range;
+        jump.low = low;
+        return jump;
+    }
+    const ListNode<Inst>** table = alloc(&memory->jumps, len);
+    u8*                    sorted = alloc(&memory->tags, len);
+    for (u16 i = 0; i < len; ++i) {
+        u16 j = i;
+        for (; (j != 0) && (tags[i] < sorted[j - 1]); --j) {
+            sorted[j] = sorted[j - 1];
+            table[j] = table[j - 1];
+        }
+        EXIT_IF((j != 0) && (sorted[j - 1] == tags[i]));
+        sorted[j] = tags[i];
+        table[j] = insts[i];
+    }
+    jump.insts = table;
+    jump.tags = sorted;
+    jump.len = len;
+    jump.low = low;
+    return jump;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_unpack(InstMemory<N, J, G>* memory,
+                                      const Local*         locals,
+                                      u32                  depth,
+                                      CompileMode          mode,
+                                      const Expr*          expr,
+                                      ListNode<Inst>*      next) {
+    const ListNode<Inst>* insts[1 << 8];
+    u8                    tags[1 << 8];
+    u16                   len = 0;
+    const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+    for (const ExprBranch* branch = branches->items;
+         branch != &branches->items[branches->len];
+         ++branch)
+    {
+        EXIT_IF(CAP_LOCALS < branch->args.len);
+        Local     args[CAP_LOCALS];
+        const u32 n = static_cast<u32>(branch->args.len);
+        for (u32 i = 0; i < n; ++i) {
+            args[i].name = branch->args.items[i];
+            args[i].depth = depth + n - i;
+            args[i].join = null;
+            args[i].next = i == 0 ? locals : &args[i - 1];
+        }
+        ListNode<Inst>* code = next;
+        if ((mode != COMPILE_TAIL) && (n != 0)) {
+            code = get_inst(memory, INST_SLIDE, n, code);
+        }
+        code = compile_expr(memory,
+                            n == 0 ? locals : &args[n - 1],
+                            depth + n,
+                            mode,
+                            branch->expr,
+                            code);
+        EXIT_IF((1 << 8) <= len);
+        insts[len] = get_inst(memory, INST_SPLIT, n, code);
+        tags[len++] = branch->tag;
+    }
+    ListNode<Inst>* jump = get_inst(memory, INST_JUMP, 0, null);
+    jump->value.body.as_jump = get_table(memory, insts, tags, len);
+    return compile_expr(memory,
+                        locals,
+                        depth,
+                        COMPILE_STRICT,
+                        expr->body.as_unpack.expr,
+                        jump);
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_lift(InstMemory<N, J, G>* memory,
+                                    const Local*         locals,
+                                    u32                  depth,
+                                    const Expr*          expr,
+                                    ListNode<Inst>*      next) {
+    const Local* frees[CAP_LOCALS];
+    u32          len = 0;
+    for (const Local* local = locals; local; local = local->next) {
+        if ((find_local(locals, local->name) == local) &&
+            is_free(expr, local->name))
+        {
+            EXIT_IF(CAP_LOCALS <= len);
+            frees[len++] = local;
+        }
+    }
+    const u32 index = static_cast<u32>(memory->codes.len);
+    {
+        Local args[CAP_LOCALS];
+        for (u32 i = 0; i < len; ++i) {
+            args[i].name = frees[i]->name;
+            args[i].depth = len - i;
+            args[i].join = null;
+            args[i].next = i == 0 ? null : &args[i - 1];
+        }
+        InstCode* code = alloc(&memory->codes);
+        code->select = {};
+        code->arity = static_cast<u8>(len);
+        code->insts = compile_expr(memory,
+                                   len == 0 ? null : &args[len - 1],
+                                   len,
+                                   COMPILE_TAIL,
+                                   expr,
+                                   null);
+        code->depth = get_depth(memory, code->insts, len + 1);
+    }
+    for (u32 i = 0; i < len; ++i) {
+        next = get_inst(memory, INST_APP, 0, next);
+    }
+    next = get_inst(memory, INST_PUSH_GLOBAL, 0, next);
+    next->value.body.as_global = index;
+    for (u32 i = 0; i < len; ++i) {
+        next = get_inst(memory,
+                        INST_PUSH,
+                        (depth + len - 1 - i) - frees[i]->depth,
+                        next);
+    }
+    return next;
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_lazy(InstMemory<N, J, G>* memory,
+                                    const Local*         locals,
+                                    u32                  depth,
+                                    const Expr*          expr,
+                                    ListNode<Inst>*      next) {
+    switch (expr->tag) {
+    case EXPR_UNDEF: {
+        return get_inst(memory, INST_PUSH_UNDEF, 0, next);
+    }
+    case EXPR_U32: {
+        return get_inst(memory, INST_PUSH_INT, expr->body.as_u32, next);
+    }
+    case EXPR_VAR: {
+        const Local* local = find_local(locals, expr->body.as_var);
+        if (local) {
+            EXIT_IF(local->join);
+            return get_inst(memory, INST_PUSH, depth - local->depth, next);
+        }
+        next = get_inst(memory, INST_PUSH_GLOBAL, 0, next);
+        next->value.body.as_global = get_global(memory, expr->body.as_var);
+        return next;
+    }
+    case EXPR_BINOP: {
+        next = get_inst(memory,
+                        INST_PUSH_GLOBAL,
+                        0,
+                        get_inst(memory,
+                                 INST_APP,
+                                 0,
+                                 get_inst(memory, INST_APP, 0, next)));
+        next->value.body.as_global = expr->body.as_binop.op;
+        next = compile_lazy(memory,
+                            locals,
+                            depth + 1,
+                            expr->body.as_binop.args[0],
+                            next);
+        return compile_lazy(memory,
+                            locals,
+                            depth,
+                            expr->body.as_binop.args[1],
+                            next);
+    }
+    case EXPR_PACK: {
+        EXIT_IF(expr->body.as_pack[1] != 0);
+        const Spine spine = get_spine(expr);
+        return compile_pack(memory, locals, depth, &spine, next);
+    }
+    case EXPR_APP: {
+        const Spine spine = get_spine(expr);
+        if (is_saturated_pack(&spine)) {
+            return compile_pack(memory, locals, depth, &spine, next);
+        }
+        next = compile_lazy(memory,
+                            locals,
+                            depth + 1,
+                            expr->body.as_app[0],
+                            get_inst(memory, INST_APP, 0, next));
+        return compile_lazy(memory,
+                            locals,
+                            depth,
+                            expr->body.as_app[1],
+                            next);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        return compile_let(memory, locals, depth, COMPILE_LAZY, expr, next);
+    }
+    case EXPR_UNPACK: {
+        return compile_lift(memory, locals, depth, expr, next);
+    }
+    }
+    EXIT();
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_strict(InstMemory<N, J, G>* memory,
+                                      const Local*         locals,
+                                      u32                  depth,
+                                      const Expr*          expr,
+                                      ListNode<Inst>*      next) {
+    switch (expr->tag) {
+    case EXPR_U32:
+    case EXPR_PACK: {
+        return compile_lazy(memory, locals, depth, expr, next);
+    }
+    case EXPR_APP: {
+        const Spine spine = get_spine(expr);
+        if (is_saturated_pack(&spine)) {
+            return compile_pack(memory, locals, depth, &spine, next);
+        }
+        Prim prim;
+        if (is_prim(memory, locals, &spine, &prim)) {
+            next = get_inst(memory, INST_PRIM, prim, next);
+            for (usize i = 0; i < spine.len; ++i) {
+                next = compile_strict(
+                    memory,
+                    locals,
+                    depth + static_cast<u32>(spine.len - 1 - i),
+                    spine.args[i],
+                    next);
+            }
+            return next;
+        }
+        if (is_if(locals, &spine)) {
+            ListNode<Inst>* cond = get_inst(memory, INST_COND, 0, null);
+            cond->value.body.as_cond.insts[0] =
+                compile_strict(memory, locals, depth, spine.args[1], next);
+            cond->value.body.as_cond.insts[1] =
+                compile_strict(memory, locals, depth, spine.args[2], next);
+            return compile_strict(memory,
+                                  locals,
+                                  depth,
+                                  spine.args[0],
+                                  cond);
+        }
+        u32 global;
+        if (is_call(memory, locals, &spine, &global)) {
+            next = get_call(memory, INST_CALL, global, 0, next);
+            for (usize i = 0; i < spine.len; ++i) {
+                next = compile_lazy(
+                    memory,
+                    locals,
+                    depth + 1 + static_cast<u32>(spine.len - 1 - i),
+                    spine.args[i],
+                    next);
+            }
+            return get_inst(memory, INST_PUSH_UNDEF, 0, next);
+        }
+        break;
+    }
+    case EXPR_BINOP: {
+        next = get_inst(memory,
+                        get_inst_tag(expr->body.as_binop.op),
+                        0,
+                        next);
+        next = compile_strict(memory,
+                              locals,
+                              depth + 1,
+                              expr->body.as_binop.args[0],
+                              next);
+        return compile_strict(memory,
+                              locals,
+                              depth,
+                              expr->body.as_binop.args[1],
+                              next);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        return compile_let(memory, locals, depth, COMPILE_STRICT, expr, next);
+    }
+    case EXPR_UNPACK: {
+        return compile_unpack(memory,
+                              locals,
+                              depth,
+                              COMPILE_STRICT,
+                              expr,
+                              next);
+    }
+    case EXPR_VAR: {
+        const Local* local = find_local(locals, expr->body.as_var);
+        if (local && local->join) {
+            return compile_join(memory, depth, local);
+        }
+        break;
+    }
+    case EXPR_UNDEF: {
+        break;
+    }
+    }
+    return compile_lazy(memory,
+                        locals,
+                        depth,
+                        expr,
+                        get_inst(memory, INST_EVAL, 0, next));
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_tail(InstMemory<N, J, G>* memory,
+                                    const Local*         locals,
+                                    u32                  depth,
+                                    const Expr*          expr) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        const Spine spine = get_spine(expr);
+        Prim        prim;
+        if (is_saturated_pack(&spine) ||
+            is_prim(memory, locals, &spine, &prim))
+        {
+            return compile_strict(memory,
+                                  locals,
+                                  depth,
+                                  expr,
+                                  get_return(memory, depth));
+        }
+        if (is_if(locals, &spine)) {
+            ListNode<Inst>* cond = get_inst(memory, INST_COND, 0, null);
+            cond->value.body.as_cond.insts[0] =
+                compile_tail(memory, locals, depth, spine.args[1]);
+            cond->value.body.as_cond.insts[1] =
+                compile_tail(memory, locals, depth, spine.args[2]);
+            return compile_strict(memory,
+                                  locals,
+                                  depth,
+                                  spine.args[0],
+                                  cond);
+        }
+        u32 global;
+        if (is_call(memory, locals, &spine, &global)) {
+            ListNode<Inst>* code =
+                get_call(memory, INST_TAIL_CALL, global, depth, null);
+            for (usize i = 0; i < spine.len; ++i) {
+                code = compile_lazy(
+                    memory,
+                    locals,
+                    depth + static_cast<u32>(spine.len - 1 - i),
+                    spine.args[i],
+                    code);
+            }
+            return code;
+        }
+        break;
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        return compile_let(memory, locals, depth, COMPILE_TAIL, expr, null);
+    }
+    case EXPR_UNPACK: {
+        return compile_unpack(memory,
+                              locals,
+                              depth,
+                              COMPILE_TAIL,
+                              expr,
+                              null);
+    }
+    case EXPR_BINOP: {
+        return compile_strict(memory,
+                              locals,
+                              depth,
+                              expr,
+                              get_return(memory, depth));
+    }
+    case EXPR_VAR: {
+        const Local* local = find_local(locals, expr->body.as_var);
+        if (local && local->join) {
+            return compile_join(memory, depth, local);
+        }
+        break;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32: {
+        break;
+    }
+    }
+    return compile_lazy(memory,
+                        locals,
+                        depth,
+                        expr,
+                        get_return(memory, depth));
+}
+
+template <usize N, usize J, usize G>
+static ListNode<Inst>* compile_expr(InstMemory<N, J, G>* memory,
+                                    const Local*         locals,
+                                    u32                  depth,
+                                    CompileMode          mode,
+                                    const Expr*          expr,
+                                    ListNode<Inst>*      next) {
+    switch (mode) {
+    case COMPILE_LAZY: {
+        return compile_lazy(memory, locals, depth, expr, next);
+    }
+    case COMPILE_STRICT: {
+        return compile_strict(memory, locals, depth, expr, next);
+    }
+    case COMPILE_TAIL: {
+        return compile_tail(memory, locals, depth, expr);
+    }
+    }
+    EXIT();
+}
+
+static InstSelect get_select(const Func* func) {
+    InstSelect select = {};
+    if ((func->args.len != 1) || (func->expr->tag != EXPR_UNPACK) ||
+        (!is_var(func->expr->body.as_unpack.expr, func->args.items[0])))
+    {
+        return select;
+    }
+    const Span<ExprBranch>* branches = &func->expr->body.as_unpack.branches;
+    for (usize i = 0; i < branches->len; ++i) {
+        const ExprBranch* branch = &branches->items[i];
+        if (branch->expr->tag != EXPR_VAR) {
+            continue;
+        }
+        for (usize j = branch->args.len; j != 0; --j) {
+            if (branch->args.items[j - 1] == branch->expr->body.as_var) {
+                select.tag = branch->tag;
+                select.arity = static_cast<u8>(branch->args.len);
+                select.field = static_cast<u8>(j - 1);
+                return select;
+            }
+        }
+    }
+    return select;
+}
+
+template <usize N, usize J, usize G>
+static void compile_func(InstMemory<N, J, G>* memory,
+                         InstCode*            code,
+                         const Func*          func) {
+    EXIT_IF(CAP_LOCALS < func->args.len);
+    Local     args[CAP_LOCALS];
+    const u32 len = static_cast<u32>(func->args.len);
+    for (u32 i = 0; i < len; ++i) {
+        args[i].name = func->args.items[i];
+        args[i].depth = len - i;
+        args[i].join = null;
+        args[i].next = i == 0 ? null : &args[i - 1];
+    }
+    code->select = get_select(func);
+    code->arity = static_cast<u8>(len);
+    code->insts = compile_tail(memory,
+                               len == 0 ? null : &args[len - 1],
+                               len,
+                               func->expr);
+    code->depth = get_depth(memory, code->insts, len + 1);
+}
+
+// NOTE: Clears `memory` down to the built-in globals, the binary operators,
+// `if` and the primitives, which every program starts from.
+template <usize N, usize J, usize G>
+static void compile_prims(InstMemory<N, J, G>* memory) {
+    memory->insts.len = 0;
+    memory->jumps.len = 0;
+    memory->tags.len = 0;
+    memory->codes.len = 0;
+    for (usize i = 0; i < G; ++i) {
+        memory->globals.items[i].alive = false;
+    }
+    memory->globals.len = 0;
+    {
+        String      args[3] = {};
+        Expr        vars[3] = {};
+        const char* names[3] = {"x", "y", "z"};
+        for (usize i = 0; i < 3; ++i) {
+            args[i] = {names[i], 1};
+            vars[i].tag = EXPR_VAR;
+            vars[i].body.as_var = args[i];
+        }
+        Expr binop = {};
+        binop.tag = EXPR_BINOP;
+        binop.body.as_binop.args[0] = &vars[0];
+        binop.body.as_binop.args[1] = &vars[1];
+        Func func = {};
+        func.args = {args, 2};
+        func.expr = &binop;
+        func.tag = FUNC_BINOP;
+        for (u32 i = 0; i < GLOBAL_IF; ++i) {
+            binop.body.as_binop.op = static_cast<BinOp>(i);
+            func.name.as_binop = binop.body.as_binop.op;
+            compile_func(memory, alloc(&memory->codes), &func);
+        }
+        Expr op = {};
+        Expr apps[3] = {};
+        apps[0].tag = EXPR_APP;
+        apps[0].body.as_app[0] = &op;
+        apps[0].body.as_app[1] = &vars[0];
+        apps[1].tag = EXPR_APP;
+        apps[1].body.as_app[0] = &apps[0];
+        apps[1].body.as_app[1] = &vars[1];
+        apps[2].tag = EXPR_APP;
+        apps[2].body.as_app[0] = &apps[1];
+        apps[2].body.as_app[1] = &vars[2];
+        func.args.len = 3;
+        func.expr = &apps[2];
+        func.tag = FUNC_VAR;
+        func.name.as_var = GET_STRING("if");
+        op.tag = EXPR_VAR;
+        op.body.as_var = func.name.as_var;
+        insert(&memory->globals,
+               func.name.as_var,
+               static_cast<u32>(GLOBAL_IF));
+        compile_func(memory, alloc(&memory->codes), &func);
+    }
+    for (u32 i = 0; i < (GLOBAL_FUNCS - GLOBAL_PRIMS); ++i) {
+        const Prim      prim = static_cast<Prim>(i);
+        const u8        arity = get_prim_arity(prim);
+        ListNode<Inst>* insts =
+            get_inst(memory, INST_PRIM, prim, get_return(memory, arity));
+        for (u8 j = 0; j < arity; ++j) {
+            insts = get_inst(memory,
+                             INST_PUSH,
+                             arity - 1,
+                             get_inst(memory, INST_EVAL, 0, insts));
+        }
+        InstCode* code = alloc(&memory->codes);
+        code->insts = insts;
+        code->select = {};
+        code->arity = arity;
+        code->depth = get_depth(memory, insts, arity + 1u);
+        insert(&memory->globals, get_prim_name(prim), GLOBAL_PRIMS + i);
+    }
+}
+
+template <usize N, usize J, usize G, usize P>
+static void compile_program(InstMemory<N, J, G>*   memory,
+                            const Buffer<Func, P>* funcs) {
+    compile_prims(memory);
+    for (usize i = 0; i < funcs->len; ++i) {
+        const String name = funcs->items[i].name.as_var;
+        EXIT_IF(lookup(&memory->globals, name));
+        insert(&memory->globals, name, static_cast<u32>(GLOBAL_FUNCS + i));
+    }
+    alloc(&memory->codes, funcs->len);
+    for (usize i = 0; i < funcs->len; ++i) {
+        memory->codes.items[GLOBAL_FUNCS + i].arity =
+            static_cast<u8>(funcs->items[i].args.len);
+    }
+    for (usize i = 0; i < funcs->len; ++i) {
+        compile_func(memory,
+                     &memory->codes.items[GLOBAL_FUNCS + i],
+                     &funcs->items[i]);
+    }
+}
+
+template <usize N, usize J, usize G>
+static const ListNode<Inst>* get_code(InstMemory<N, J, G>* memory,
+                                      String               name) {
+    return memory->codes.items[get_global(memory, name)].insts;
+}
+
+static void expect_insts(const ListNode<Inst>* node,
+                         const InstTag*        tags,
+                         usize                 len) {
+    for (usize i = 0; i < len; ++i, node = node->next) {
+        EXIT_IF(!node);
+        EXIT_IF(node->value.tag != tags[i]);
+    }
+    EXIT_IF(node);
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize P,
+          usize N,
+          usize J,
+          usize G>
+static void test_compile_program(Tokens<T>*                  tokens,
+                                 ParseMemory<S, B, U, E, P>* parse_memory,
+                                 InstMemory<N, J, G>*        inst_memory) {
+    {
+        set_tokens(GET_STRING("nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "sum xs {\n"
+                              "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                              "}"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        EXIT_IF(inst_memory->codes.len != (GLOBAL_FUNCS + 3));
+        EXIT_IF(inst_memory->codes.items[GLOBAL_FUNCS].depth != 2);
+        EXIT_IF(inst_memory->codes.items[GLOBAL_FUNCS + 1].depth != 5);
+        EXIT_IF(inst_memory->codes.items[GLOBAL_FUNCS + 2].depth != 6);
+        {
+            const InstTag tags[] = {INST_PACK, INST_UPDATE, INST_UNWIND};
+            expect_insts(get_code(inst_memory, GET_STRING("nil")), tags, 3);
+        }
+        {
+            const InstTag tags[] = {
+                INST_PUSH,
+                INST_PUSH,
+                INST_PACK,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("cons"));
+            expect_insts(code, tags, 6);
+            EXIT_IF(code->value.body.as_i64 != 1);
+            EXIT_IF(code->next->value.body.as_i64 != 1);
+        }
+        {
+            const InstTag tags[] = {INST_PUSH, INST_EVAL, INST_JUMP};
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("sum"));
+            expect_insts(code, tags, 3);
+            const InstJump* jump = &code->next->next->value.body.as_jump;
+            EXIT_IF(jump->tags);
+            EXIT_IF(jump->low != 1);
+            EXIT_IF(jump->len != 2);
+            EXIT_IF(get_jump(jump, 0));
+            EXIT_IF(get_jump(jump, 3));
+            const InstTag tags1[] = {
+                INST_SPLIT,
+                INST_PUSH_INT,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            expect_insts(get_jump(jump, 1), tags1, 5);
+            const InstTag tags2[] = {
+                INST_SPLIT,
+                INST_PUSH_UNDEF,
+                INST_PUSH,
+                INST_CALL,
+                INST_PUSH,
+                INST_EVAL,
+                INST_ADD,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            const ListNode<Inst>* branch = get_jump(jump, 2);
+            expect_insts(branch, tags2, 10);
+            EXIT_IF(branch->next->next->value.body.as_i64 != 2);
+            EXIT_IF(branch->next->next->next->value.body.as_call.global !=
+                    (GLOBAL_FUNCS + 2));
+            EXIT_IF(branch->next->next->next->next->value.body.as_i64 != 1);
+            EXIT_IF(branch->next->next->next->next->next->next->next
+                        ->value.body.as_i64 != 3);
+        }
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("f x { unpack x { 7 = 1; 200 = 2; 9 = 3 } }\n"
+                              "g x { if x (x + 1) (x - 1) }\n"
+                              "h xs { pack 2 2 (unpack xs { 1 = xs }) xs }"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        {
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("f"))->next->next;
+            EXIT_IF(code->value.tag != INST_JUMP);
+            const InstJump* jump = &code->value.body.as_jump;
+            EXIT_IF(!jump->tags);
+            EXIT_IF(jump->len != 3);
+            EXIT_IF(jump->tags[0] != 7);
+            EXIT_IF(jump->tags[1] != 9);
+            EXIT_IF(jump->tags[2] != 200);
+            EXIT_IF(get_jump(jump, 8));
+            EXIT_IF(get_jump(jump, 201));
+            EXIT_IF(get_jump(jump, 9)->next->value.body.as_i64 != 3);
+            EXIT_IF(get_jump(jump, 200)->next->value.body.as_i64 != 2);
+        }
+        {
+            const InstTag tags[] = {INST_PUSH, INST_EVAL, INST_COND};
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("g"));
+            expect_insts(code, tags, 3);
+            const InstTag tags0[] = {
+                INST_PUSH_INT,
+                INST_PUSH,
+                INST_EVAL,
+                INST_ADD,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            expect_insts(code->next->next->value.body.as_cond.insts[0],
+                         tags0,
+                         7);
+        }
+        {
+            EXIT_IF(inst_memory->codes.len != (GLOBAL_FUNCS + 4));
+            const InstCode* lift = &inst_memory->codes.items[GLOBAL_FUNCS + 3];
+            EXIT_IF(lift->arity != 1);
+            const InstTag tags[] = {
+                INST_PUSH,
+                INST_PUSH,
+                INST_PUSH_GLOBAL,
+                INST_APP,
+                INST_PACK,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("h"));
+            expect_insts(code, tags, 8);
+            EXIT_IF(code->next->value.body.as_i64 != 1);
+            EXIT_IF(code->next->next->value.body.as_global !=
+                    (GLOBAL_FUNCS + 3));
+        }
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("j x { let { k = x + 1 } if x k 0 }\n"
+                              "g x y { h y x }\n"
+                              "h a b { a - b }\n"
+                              "fst p { unpack p { 3 a b = a } }\n"
+                              "tl xs { unpack xs { 1 = xs; 2 y ys = ys } }"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        {
+            const InstTag tags[] = {INST_PUSH, INST_EVAL, INST_COND};
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("j"));
+            expect_insts(code, tags, 3);
+            const InstTag tags0[] = {
+                INST_PUSH_INT,
+                INST_PUSH,
+                INST_EVAL,
+                INST_ADD,
+                INST_UPDATE,
+                INST_POP,
+                INST_UNWIND,
+            };
+            expect_insts(code->next->next->value.body.as_cond.insts[0],
+                         tags0,
+                         7);
+        }
+        {
+            const InstTag tags[] = {INST_PUSH, INST_PUSH, INST_TAIL_CALL};
+            const ListNode<Inst>* code =
+                get_code(inst_memory, GET_STRING("g"));
+            expect_insts(code, tags, 3);
+            EXIT_IF(code->value.body.as_i64 != 0);
+            EXIT_IF(code->next->value.body.as_i64 != 2);
+            const InstCall call = code->next->next->value.body.as_call;
+            EXIT_IF(call.global != (GLOBAL_FUNCS + 2));
+            EXIT_IF(call.depth != 2);
+        }
+        {
+            const InstCode* codes = &inst_memory->codes.items[GLOBAL_FUNCS];
+            EXIT_IF(codes[2].select.arity != 0);
+            EXIT_IF(codes[3].select.tag != 3);
+            EXIT_IF(codes[3].select.arity != 2);
+            EXIT_IF(codes[3].select.field != 0);
+            EXIT_IF(codes[4].select.tag != 2);
+            EXIT_IF(codes[4].select.arity != 2);
+            EXIT_IF(codes[4].select.field != 1);
+        }
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
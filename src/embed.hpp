@@ -0,0 +1,382 @@
+#ifndef __EMBED_H__
+#define __EMBED_H__
+
+#include "eval.hpp"
+
+#include <inttypes.h>
+
+// NOTE: A compiled program. Nothing here is written after `set_program`, so
+// one instance can back any number of `EvalMemory` contexts, each with its
+// own heap, stack and dump, running concurrently. The global names point into
+// the source and into the fuse memory, which both have to outlive the program.
+template <usize I, usize J, usize G>
+struct Program {
+    InstMemory<I, J, G> inst_memory;
+    NodeShared          shared;
+};
+
+enum ValueTag {
+    VALUE_I64 = 0,
+    VALUE_DATA,
+};
+
+typedef struct Value Value;
+
+struct ValueData {
+    const Value* fields;
+    u8           tag;
+    u8           arity;
+};
+
+union ValueBody {
+    i64       as_i64;
+    ValueData as_data;
+};
+
+struct Value {
+    ValueBody body;
+    ValueTag  tag;
+};
+
+static Value get_value(i64 value) {
+    Value result = {};
+    result.tag = VALUE_I64;
+    result.body.as_i64 = value;
+    return result;
+}
+
+static Value get_value(u8 tag, const Value* fields, u8 arity) {
+    Value result = {};
+    result.tag = VALUE_DATA;
+    result.body.as_data = {fields, tag, arity};
+    return result;
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize C,
+          usize R,
+          usize Q,
+          usize I,
+          usize J,
+          usize G>
+static List<Fusion> set_program(Program<I, J, G>*           program,
+                                Tokens<T>*                  tokens,
+                                ParseMemory<S, B, U, E, F>* parse_memory,
+                                FuseMemory<C, R, Q>*        fuse_memory,
+                                String                      source) {
+    set_tokens(source, tokens);
+    parse_program(tokens, parse_memory);
+    reset(fuse_memory);
+    const List<Fusion> fusions = fuse_program(parse_memory, fuse_memory);
+    simplify_program(parse_memory, fuse_memory);
+    compile_program(&program->inst_memory, &parse_memory->funcs);
+    memset(&program->shared, 0, sizeof(NodeShared));
+    set_shared_i64s(&program->shared);
+    set_shared_packs(&program->shared, &parse_memory->funcs);
+    return fusions;
+}
+
+static usize get_cells(const Value* value) {
+    switch (value->tag) {
+    case VALUE_I64: {
+        return 1;
+    }
+    case VALUE_DATA: {
+        usize cells = NODE_CELLS(value->body.as_data.arity);
+        for (u8 i = 0; i < value->body.as_data.arity; ++i) {
+            cells += get_cells(&value->body.as_data.fields[i]);
+        }
+        return cells;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: The caller reserves `get_cells(value)` beforehand, so nothing moves
+// while the nodes are linked together.
+template <usize N, usize S, usize D, usize G>
+static Node* put_value(EvalMemory<N, S, D, G>* memory, const Value* value) {
+    switch (value->tag) {
+    case VALUE_I64: {
+        return get_i64(memory, value->body.as_i64);
+    }
+    case VALUE_DATA: {
+        const ValueData data = value->body.as_data;
+        Node*           node =
+            get_pack(&memory->shared, get_heap(memory), data.tag, data.arity);
+        Node** fields = get_fields(node);
+        for (u8 i = 0; i < data.arity; ++i) {
+            fields[i] = put_value(memory, &data.fields[i]);
+        }
+        return node;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: Reads the node behind `handles.items[handle]` back out as a value,
+// forcing every field on the way. Handles are collector roots, so each step
+// re-reads its node after an evaluation that may have moved it. The last
+// field reuses the handle, so walking a list keeps neither the native stack
+// nor the heap growing.
+template <usize N, usize S, usize D, usize G, usize I, usize J, usize V>
+static void get_value(EvalMemory<N, S, D, G>*    memory,
+                      const InstMemory<I, J, G>* inst_memory,
+                      Buffer<Value, V>*          values,
+                      usize                      handle,
+                      Value*                     value) {
+    for (;;) {
+        Node* node = eval(memory, inst_memory, memory->handles.items[handle]);
+        memory->handles.items[handle] = node;
+        switch (get_tag(node)) {
+        case NODE_I64: {
+            *value = get_value(node->body.as_i64);
+            return;
+        }
+        case NODE_DATA: {
+            const u8 arity = get_arity(node);
+            Value*   fields = alloc(values, arity);
+            *value = get_value(get_pack_tag(node), fields, arity);
+            if (arity == 0) {
+                return;
+            }
+            for (u8 i = 0; i < (arity - 1); ++i) {
+                *alloc(&memory->handles) =
+                    get_fields(memory->handles.items[handle])[i];
+                get_value(memory,
+                          inst_memory,
+                          values,
+                          memory->handles.len - 1,
+                          &fields[i]);
+                --memory->handles.len;
+            }
+            memory->handles.items[handle] =
+                get_fields(memory->handles.items[handle])[arity - 1];
+            value = &fields[arity - 1];
+            break;
+        }
+        case NODE_UNDEF:
+        case NODE_APP:
+        case NODE_GLOBAL:
+        case NODE_INDIR:
+        case NODE_ARRAY:
+        case NODE_BLACKHOLE:
+        case NODE_FORWARD: {
+            EXIT_WITH("not a value");
+        }
+        }
+    }
+}
+
+// NOTE: Applies the global `name` to `args` and evaluates the result fully,
+// writing it (and any nested fields) into `values`. Only `memory` and
+// `values` are written to. A failure anywhere on the way sets the context up
+// again from the program, which loses what its globals had evaluated, puts
+// `values` back as it was and returns null, with what went wrong in
+// `FAILURE`. The caller's `RECOVER` is back in place either way.
+template <usize N, usize S, usize D, usize G, usize I, usize J, usize V>
+static const Value* call(EvalMemory<N, S, D, G>* memory,
+                         const Program<I, J, G>* program,
+                         Buffer<Value, V>*       values,
+                         String                  name,
+                         const Value*            args,
+                         u8                      len) {
+    jmp_buf*    outer = RECOVER;
+    jmp_buf     recover;
+    const usize start = values->len;
+    RECOVER = &recover;
+    if (setjmp(recover) != 0) {
+        RECOVER = outer;
+        values->len = start;
+        set_globals(memory, &program->inst_memory, &program->shared);
+        return null;
+    }
+    const u32 index = get_global(&program->inst_memory, name);
+    EXIT_IF(program->inst_memory.codes.items[index].arity != len);
+    usize cells = len;
+    for (u8 i = 0; i < len; ++i) {
+        cells += get_cells(&args[i]);
+    }
+    reserve(memory, cells);
+    Node* node = memory->roots[index];
+    for (u8 i = 0; i < len; ++i) {
+        node = alloc_app(get_heap(memory), node, put_value(memory, &args[i]));
+    }
+    const usize handle = memory->handles.len;
+    *alloc(&memory->handles) = node;
+    Value* value = alloc(values);
+    get_value(memory, &program->inst_memory, values, handle, value);
+    memory->handles.len = handle;
+    RECOVER = outer;
+    return value;
+}
+
+template <usize C>
+static void put_chars(Buffer<char, C>* chars, const char* source, usize len) {
+    memcpy(alloc(chars, len), source, len);
+}
+
+// NOTE: The last field is written in a loop rather than by recursion, the
+// same way `get_value` reads it, so long lists print in constant stack.
+template <usize C>
+static void put_value(Buffer<char, C>* chars, const Value* value) {
+    char  digits[64];
+    usize closes = 0;
+    for (;;) {
+        if (value->tag == VALUE_I64) {
+            const i32 len = snprintf(digits,
+                                     sizeof(digits),
+                                     "%" PRId64,
+                                     value->body.as_i64);
+            EXIT_IF(len <= 0);
+            put_chars(chars, digits, static_cast<usize>(len));
+            break;
+        }
+        const ValueData data = value->body.as_data;
+        const i32       len = snprintf(digits,
+                                       sizeof(digits),
+                                       "(pack %u %u",
+                                       data.tag,
+                                       data.arity);
+        EXIT_IF(len <= 0);
+        put_chars(chars, digits, static_cast<usize>(len));
+        if (data.arity == 0) {
+            put_chars(chars, ")", 1);
+            break;
+        }
+        for (u8 i = 0; i < (data.arity - 1); ++i) {
+            put_chars(chars, " ", 1);
+            put_value(chars, &data.fields[i]);
+        }
+        put_chars(chars, " ", 1);
+        value = &data.fields[data.arity - 1];
+        ++closes;
+    }
+    for (; closes != 0; --closes) {
+        put_chars(chars, ")", 1);
+    }
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize C,
+          usize R,
+          usize Q,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize D,
+          usize V>
+static void test_call(Tokens<T>*                  tokens,
+                      ParseMemory<S, B, U, E, F>* parse_memory,
+                      FuseMemory<C, R, Q>*        fuse_memory,
+                      Program<I, J, G>*           program,
+                      EvalMemory<N, K, D, G>*     contexts,
+                      Buffer<Value, V>*           values) {
+    const List<Fusion> fusions =
+        set_program(program,
+                    tokens,
+                    parse_memory,
+                    fuse_memory,
+                    GET_STRING("nil { pack 1 0 }\n"
+                               "cons x xs { pack 2 2 x xs }\n"
+                               "range a b {\n"
+                               "  if (b <= a) nil (cons a (range (a + 1) b))\n"
+                               "}\n"
+                               "map k xs {\n"
+                               "  unpack xs {\n"
+                               "    1 = nil;\n"
+                               "    2 y ys = cons (y * k) (map k ys)\n"
+                               "  }\n"
+                               "}\n"
+                               "sum xs {\n"
+                               "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                               "}\n"
+                               "main { sum (range 0 30) }"));
+    EXIT_IF((!fusions.first) || (fusions.first != fusions.last));
+    EXIT_IF(fusions.first->value.consumer != GET_STRING("sum"));
+    EXIT_IF(fusions.first->value.producer != GET_STRING("range"));
+    memset(parse_memory, 0, sizeof(ParseMemory<S, B, U, E, F>));
+    set_globals(&contexts[0], &program->inst_memory, &program->shared);
+    set_globals(&contexts[1], &program->inst_memory, &program->shared);
+    {
+        values->len = 0;
+        const Value* value =
+            call(&contexts[0], program, values, GET_STRING("main"), null, 0);
+        EXIT_IF(value->tag != VALUE_I64);
+        EXIT_IF(value->body.as_i64 != 435);
+        fprintf(stderr, ".");
+    }
+    {
+        values->len = 0;
+        const Value  args[] = {get_value(3), get_value(1000)};
+        const Value* list =
+            call(&contexts[1], program, values, GET_STRING("range"), args, 2);
+        for (i64 i = 3; i < 1000; ++i) {
+            EXIT_IF(list->tag != VALUE_DATA);
+            EXIT_IF(list->body.as_data.tag != 2);
+            EXIT_IF(list->body.as_data.fields[0].body.as_i64 != i);
+            list = &list->body.as_data.fields[1];
+        }
+        EXIT_IF(list->body.as_data.tag != 1);
+        EXIT_IF(list->body.as_data.arity != 0);
+        fprintf(stderr, ".");
+    }
+    {
+        values->len = 0;
+        const Value  cells[] = {get_value(-7), get_value(1, null, 0)};
+        const Value  args[] = {get_value(1000), get_value(2, cells, 2)};
+        const Value* list =
+            call(&contexts[0], program, values, GET_STRING("map"), args, 2);
+        const Value* sum =
+            call(&contexts[1], program, values, GET_STRING("sum"), list, 1);
+        EXIT_IF(sum->body.as_i64 != -7000);
+        const Value* total =
+            call(&contexts[0], program, values, GET_STRING("main"), null, 0);
+        EXIT_IF(total->body.as_i64 != 435);
+        fprintf(stderr, ".");
+    }
+    {
+        values->len = 0;
+        const InstMemory<I, J, G>* inst_memory = &program->inst_memory;
+        const u32 global = get_global(inst_memory, GET_STRING("main"));
+        u64       fuel = 50;
+        set_globals(&contexts[0], inst_memory, &program->shared);
+        start_eval(&contexts[0], inst_memory, contexts[0].roots[global]);
+        EXIT_IF(resume_eval(&contexts[0], inst_memory, &fuel, 0) != EVAL_FUEL);
+        abandon_eval(&contexts[0], inst_memory);
+        const Value* value =
+            call(&contexts[0], program, values, GET_STRING("main"), null, 0);
+        EXIT_IF(value->body.as_i64 != 435);
+        fprintf(stderr, ".");
+    }
+    {
+        values->len = 0;
+        const Value  args[] = {get_value(1), get_value(0)};
+        EXIT_IF(
+            call(&contexts[1], program, values, GET_STRING("range"), args, 1));
+        EXIT_IF(
+            call(&contexts[1], program, values, GET_STRING("map"), args, 2));
+        EXIT_IF(!FAILURE);
+        EXIT_IF(values->len != 0);
+        EXIT_IF(contexts[1].handles.len != 0);
+        const Value* value =
+            call(&contexts[1], program, values, GET_STRING("main"), null, 0);
+        EXIT_IF(value->body.as_i64 != 435);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
@@ -0,0 +1,1488 @@
+#ifndef __EVAL_H__
+#define __EVAL_H__
+
+#include "compile.hpp"
+#include "gc.hpp"
+#include "input.hpp"
+#include "profile.hpp"
+#include "share.hpp"
+#include "simplify.hpp"
+
+#include <time.h>
+
+#ifndef EVAL_SLICE
+    #define EVAL_SLICE (1 << 10)
+#endif
+
+STATIC_ASSERT(0 < EVAL_SLICE);
+
+#ifndef EVAL_SEGMENTS
+    #define EVAL_SEGMENTS (1 << 8)
+#endif
+
+STATIC_ASSERT(0 < EVAL_SEGMENTS);
+
+enum EvalStatus {
+    EVAL_DONE = 0,
+    EVAL_FUEL,
+    EVAL_DEADLINE,
+};
+
+// NOTE: The spine stack and the dump grow in segments of `S` items and `D`
+// frames. A frame that would not fit in what is left of the current segment
+// (its code's `depth`, or its spine as `unwind` pushes it) moves into a new
+// one, which is released again when that frame returns; a frame never reaches
+// below its own segment, so nothing else has to know.
+template <usize S, usize D>
+struct EvalSegment {
+    Buffer<Node*, S>     stack;
+    Buffer<InstFrame, D> dump;
+    EvalSegment<S, D>*   prev;
+};
+
+// NOTE: `peak` and `links` count over the life of the context; setting its
+// globals up again, as happens after every failure, leaves them be.
+struct SegmentStats {
+    usize len;
+    usize peak;
+    usize links;
+};
+
+// NOTE: What native code sees of a context while it runs: the innermost
+// segment's stack and dump, the current heap, and the nodes it can push
+// without allocating. The lengths, `producer` and `budget` (the instructions
+// it may still run) are read back once it returns, along with the
+// instruction the interpreter carries on from.
+struct EvalRegs {
+    Node**                stack;
+    usize                 stack_len;
+    usize                 stack_cap;
+    InstFrame*            dump;
+    usize                 dump_len;
+    usize                 dump_cap;
+    usize                 linked;
+    Node*                 heap;
+    usize                 heap_len;
+    usize                 heap_cap;
+    Node* const*          roots;
+    Node*                 i64s;
+    Node*                 packs;
+    Node*                 undef;
+    u64                   budget;
+    const ListNode<Inst>* next;
+    u32                   producer;
+};
+
+// NOTE: Native code for the instructions of one `InstMemory`, starting at
+// `insts`; `entries` holds the entry point of each instruction, or null.
+struct EvalNative {
+    const ListNode<Inst>* insts;
+    const void* const*    entries;
+    usize                 len;
+    void (*run)(EvalRegs*, const void*);
+};
+
+template <usize N, usize S, usize D, usize G>
+struct EvalMemory {
+    Buffer<Node, N>       heaps[2];
+    EvalSegment<S, D>     first;
+    EvalSegment<S, D>*    segment;
+    EvalSegment<S, D>*    spare;
+    SegmentStats          segments;
+    Buffer<Node*, S>      handles;
+    const ListNode<Inst>* code;
+    const InstCode*       codes;
+    NodeTable<N * 2>*     conses;
+    Node                  globals[G];
+    Node*                 roots[G];
+    NodeShared            shared;
+    Node                  undef;
+    Input                 input;
+    HeapProfile<N, G>*    profile;
+    const EvalNative*     native;
+    u32                   producer;
+    u32                   slice;
+    u8                    heap;
+};
+
+template <usize N, usize S, usize D, usize G>
+static Buffer<Node, N>* get_heap(EvalMemory<N, S, D, G>* memory) {
+    return &memory->heaps[memory->heap];
+}
+
+template <usize N, usize S, usize D, usize G>
+static Buffer<Node*, S>* get_stack(EvalMemory<N, S, D, G>* memory) {
+    return &memory->segment->stack;
+}
+
+template <usize N, usize S, usize D, usize G>
+static Buffer<InstFrame, D>* get_dump(EvalMemory<N, S, D, G>* memory) {
+    return &memory->segment->dump;
+}
+
+template <usize N, usize S, usize D, usize G>
+static void link_segment(EvalMemory<N, S, D, G>* memory) {
+    EXIT_IF(EVAL_SEGMENTS <= memory->segments.len);
+    EvalSegment<S, D>* segment = memory->spare;
+    memory->spare = null;
+    if (!segment) {
+        segment = reinterpret_cast<EvalSegment<S, D>*>(
+            calloc(1, sizeof(EvalSegment<S, D>)));
+        EXIT_IF(!segment);
+    }
+    segment->stack.len = 0;
+    segment->dump.len = 0;
+    segment->prev = memory->segment;
+    memory->segment = segment;
+    ++memory->segments.len;
+    ++memory->segments.links;
+    if (memory->segments.peak < memory->segments.len) {
+        memory->segments.peak = memory->segments.len;
+    }
+}
+
+// NOTE: One segment is kept back as a spare, so a recursion that keeps
+// crossing the same boundary does not allocate on every call.
+template <usize N, usize S, usize D, usize G>
+static void unlink_segment(EvalMemory<N, S, D, G>* memory) {
+    EvalSegment<S, D>* segment = memory->segment;
+    memory->segment = segment->prev;
+    --memory->segments.len;
+    if (memory->spare) {
+        free(segment);
+    } else {
+        memory->spare = segment;
+    }
+}
+
+template <usize N, usize S, usize D, usize G>
+static void reset_segments(EvalMemory<N, S, D, G>* memory) {
+    if (memory->segment) {
+        while (memory->segment->prev) {
+            unlink_segment(memory);
+        }
+    }
+    free(memory->spare);
+    memory->spare = null;
+    memory->segment = &memory->first;
+    memory->segments.len = 1;
+    if (memory->segments.peak == 0) {
+        memory->segments.peak = 1;
+    }
+    memory->first.stack.len = 0;
+    memory->first.dump.len = 0;
+    memory->first.prev = null;
+}
+
+static void print(File* stream, const SegmentStats* stats) {
+    fprintf(stream,
+            "stack %zu segments (peak %zu, %zu links)\n",
+            stats->len,
+            stats->peak,
+            stats->links);
+}
+
+static u64 get_nanos() {
+    struct timespec time;
+    EXIT_IF(clock_gettime(CLOCK_MONOTONIC, &time) != 0);
+    return (static_cast<u64>(time.tv_sec) * 1000000000) +
+           static_cast<u64>(time.tv_nsec);
+}
+
+// NOTE: Moves everything reachable from `roots` into `to`. When profiling,
+// the cells this keeps alive that no earlier root did are added to the
+// retainer counter at `retainer`.
+template <usize N, usize S, usize D, usize G>
+static void retain(EvalMemory<N, S, D, G>* memory,
+                   const Buffer<Node, N>*  from,
+                   Buffer<Node, N>*        to,
+                   const CellTags*         tags,
+                   Node**                  roots,
+                   usize                   len,
+                   usize                   retainer) {
+    const usize scanned = to->len;
+    copy_roots(from, to, memory->codes, tags, roots, len);
+    scan(from, to, memory->codes, tags, scanned);
+    if (memory->profile) {
+        memory->profile->by_retainer[retainer] += to->len - scanned;
+    }
+}
+
+template <usize N, usize S, usize D, usize G>
+static void reserve(EvalMemory<N, S, D, G>* memory, usize n) {
+    if (n <= (N - get_heap(memory)->len)) {
+        return;
+    }
+    HeapProfile<N, G>* profile = memory->profile;
+    const u8           heap = memory->heap;
+    Buffer<Node, N>*   from = get_heap(memory);
+    memory->heap ^= 1;
+    Buffer<Node, N>* to = get_heap(memory);
+    to->len = 0;
+    CellTags        cell_tags = {};
+    const CellTags* tags = null;
+    if (profile) {
+        mark(profile, heap, from, memory->producer);
+        memset(profile->by_retainer, 0, sizeof(profile->by_retainer));
+        cell_tags = {profile->producers[heap],
+                     profile->producers[memory->heap]};
+        tags = &cell_tags;
+        for (usize i = 0; i < G; ++i) {
+            retain(memory, from, to, tags, &memory->roots[i], 1, i);
+        }
+    } else {
+        retain(memory, from, to, tags, memory->roots, G, G);
+    }
+    for (EvalSegment<S, D>* segment = memory->segment; segment;
+         segment = segment->prev)
+    {
+        retain(memory,
+               from,
+               to,
+               tags,
+               segment->stack.items,
+               segment->stack.len,
+               G);
+    }
+    retain(memory,
+           from,
+           to,
+           tags,
+           memory->handles.items,
+           memory->handles.len,
+           G + 1);
+    from->len = 0;
+    sweep(memory->conses);
+    if (profile) {
+        sample(profile, memory->heap, to, get_nanos());
+    }
+    if ((N - to->len) < n) {
+        EXIT_WITH("heap exhausted");
+    }
+}
+
+template <usize N, usize S, usize D, usize G>
+static Node* get_i64(EvalMemory<N, S, D, G>* memory, i64 value) {
+    Buffer<Node, N>* heap = get_heap(memory);
+    return share(memory->conses, heap, get_i64(&memory->shared, heap, value));
+}
+
+template <usize N, usize S, usize D, usize G>
+static void push(EvalMemory<N, S, D, G>* memory, Node* node) {
+    *alloc(get_stack(memory)) = node;
+}
+
+template <usize N, usize S, usize D, usize G>
+static Node* pop(EvalMemory<N, S, D, G>* memory) {
+    Buffer<Node*, S>* stack = get_stack(memory);
+    EXIT_IF(stack->len == 0);
+    return stack->items[--stack->len];
+}
+
+template <usize N, usize S, usize D, usize G>
+static Node** peek(EvalMemory<N, S, D, G>* memory, usize offset) {
+    Buffer<Node*, S>* stack = get_stack(memory);
+    EXIT_IF(stack->len <= offset);
+    return &stack->items[stack->len - 1 - offset];
+}
+
+template <usize N, usize S, usize D, usize G>
+static usize get_base(EvalMemory<N, S, D, G>* memory) {
+    const Buffer<InstFrame, D>* dump = get_dump(memory);
+    return dump->len == 0 ? 0 : dump->items[dump->len - 1].base;
+}
+
+template <usize N, usize S, usize D, usize G>
+static Node* pop_i64(EvalMemory<N, S, D, G>* memory) {
+    Node* node = follow_indirs(pop(memory));
+    EXIT_IF(get_tag(node) != NODE_I64);
+    return node;
+}
+
+template <usize N, usize S, usize D, usize G>
+static bool is_whnf(EvalMemory<N, S, D, G>* memory, const Node* node) {
+    switch (get_tag(node)) {
+    case NODE_I64:
+    case NODE_DATA:
+    case NODE_ARRAY: {
+        return true;
+    }
+    case NODE_GLOBAL: {
+        return (get_stack(memory)->len - 1 - get_base(memory)) <
+               get_arity(node);
+    }
+    case NODE_UNDEF:
+    case NODE_APP:
+    case NODE_INDIR:
+    case NODE_BLACKHOLE:
+    case NODE_FORWARD: {
+        return false;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: Points global `index` back at its code, dropping whatever it had
+// been evaluated to.
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static void reset_global(EvalMemory<N, S, D, G>*    memory,
+                         const InstMemory<I, J, G>* inst_memory,
+                         usize                      index) {
+    const u8 arity = index < inst_memory->codes.len
+                         ? inst_memory->codes.items[index].arity
+                         : 0;
+    memory->globals[index].header =
+        NODE_GLOBAL | (static_cast<usize>(arity) << NODE_ARITY);
+    memory->globals[index].body.as_global = static_cast<u32>(index);
+    memory->roots[index] = &memory->globals[index];
+}
+
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static void reset_globals(EvalMemory<N, S, D, G>*    memory,
+                          const InstMemory<I, J, G>* inst_memory) {
+    memory->heaps[0].len = 0;
+    memory->heaps[1].len = 0;
+    reset_segments(memory);
+    memory->handles.len = 0;
+    memory->code = null;
+    memory->codes = inst_memory->codes.items;
+    if (memory->profile) {
+        memory->profile->marked = 0;
+    }
+    memory->producer = G;
+    memory->slice = EVAL_SLICE;
+    memory->heap = 0;
+    memory->undef.header = NODE_UNDEF;
+    if (memory->conses) {
+        reset(memory->conses);
+    }
+    for (usize i = 0; i < G; ++i) {
+        reset_global(memory, inst_memory, i);
+    }
+}
+
+// NOTE: Only reads `inst_memory` and `shared`, so any number of contexts can
+// be set up from (and then run against) the same compiled program.
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static void set_globals(EvalMemory<N, S, D, G>*    memory,
+                        const InstMemory<I, J, G>* inst_memory,
+                        const NodeShared*          shared) {
+    reset_globals(memory, inst_memory);
+    memory->shared = *shared;
+}
+
+template <usize N, usize S, usize D, usize G, usize I, usize J, usize F>
+static void set_globals(EvalMemory<N, S, D, G>*    memory,
+                        const InstMemory<I, J, G>* inst_memory,
+                        const Buffer<Func, F>*     funcs) {
+    reset_globals(memory, inst_memory);
+    set_shared_i64s(&memory->shared);
+    set_shared_packs(&memory->shared, funcs);
+}
+
+// NOTE: The sharing table spans both halves of the heap, so it is only
+// allocated for a context that turns sharing on.
+template <usize N, usize S, usize D, usize G>
+static void set_sharing(EvalMemory<N, S, D, G>* memory, bool enabled) {
+    if (enabled && (!memory->conses)) {
+        memory->conses = reinterpret_cast<NodeTable<N * 2>*>(
+            calloc(1, sizeof(NodeTable<N * 2>)));
+        EXIT_IF(!memory->conses);
+    } else if (!enabled) {
+        free(memory->conses);
+        memory->conses = null;
+    }
+}
+
+// NOTE: A direct call has no application to overwrite; its root is
+// `memory->undef`, which the result simply replaces on the stack.
+template <usize N, usize S, usize D, usize G>
+static void update(EvalMemory<N, S, D, G>* memory, usize offset) {
+    Node*  value = follow_indirs(pop(memory));
+    Node** root = peek(memory, offset);
+    Node*  node = *root;
+    if (node == &memory->undef) {
+        *root = value;
+        return;
+    }
+    if (node == value) {
+        return;
+    }
+    if ((get_tag(value) == NODE_I64) ||
+        ((get_tag(value) == NODE_DATA) && (get_arity(value) == 0)))
+    {
+        *node = *value;
+        return;
+    }
+    set_indir(node, value);
+}
+
+template <usize N, usize S, usize D, usize G>
+static void rearrange(EvalMemory<N, S, D, G>* memory, u8 arity) {
+    Node** items = peek(memory, arity);
+    for (u8 i = arity; i != 0; --i) {
+        items[i] = get_app_arg(items[i - 1]);
+    }
+}
+
+template <usize N, usize S, usize D, usize G>
+static Node* peek_array(EvalMemory<N, S, D, G>* memory, usize offset) {
+    Node** node = peek(memory, offset);
+    *node = follow_indirs(*node);
+    EXIT_IF(get_tag(*node) != NODE_ARRAY);
+    return *node;
+}
+
+template <usize N, usize S, usize D, usize G>
+static i64 peek_i64(EvalMemory<N, S, D, G>* memory, usize offset) {
+    Node** node = peek(memory, offset);
+    *node = follow_indirs(*node);
+    EXIT_IF(get_tag(*node) != NODE_I64);
+    return (*node)->body.as_i64;
+}
+
+// NOTE: Arguments are already evaluated, first argument on top. Sizes are read
+// before `reserve` since collecting moves the operands. A range can be longer
+// than any `i64`, so its length is taken unsigned and checked against the
+// heap before it is turned into cells.
+template <usize N, usize S, usize D, usize G>
+static void eval_prim(EvalMemory<N, S, D, G>* memory, Prim prim) {
+    Node* node = null;
+    switch (prim) {
+    case PRIM_FILL: {
+        const i64 len = peek_i64(memory, 0);
+        EXIT_IF(len < 0);
+        reserve(memory, NODE_CELLS(len));
+        node = alloc_array(get_heap(memory), static_cast<usize>(len));
+        fill_i64s(get_i64s(node),
+                  static_cast<usize>(len),
+                  peek_i64(memory, 1));
+        break;
+    }
+    case PRIM_RANGE: {
+        const i64 low = peek_i64(memory, 0);
+        const i64 high = peek_i64(memory, 1);
+        const u64 len =
+            low < high ? static_cast<u64>(high) - static_cast<u64>(low) : 0;
+        if (N < len) {
+            EXIT_WITH("heap exhausted");
+        }
+        reserve(memory, NODE_CELLS(len));
+        node = alloc_array(get_heap(memory), static_cast<usize>(len));
+        range_i64s(get_i64s(node), static_cast<usize>(len), low);
+        break;
+    }
+    case PRIM_LEN: {
+        reserve(memory, 1);
+        node = get_i64(memory,
+                       static_cast<i64>(get_array_len(peek_array(memory, 0))));
+        break;
+    }
+    case PRIM_GET: {
+        reserve(memory, 1);
+        Node*     array = peek_array(memory, 0);
+        const i64 i = peek_i64(memory, 1);
+        EXIT_IF((i < 0) || (get_array_len(array) <= static_cast<usize>(i)));
+        node = get_i64(memory, get_i64s(array)[i]);
+        break;
+    }
+    case PRIM_SLICE: {
+        const usize len = get_array_len(peek_array(memory, 0));
+        const i64   low = peek_i64(memory, 1);
+        const i64   high = peek_i64(memory, 2);
+        EXIT_IF((low < 0) || (high < low) ||
+                (len < static_cast<usize>(high)));
+        reserve(memory, NODE_CELLS(high - low));
+        node = alloc_array(get_heap(memory), static_cast<usize>(high - low));
+        memcpy(get_i64s(node),
+               &get_i64s(peek_array(memory, 0))[low],
+               sizeof(i64) * static_cast<usize>(high - low));
+        break;
+    }
+    case PRIM_ADD:
+    case PRIM_SUB:
+    case PRIM_MUL: {
+        const usize len = get_array_len(peek_array(memory, 0));
+        EXIT_IF(get_array_len(peek_array(memory, 1)) != len);
+        reserve(memory, NODE_CELLS(len));
+        node = alloc_array(get_heap(memory), len);
+        const i64* a = get_i64s(peek_array(memory, 0));
+        const i64* b = get_i64s(peek_array(memory, 1));
+        if (prim == PRIM_ADD) {
+            add_i64s(get_i64s(node), a, b, len);
+        } else if (prim == PRIM_SUB) {
+            sub_i64s(get_i64s(node), a, b, len);
+        } else {
+            mul_i64s(get_i64s(node), a, b, len);
+        }
+        break;
+    }
+    case PRIM_SUM: {
+        reserve(memory, 1);
+        Node* array = peek_array(memory, 0);
+        node = get_i64(memory,
+                       sum_i64s(get_i64s(array), get_array_len(array)));
+        break;
+    }
+    case PRIM_EQ: {
+        reserve(memory, 1);
+        Node*       a = peek_array(memory, 0);
+        Node*       b = peek_array(memory, 1);
+        const usize len = get_array_len(a);
+        node = get_i64(memory,
+                       (a == b) ||
+                           ((get_array_len(b) == len) &&
+                            eq_i64s(get_i64s(a), get_i64s(b), len)));
+        break;
+    }
+    case PRIM_INPUT: {
+        const i64 offset = peek_i64(memory, 0);
+        EXIT_IF(offset < 0);
+        reserve(memory, INPUT_CELLS);
+        node = decode_input(&memory->input,
+                            &memory->shared,
+                            get_heap(memory),
+                            memory->roots[GLOBAL_PRIMS + PRIM_INPUT],
+                            static_cast<usize>(offset));
+        break;
+    }
+    }
+    get_stack(memory)->len -= get_prim_arity(prim);
+    push(memory, node);
+}
+
+// NOTE: When profiling, the cells allocated so far go to the global that was
+// running until now.
+template <usize N, usize S, usize D, usize G>
+static void set_producer(EvalMemory<N, S, D, G>* memory, u32 global) {
+    if (memory->profile && (memory->producer != global)) {
+        mark(memory->profile,
+             memory->heap,
+             get_heap(memory),
+             memory->producer);
+    }
+    memory->producer = global;
+}
+
+// NOTE: Opens a frame over the top `arity + 1` items that grows to `depth`
+// items, moving them into a new segment first when the current one is too
+// full.
+template <usize N, usize S, usize D, usize G>
+static void enter(EvalMemory<N, S, D, G>* memory,
+                  const ListNode<Inst>*   code,
+                  u8                      arity,
+                  usize                   depth) {
+    const usize len = static_cast<usize>(arity) + 1;
+    Buffer<Node*, S>* from = get_stack(memory);
+    EXIT_IF((from->len < len) || (S < depth));
+    if (((S - (from->len - len)) < depth) || (get_dump(memory)->len == D)) {
+        from->len -= len;
+        link_segment(memory);
+        memcpy(alloc(get_stack(memory), len),
+               &from->items[from->len],
+               sizeof(Node*) * len);
+    }
+    *alloc(get_dump(memory)) = {code,
+                                get_stack(memory)->len - len,
+                                memory->producer};
+}
+
+// NOTE: Makes room for `n` more items in the innermost frame, moving the frame
+// and its dump entry into a new segment when the current one is too full. A
+// frame that already starts its segment has nowhere else to go.
+template <usize N, usize S, usize D, usize G>
+static void grow(EvalMemory<N, S, D, G>* memory, usize n) {
+    Buffer<Node*, S>* from = get_stack(memory);
+    if (n <= (S - from->len)) {
+        return;
+    }
+    Buffer<InstFrame, D>* dump = get_dump(memory);
+    const usize           base = get_base(memory);
+    const usize           len = from->len - base;
+    EXIT_IF((base == 0) || ((S - len) < n));
+    const InstFrame frame = dump->items[--dump->len];
+    from->len = base;
+    link_segment(memory);
+    memcpy(alloc(get_stack(memory), len),
+           &from->items[base],
+           sizeof(Node*) * len);
+    *alloc(get_dump(memory)) = {frame.insts, 0, frame.global};
+}
+
+// NOTE: Leaves `node` in place of the innermost frame and returns the code to
+// continue with. The first frame of a linked segment is based on the segment
+// below, so returning from it releases the segment.
+template <usize N, usize S, usize D, usize G>
+static const ListNode<Inst>* leave(EvalMemory<N, S, D, G>* memory,
+                                   Node*                   node) {
+    Buffer<Node*, S>*     stack = get_stack(memory);
+    Buffer<InstFrame, D>* dump = get_dump(memory);
+    if (dump->len == 0) {
+        stack->items[0] = node;
+        stack->len = 1;
+        set_producer(memory, G);
+        return null;
+    }
+    const InstFrame frame = dump->items[--dump->len];
+    set_producer(memory, frame.global);
+    stack->len = frame.base;
+    if ((dump->len == 0) && memory->segment->prev) {
+        unlink_segment(memory);
+    }
+    push(memory, node);
+    return frame.insts;
+}
+
+// NOTE: Returns the code to continue with, or null once the outermost node is
+// in weak head normal form.
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static const ListNode<Inst>* unwind(EvalMemory<N, S, D, G>*    memory,
+                                    const InstMemory<I, J, G>* inst_memory) {
+    for (;;) {
+        Node** top = peek(memory, 0);
+        Node*  node = follow_indirs(*top);
+        *top = node;
+        switch (get_tag(node)) {
+        case NODE_APP: {
+            grow(memory, 1);
+            push(memory, get_app_func(node));
+            break;
+        }
+        case NODE_GLOBAL: {
+            if (!is_whnf(memory, node)) {
+                const InstCode* code =
+                    &inst_memory->codes.items[node->body.as_global];
+                rearrange(memory, code->arity);
+                (*peek(memory, code->arity))->header = NODE_BLACKHOLE;
+                grow(memory, code->depth - (code->arity + 1u));
+                set_producer(memory, node->body.as_global);
+                return code->insts;
+            }
+            return leave(memory,
+                         follow_indirs(
+                             get_stack(memory)->items[get_base(memory)]));
+        }
+        case NODE_I64:
+        case NODE_DATA:
+        case NODE_ARRAY: {
+            return leave(memory, node);
+        }
+        case NODE_UNDEF: {
+            EXIT_WITH("undef");
+        }
+        case NODE_BLACKHOLE: {
+            EXIT_WITH("loop");
+        }
+        case NODE_INDIR:
+        case NODE_FORWARD: {
+            EXIT();
+        }
+        }
+    }
+}
+
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static void start_eval(EvalMemory<N, S, D, G>*    memory,
+                       const InstMemory<I, J, G>* inst_memory,
+                       Node*                      root) {
+    reset_segments(memory);
+    set_producer(memory, G);
+    memory->slice = EVAL_SLICE;
+    push(memory, root);
+    memory->code = unwind(memory, inst_memory);
+}
+
+// NOTE: Runs native code from `code` for as many instructions as the fuel and
+// what is left of the slice allow, counting them off both just as
+// `resume_eval` does, and returns the first instruction it left to the
+// interpreter. Profiling and sharing both hook into allocation, so either one
+// keeps evaluation in the interpreter.
+template <usize N, usize S, usize D, usize G>
+static const ListNode<Inst>* run_native(EvalMemory<N, S, D, G>* memory,
+                                        const ListNode<Inst>*   code,
+                                        u64*                    fuel,
+                                        u32*                    slice) {
+    const EvalNative* native = memory->native;
+    if ((!native) || memory->profile || memory->conses ||
+        (code < native->insts) || ((native->insts + native->len) <= code))
+    {
+        return code;
+    }
+    const void* entry = native->entries[code - native->insts];
+    const u64   budget = *fuel < *slice ? *fuel : *slice;
+    if ((!entry) || (budget == 0)) {
+        return code;
+    }
+    Buffer<Node*, S>*     stack = get_stack(memory);
+    Buffer<InstFrame, D>* dump = get_dump(memory);
+    Buffer<Node, N>*      heap = get_heap(memory);
+    EvalRegs              regs = {
+        stack->items,
+        stack->len,
+        S,
+        dump->items,
+        dump->len,
+        D,
+        memory->segment->prev ? 1u : 0u,
+        heap->items,
+        heap->len,
+        N,
+        memory->roots,
+        memory->shared.i64s,
+        memory->shared.packs,
+        &memory->undef,
+        budget,
+        null,
+        memory->producer,
+    };
+    native->run(&regs, entry);
+    stack->len = regs.stack_len;
+    dump->len = regs.dump_len;
+    heap->len = regs.heap_len;
+    memory->producer = regs.producer;
+    *fuel -= budget - regs.budget;
+    *slice -= static_cast<u32>(budget - regs.budget);
+    return regs.next;
+}
+
+// NOTE: Runs the evaluation set up by `start_eval` for at most `*fuel`
+// instructions, or until the monotonic clock passes `deadline` (checked every
+// `EVAL_SLICE` instructions, counted across calls so that small amounts of
+// fuel still reach a check; zero means no deadline). Between instructions the
+// whole state is the stack, the dump and `memory->code`, so stopping there
+// and calling again later picks up exactly where it left off; any number of
+// evaluations can be interleaved on one thread, one context each. Once done,
+// the result is the only node left on the stack. An evaluation that stopped
+// and will not be resumed still has its roots blackholed, so the caller has
+// to `abandon_eval` it before the context evaluates anything else.
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static EvalStatus resume_eval(EvalMemory<N, S, D, G>*    memory,
+                              const InstMemory<I, J, G>* inst_memory,
+                              u64*                       fuel,
+                              u64                        deadline) {
+    const ListNode<Inst>* code = memory->code;
+    u32                   slice = memory->slice;
+    while (code) {
+        if (slice == 0) {
+            slice = EVAL_SLICE;
+            if ((deadline != 0) && (deadline <= get_nanos())) {
+                memory->code = code;
+                memory->slice = slice;
+                return EVAL_DEADLINE;
+            }
+        }
+        code = run_native(memory, code, fuel, &slice);
+        if (slice == 0) {
+            continue;
+        }
+        if (*fuel == 0) {
+            memory->code = code;
+            memory->slice = slice;
+            return EVAL_FUEL;
+        }
+        --(*fuel);
+        --slice;
+        const Inst* inst = &code->value;
+        code = code->next;
+        switch (inst->tag) {
+        case INST_UNWIND: {
+            code = unwind(memory, inst_memory);
+            break;
+        }
+        case INST_PUSH_GLOBAL: {
+            push(memory, memory->roots[inst->body.as_global]);
+            break;
+        }
+        case INST_PUSH_INT: {
+            reserve(memory, 1);
+            push(memory, get_i64(memory, inst->body.as_i64));
+            break;
+        }
+        case INST_PUSH_UNDEF: {
+            push(memory, &memory->undef);
+            break;
+        }
+        case INST_PUSH: {
+            Node** node = peek(memory, static_cast<usize>(inst->body.as_i64));
+            *node = follow_indirs(*node);
+            push(memory, *node);
+            break;
+        }
+        case INST_APP: {
+            reserve(memory, 1);
+            Node* func = pop(memory);
+            Node* arg = pop(memory);
+            push(memory, alloc_app(get_heap(memory), func, arg));
+            break;
+        }
+        case INST_UPDATE: {
+            update(memory, static_cast<usize>(inst->body.as_i64));
+            break;
+        }
+        case INST_POP: {
+            const usize n = static_cast<usize>(inst->body.as_i64);
+            EXIT_IF(get_stack(memory)->len < n);
+            get_stack(memory)->len -= n;
+            break;
+        }
+        case INST_ALLOC: {
+            const usize n = static_cast<usize>(inst->body.as_i64);
+            reserve(memory, n);
+            for (usize i = 0; i < n; ++i) {
+                Node* hole = alloc(get_heap(memory));
+                hole->header = NODE_UNDEF;
+                push(memory, hole);
+            }
+            break;
+        }
+        case INST_SLIDE: {
+            const usize n = static_cast<usize>(inst->body.as_i64);
+            Node*       top = pop(memory);
+            EXIT_IF(get_stack(memory)->len < n);
+            get_stack(memory)->len -= n;
+            push(memory, top);
+            break;
+        }
+        case INST_EVAL: {
+            Node** top = peek(memory, 0);
+            *top = follow_indirs(*top);
+            if ((get_tag(*top) != NODE_GLOBAL) && is_whnf(memory, *top)) {
+                break;
+            }
+            enter(memory, code, 0, 1);
+            code = unwind(memory, inst_memory);
+            break;
+        }
+        case INST_CALL: {
+            const InstCode* callee =
+                &inst_memory->codes.items[inst->body.as_call.global];
+            enter(memory, code, callee->arity, callee->depth);
+            set_producer(memory, inst->body.as_call.global);
+            code = callee->insts;
+            break;
+        }
+        case INST_TAIL_CALL: {
+            const InstCode* callee =
+                &inst_memory->codes.items[inst->body.as_call.global];
+            Buffer<Node*, S>* stack = get_stack(memory);
+            const usize       depth = inst->body.as_call.depth;
+            EXIT_IF(stack->len < (depth + callee->arity));
+            Node** args = &stack->items[stack->len - callee->arity];
+            memmove(args - depth, args, sizeof(Node*) * callee->arity);
+            stack->len -= depth;
+            grow(memory, callee->depth - (callee->arity + 1u));
+            set_producer(memory, inst->body.as_call.global);
+            code = callee->insts;
+            break;
+        }
+        case INST_PACK: {
+            const InstPack pack = inst->body.as_pack;
+            reserve(memory, NODE_CELLS(pack.arity));
+            Node* node = get_pack(&memory->shared,
+                                  get_heap(memory),
+                                  pack.tag,
+                                  pack.arity);
+            Node** fields = get_fields(node);
+            for (u8 i = 0; i < pack.arity; ++i) {
+                fields[i] = pop(memory);
+            }
+            push(memory, share(memory->conses, get_heap(memory), node));
+            break;
+        }
+        case INST_JUMP: {
+            const Node* node = follow_indirs(*peek(memory, 0));
+            EXIT_IF(get_tag(node) != NODE_DATA);
+            code = get_jump(&inst->body.as_jump, get_pack_tag(node));
+            if (!code) {
+                EXIT_WITH("no matching branch");
+            }
+            break;
+        }
+        case INST_SPLIT: {
+            Node* node = follow_indirs(pop(memory));
+            EXIT_IF(get_tag(node) != NODE_DATA);
+            const u8 arity = get_arity(node);
+            EXIT_IF(arity != inst->body.as_i64);
+            Node** fields = get_fields(node);
+            for (u8 i = arity; i != 0; --i) {
+                push(memory, fields[i - 1]);
+            }
+            break;
+        }
+        case INST_COND: {
+            const bool cond = pop_i64(memory)->body.as_i64 != 0;
+            code = inst->body.as_cond.insts[cond ? 0 : 1];
+            break;
+        }
+        case INST_ADD:
+        case INST_SUB:
+        case INST_MUL:
+        case INST_DIV:
+        case INST_EQ:
+        case INST_NE:
+        case INST_LT:
+        case INST_LE:
+        case INST_GT:
+        case INST_GE:
+        case INST_OR:
+        case INST_AND: {
+            reserve(memory, 1);
+            const i64 l = pop_i64(memory)->body.as_i64;
+            const i64 r = pop_i64(memory)->body.as_i64;
+            i64       value = 0;
+            switch (inst->tag) {
+            case INST_ADD: {
+                value = add_i64(l, r);
+                break;
+            }
+            case INST_SUB: {
+                value = sub_i64(l, r);
+                break;
+            }
+            case INST_MUL: {
+                value = mul_i64(l, r);
+                break;
+            }
+            case INST_DIV: {
+                if (r == 0) {
+                    EXIT_WITH("division by zero");
+                }
+                value = div_i64(l, r);
+                break;
+            }
+            case INST_EQ: {
+                value = l == r;
+                break;
+            }
+            case INST_NE: {
+                value = l != r;
+                break;
+            }
+            case INST_LT: {
+                value = l < r;
+                break;
+            }
+            case INST_LE: {
+                value = l <= r;
+                break;
+            }
+            case INST_GT: {
+                value = l > r;
+                break;
+            }
+            case INST_GE: {
+                value = l >= r;
+                break;
+            }
+            case INST_OR: {
+                value = (l != 0) || (r != 0);
+                break;
+            }
+            case INST_AND: {
+                value = (l != 0) && (r != 0);
+                break;
+            }
+            case INST_UNWIND:
+            case INST_PUSH_GLOBAL:
+            case INST_PUSH_INT:
+            case INST_PUSH_UNDEF:
+            case INST_PUSH:
+            case INST_APP:
+            case INST_UPDATE:
+            case INST_POP:
+            case INST_ALLOC:
+            case INST_SLIDE:
+            case INST_EVAL:
+            case INST_CALL:
+            case INST_TAIL_CALL:
+            case INST_PACK:
+            case INST_JUMP:
+            case INST_SPLIT:
+            case INST_COND:
+            case INST_PRIM: {
+                EXIT();
+            }
+            }
+            push(memory, get_i64(memory, value));
+            break;
+        }
+        case INST_PRIM: {
+            eval_prim(memory, static_cast<Prim>(inst->body.as_i64));
+            break;
+        }
+        }
+    }
+    memory->code = null;
+    free(memory->spare);
+    memory->spare = null;
+    return EVAL_DONE;
+}
+
+// NOTE: Drops the evaluation `resume_eval` stopped on. Which of the nodes it
+// blackholed are reachable from the roots is not tracked, so the context goes
+// back to how `set_globals` left it, losing the globals already evaluated.
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static void abandon_eval(EvalMemory<N, S, D, G>*    memory,
+                         const InstMemory<I, J, G>* inst_memory) {
+    reset_globals(memory, inst_memory);
+}
+
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static Node* eval(EvalMemory<N, S, D, G>*    memory,
+                  const InstMemory<I, J, G>* inst_memory,
+                  Node*                      root) {
+    start_eval(memory, inst_memory, root);
+    u64 fuel = UINT64_MAX;
+    EXIT_IF(resume_eval(memory, inst_memory, &fuel, 0) != EVAL_DONE);
+    return pop(memory);
+}
+
+template <usize N, usize S, usize D, usize G, usize I, usize J>
+static Node* eval(EvalMemory<N, S, D, G>*    memory,
+                  const InstMemory<I, J, G>* inst_memory,
+                  String                     name) {
+    return eval(memory,
+                inst_memory,
+                memory->roots[get_global(inst_memory, name)]);
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize C,
+          usize R,
+          usize Q,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize D>
+static i64 eval_i64(Tokens<T>*                  tokens,
+                    ParseMemory<S, B, U, E, F>* parse_memory,
+                    FuseMemory<C, R, Q>*        fuse_memory,
+                    InstMemory<I, J, G>*        inst_memory,
+                    EvalMemory<N, K, D, G>*     eval_memory,
+                    String                      source) {
+    set_tokens(source, tokens);
+    parse_program(tokens, parse_memory);
+    reset(fuse_memory);
+    fuse_program(parse_memory, fuse_memory);
+    simplify_program(parse_memory, fuse_memory);
+    compile_program(inst_memory, &parse_memory->funcs);
+    set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+    const Node* node = eval(eval_memory, inst_memory, GET_STRING("main"));
+    EXIT_IF(get_tag(node) != NODE_I64);
+    return node->body.as_i64;
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize C,
+          usize R,
+          usize Q,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize D>
+static void test_eval(Tokens<T>*                  tokens,
+                      ParseMemory<S, B, U, E, F>* parse_memory,
+                      FuseMemory<C, R, Q>*        fuse_memory,
+                      InstMemory<I, J, G>*        inst_memory,
+                      EvalMemory<N, K, D, G>*     eval_memory,
+                      HeapProfile<N, G>*          profile) {
+    {
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("main { 1 + (2 * 3) - 4 }")) != 3);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("min { (2147483648 * 2147483648) * 2 }\n"
+                                    "main { min / (0 - 1) }")) != INT64_MIN);
+        EXIT_IF(
+            eval_i64(tokens,
+                     parse_memory,
+                     fuse_memory,
+                     inst_memory,
+                     eval_memory,
+                     GET_STRING("min { (2147483648 * 2147483648) * 2 }\n"
+                                "main { ((min - 1) > 0) + min + min }")) != 1);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(
+            eval_i64(tokens,
+                     parse_memory,
+                     fuse_memory,
+                     inst_memory,
+                     eval_memory,
+                     GET_STRING("fib n { if (n < 2) n (fib (n - 1) + "
+                                "fib (n - 2)) }\n"
+                                "main { fib 15 }")) != 610);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(
+            eval_i64(tokens,
+                     parse_memory,
+                     fuse_memory,
+                     inst_memory,
+                     eval_memory,
+                     GET_STRING("nil { pack 1 0 }\n"
+                                "cons x xs { pack 2 2 x xs }\n"
+                                "take n xs {\n"
+                                "  if (n == 0) nil (unpack xs {\n"
+                                "    1 = nil;\n"
+                                "    2 y ys = cons y (take (n - 1) ys)\n"
+                                "  })\n"
+                                "}\n"
+                                "sum xs {\n"
+                                "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                                "}\n"
+                                "main { letrec { xs = cons 2 xs } "
+                                "sum (take 4 xs) }")) != 8);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("main {\n"
+                                    "  let { a = array_range 0 10 }\n"
+                                    "  array_sum (array_mul a (array_fill 10 "
+                                    "3))\n"
+                                    "}")) != 135);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("f g { g (array_range 0 100) 10 20 }\n"
+                                    "main {\n"
+                                    "  let { a = f array_slice }\n"
+                                    "  array_get a 3 + array_len a\n"
+                                    "}")) != 23);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("main {\n"
+                                    "  let { a = array_range (0 - 5) 9 }\n"
+                                    "  array_eq (array_add a a)\n"
+                                    "           (array_mul a (array_fill 14 "
+                                    "2)) &\n"
+                                    "  (array_eq a (array_sub a a) == 0)\n"
+                                    "}")) != 1);
+        fprintf(stderr, ".");
+    }
+    {
+        File* file = tmpfile();
+        EXIT_IF(!file);
+        i64 sum = 0;
+        for (usize i = 0; i < (N * 4); ++i) {
+            const u8 byte = static_cast<u8>((i * 7) % 251);
+            EXIT_IF(fputc(byte, file) == EOF);
+            sum += byte;
+        }
+        EXIT_IF(fflush(file) != 0);
+        eval_memory->input = map_input(file);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("go n xs {\n"
+                                    "  unpack xs {\n"
+                                    "    1      = n;\n"
+                                    "    2 y ys =\n"
+                                    "      if (n < 0) 0 (go (n + y) ys)\n"
+                                    "  }\n"
+                                    "}\n"
+                                    "main { go 0 (input_from 0) }")) != sum);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("main {\n"
+                                    "  unpack input_from 100 {\n"
+                                    "    1 = 0 - 1;\n"
+                                    "    2 y ys = y\n"
+                                    "  }\n"
+                                    "}")) != 198);
+        unmap_input(&eval_memory->input);
+        EXIT_IF(fclose(file) != 0);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("main {\n"
+                                    "  unpack input_from 0 {\n"
+                                    "    1 = 7;\n"
+                                    "    2 y ys = y\n"
+                                    "  }\n"
+                                    "}")) != 7);
+        fprintf(stderr, ".");
+    }
+    {
+        const String source =
+            GET_STRING("pair x { pack 3 2 x 1 }\n"
+                       "go n acc {\n"
+                       "  if (n == 0) acc (unpack pair 1000 {\n"
+                       "    3 x y = if (acc < 0) 0 (go (n - y) (acc + x))\n"
+                       "  })\n"
+                       "}\n"
+                       "main { go 1000 0 }");
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         source) != 1000000);
+        EXIT_IF(eval_memory->conses);
+        set_sharing(eval_memory, true);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         source) != 1000000);
+        EXIT_IF(eval_memory->conses->saved < (1000 * NODE_CELLS(2)));
+        set_sharing(eval_memory, false);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("nil { pack 1 0 }\n"
+                                    "cons x xs { pack 2 2 x xs }\n"
+                                    "f xs n {\n"
+                                    "  let { k = n * 2; z = n + 1 }\n"
+                                    "  unpack xs {\n"
+                                    "    1 = k;\n"
+                                    "    2 y ys =\n"
+                                    "      if (y < 0) z\n"
+                                    "        (if (y == 0) k (y + z))\n"
+                                    "  }\n"
+                                    "}\n"
+                                    "main {\n"
+                                    "  f (cons 0 nil) 5 + f nil 4 +\n"
+                                    "  f (cons 3 nil) 1 +\n"
+                                    "  f (cons (0 - 1) nil) 7\n"
+                                    "}")) != 31);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("g x {\n"
+                                    "  1 + (let { k = x * 3 }\n"
+                                    "    if (x < 2) k (unpack pack 5 2 x x {\n"
+                                    "      5 a b = let { c = a } k\n"
+                                    "    }))\n"
+                                    "}\n"
+                                    "h n {\n"
+                                    "  letrec {\n"
+                                    "    xs = pack 2 2 n xs;\n"
+                                    "    k = unpack xs {\n"
+                                    "      2 y ys =\n"
+                                    "        unpack ys { 2 z zs = y + z }\n"
+                                    "    }\n"
+                                    "  } if (n == 0) 0 k\n"
+                                    "}\n"
+                                    "main { g 1 + g 4 + h 2 + h 0 }")) != 21);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(
+            eval_i64(tokens,
+                     parse_memory,
+                     fuse_memory,
+                     inst_memory,
+                     eval_memory,
+                     GET_STRING("add x y { x + y }\n"
+                                "twice f x { f (f x) }\n"
+                                "k x y { x }\n"
+                                "main {\n"
+                                "  let { a = twice (add 1) 3; b = undef }\n"
+                                "  k (unpack (k (pack 9 0) b) {\n"
+                                "    9 = a;\n"
+                                "    200 = b\n"
+                                "  }) b\n"
+                                "}")) != 5);
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("fib n { if (n < 2) n (fib (n - 1) + "
+                              "fib (n - 2)) }\n"
+                              "main { fib 15 }"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        const u32 global = get_global(inst_memory, GET_STRING("main"));
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        u64 fuel = UINT64_MAX;
+        start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+        EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 1) !=
+                EVAL_DEADLINE);
+        EXIT_IF(fuel != (UINT64_MAX - EVAL_SLICE));
+        EXIT_IF(get_tag(eval_memory->roots[global]) != NODE_BLACKHOLE);
+        EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 0) != EVAL_DONE);
+        EXIT_IF(pop(eval_memory)->body.as_i64 != 610);
+        EXIT_IF(get_tag(eval_memory->roots[global]) == NODE_BLACKHOLE);
+        const u64 first = UINT64_MAX - fuel;
+        u64       steps = 0;
+        usize     yields = 0;
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+        for (;;) {
+            fuel = 100;
+            const EvalStatus status =
+                resume_eval(eval_memory, inst_memory, &fuel, 0);
+            steps += 100 - fuel;
+            if (status == EVAL_DONE) {
+                break;
+            }
+            EXIT_IF(fuel != 0);
+            ++yields;
+        }
+        EXIT_IF(pop(eval_memory)->body.as_i64 != 610);
+        EXIT_IF(yields != ((steps - 1) / 100));
+        EXIT_IF(first != steps);
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+        EvalStatus status = EVAL_FUEL;
+        u64        spent = 0;
+        while (status == EVAL_FUEL) {
+            fuel = 100;
+            status = resume_eval(eval_memory, inst_memory, &fuel, 1);
+            spent += 100 - fuel;
+        }
+        EXIT_IF(status != EVAL_DEADLINE);
+        EXIT_IF(spent != EVAL_SLICE);
+        fuel = UINT64_MAX;
+        EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 0) != EVAL_DONE);
+        EXIT_IF(pop(eval_memory)->body.as_i64 != 610);
+        EXIT_IF((spent + (UINT64_MAX - fuel)) != steps);
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+        fuel = 100;
+        EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 0) != EVAL_FUEL);
+        abandon_eval(eval_memory, inst_memory);
+        EXIT_IF(get_tag(eval_memory->roots[global]) == NODE_BLACKHOLE);
+        EXIT_IF(eval(eval_memory, inst_memory, eval_memory->roots[global])
+                    ->body.as_i64 != 610);
+        fprintf(stderr, ".");
+    }
+    {
+        EXIT_IF(
+            eval_i64(tokens,
+                     parse_memory,
+                     fuse_memory,
+                     inst_memory,
+                     eval_memory,
+                     GET_STRING("nil { pack 1 0 }\n"
+                                "cons x xs { pack 2 2 x xs }\n"
+                                "range a b {\n"
+                                "  if (b <= a) nil\n"
+                                "    (cons a (range (a + 1) b))\n"
+                                "}\n"
+                                "sum xs {\n"
+                                "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                                "}\n"
+                                "main { sum (range 0 150) }")) != 11175);
+        EXIT_IF(eval_memory->segments.peak < 3);
+        EXIT_IF(eval_memory->segments.len != 1);
+        EXIT_IF(eval_memory->segments.links <
+                (eval_memory->segments.peak - 1));
+        EXIT_IF(eval_memory->spare);
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        EXIT_IF(eval_memory->segments.peak < 3);
+        EXIT_IF(eval_i64(tokens,
+                         parse_memory,
+                         fuse_memory,
+                         inst_memory,
+                         eval_memory,
+                         GET_STRING("t x { x }\n"
+                                    "w f n { if n (w (f t) (n - 1)) (f 5) }\n"
+                                    "s n a b c d e {\n"
+                                    "  if n (w t 40 + s (n - 1) a b c d e) 0\n"
+                                    "}\n"
+                                    "main { s 80 1 2 3 4 5 }")) != 400);
+        EXIT_IF(eval_memory->segments.len != 1);
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "range a b {\n"
+                              "  if (b <= a) nil (cons a (range (a + 1) b))\n"
+                              "}\n"
+                              "sum xs {\n"
+                              "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                              "}\n"
+                              "xs { range 0 200 }\n"
+                              "main {\n"
+                              "  sum xs + (sum xs + (sum xs + sum xs))\n"
+                              "}"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+        File* file = tmpfile();
+        EXIT_IF(!file);
+        set_profile(profile, inst_memory, file, 0, get_nanos());
+        eval_memory->profile = profile;
+        const Node* node = eval(eval_memory, inst_memory, GET_STRING("main"));
+        EXIT_IF(node->body.as_i64 != 79600);
+        eval_memory->profile = null;
+        EXIT_IF(profile->samples == 0);
+        EXIT_IF(ftell(file) <= 0);
+        EXIT_IF(fclose(file) != 0);
+        const usize cells = NODE_CELLS(2) * 200;
+        EXIT_IF(profile->by_retainer[get_global(inst_memory,
+                                                GET_STRING("xs"))] < cells);
+        EXIT_IF(profile->by_producer[get_global(inst_memory,
+                                                GET_STRING("cons"))] < cells);
+        EXIT_IF(profile->by_kind[NODE_DATA] < cells);
+        EXIT_IF(profile->by_tag[2] < cells);
+        usize producers = 0;
+        usize retainers = 0;
+        for (usize i = 0; i <= G; ++i) {
+            producers += profile->by_producer[i];
+        }
+        for (usize i = 0; i < (G + 2); ++i) {
+            retainers += profile->by_retainer[i];
+        }
+        EXIT_IF(producers != retainers);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
@@ -0,0 +1,1105 @@
+#ifndef __FUSE_H__
+#define __FUSE_H__
+
+#include "list.hpp"
+#include "parse.hpp"
+
+#define CAP_BINDERS (1 << 5)
+
+struct Rename {
+    String        from;
+    String        to;
+    const Rename* next;
+};
+
+struct Fusion {
+    String func;
+    String consumer;
+    String producer;
+};
+
+struct Fused {
+    const Func* consumer;
+    const Func* producer;
+    const Func* func;
+    usize       index;
+};
+
+template <usize C, usize N, usize R>
+struct FuseMemory {
+    Buffer<char, C>             chars;
+    Buffer<Rename, N>           renames;
+    Buffer<ListNode<Fusion>, R> fusions;
+    u32                         fresh;
+};
+
+static void print(File* stream, Fusion fusion) {
+    fprintf(stream, "{");
+    print(stream, fusion.func);
+    fprintf(stream, ", ");
+    print(stream, fusion.consumer);
+    fprintf(stream, ", ");
+    print(stream, fusion.producer);
+    fprintf(stream, "}");
+}
+
+template <usize F>
+static const Func* find_func(const Buffer<Func, F>* funcs, String name) {
+    for (usize i = 0; i < funcs->len; ++i) {
+        if ((funcs->items[i].tag == FUNC_VAR) &&
+            (funcs->items[i].name.as_var == name))
+        {
+            return &funcs->items[i];
+        }
+    }
+    return null;
+}
+
+template <usize F>
+static bool is_pack(const Buffer<Func, F>* funcs,
+                    const Spine*           spine,
+                    u8*                    tag) {
+    if (spine->head->tag == EXPR_PACK) {
+        if (spine->head->body.as_pack[1] != spine->len) {
+            return false;
+        }
+        *tag = spine->head->body.as_pack[0];
+        return true;
+    }
+    if (spine->head->tag != EXPR_VAR) {
+        return false;
+    }
+    const Func* func = find_func(funcs, spine->head->body.as_var);
+    if ((!func) || (func->args.len != spine->len)) {
+        return false;
+    }
+    const Spine body = get_spine(func->expr);
+    if ((body.head->tag != EXPR_PACK) ||
+        (body.head->body.as_pack[1] != body.len) || (body.len != spine->len))
+    {
+        return false;
+    }
+    for (usize i = 0; i < body.len; ++i) {
+        const String arg = func->args.items[i];
+        if (!is_var(body.args[i], arg)) {
+            return false;
+        }
+        for (usize j = i + 1; j < body.len; ++j) {
+            if (func->args.items[j] == arg) {
+                return false;
+            }
+        }
+    }
+    *tag = body.head->body.as_pack[0];
+    return true;
+}
+
+template <usize F>
+static bool has_pack(const Buffer<Func, F>* funcs, const Expr* expr) {
+    switch (expr->tag) {
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        return has_pack(funcs, expr->body.as_let.expr);
+    }
+    case EXPR_UNPACK: {
+        for (usize i = 0; i < expr->body.as_unpack.branches.len; ++i) {
+            const ExprBranch* branch = &expr->body.as_unpack.branches.items[i];
+            if (has_pack(funcs, branch->expr)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_APP:
+    case EXPR_U32:
+    case EXPR_VAR:
+    case EXPR_BINOP: {
+        const Spine spine = get_spine(expr);
+        if (is_var(spine.head, GET_STRING("if")) && (spine.len == 3)) {
+            return has_pack(funcs, spine.args[1]) ||
+                   has_pack(funcs, spine.args[2]);
+        }
+        u8 tag;
+        return is_pack(funcs, &spine, &tag);
+    }
+    }
+    EXIT();
+}
+
+static bool get_index(const Func* func, usize* index) {
+    if ((func->tag != FUNC_VAR) || (func->expr->tag != EXPR_UNPACK) ||
+        (func->expr->body.as_unpack.expr->tag != EXPR_VAR))
+    {
+        return false;
+    }
+    const ExprUnpack* unpack = &func->expr->body.as_unpack;
+    const String      name = unpack->expr->body.as_var;
+    for (usize i = 0; i < func->args.len; ++i) {
+        if (func->args.items[i] != name) {
+            continue;
+        }
+        for (usize j = 0; j < unpack->branches.len; ++j) {
+            const ExprBranch* branch = &unpack->branches.items[j];
+            if ((!contains(&branch->args, name)) &&
+                is_free(branch->expr, name))
+            {
+                return false;
+            }
+        }
+        *index = i;
+        return true;
+    }
+    return false;
+}
+
+static const ExprBranch* find_branch(const Expr* expr, u8 tag) {
+    for (usize i = 0; i < expr->body.as_unpack.branches.len; ++i) {
+        const ExprBranch* branch = &expr->body.as_unpack.branches.items[i];
+        if (branch->tag == tag) {
+            return branch;
+        }
+    }
+    return null;
+}
+
+template <usize E>
+static const Expr* get_var(Buffer<Expr, E>* exprs, String name) {
+    Expr* expr = alloc(exprs);
+    expr->tag = EXPR_VAR;
+    expr->body.as_var = name;
+    return expr;
+}
+
+static String get_renamed(const Rename* renames, String name) {
+    for (; renames; renames = renames->next) {
+        if (renames->from == name) {
+            return renames->to;
+        }
+    }
+    return name;
+}
+
+template <usize C, usize N, usize R>
+static String get_fresh(FuseMemory<C, N, R>* memory, String name) {
+    char      digits[16];
+    const i32 len = snprintf(digits, sizeof(digits), "'%u", memory->fresh++);
+    EXIT_IF(len <= 0);
+    char* chars = alloc(&memory->chars, name.len + static_cast<usize>(len));
+    memcpy(chars, name.chars, name.len);
+    memcpy(&chars[name.len], digits, static_cast<usize>(len));
+    return (String){chars, name.len + static_cast<usize>(len)};
+}
+
+template <usize C, usize N, usize R>
+static const Rename* push_rename(FuseMemory<C, N, R>* memory,
+                                 const Rename*        renames,
+                                 String               from,
+                                 String               to) {
+    Rename* rename = alloc(&memory->renames);
+    rename->from = from;
+    rename->to = to;
+    rename->next = renames;
+    return rename;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* rename(ParseMemory<S, B, U, E, F>* parse_memory,
+                          FuseMemory<C, N, R>*        fuse_memory,
+                          const Rename*               renames,
+                          const Expr*                 expr) {
+    switch (expr->tag) {
+    case EXPR_VAR: {
+        const String name = get_renamed(renames, expr->body.as_var);
+        if (name == expr->body.as_var) {
+            return expr;
+        }
+        return get_var(&parse_memory->exprs, name);
+    }
+    case EXPR_APP: {
+        return get_app(
+            &parse_memory->exprs,
+            rename(parse_memory, fuse_memory, renames, expr->body.as_app[0]),
+            rename(parse_memory, fuse_memory, renames, expr->body.as_app[1]));
+    }
+    case EXPR_BINOP: {
+        return get_binop(&parse_memory->exprs,
+                         expr->body.as_binop.op,
+                         rename(parse_memory,
+                                fuse_memory,
+                                renames,
+                                expr->body.as_binop.args[0]),
+                         rename(parse_memory,
+                                fuse_memory,
+                                renames,
+                                expr->body.as_binop.args[1]));
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        const Rename*            inner = renames;
+        for (usize i = 0; i < bindings->len; ++i) {
+            const String name = bindings->items[i].name;
+            inner = push_rename(fuse_memory,
+                                inner,
+                                name,
+                                get_fresh(fuse_memory, name));
+        }
+        const Rename* outer = expr->tag == EXPR_LET ? renames : inner;
+        Expr*         copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = expr->tag;
+        copy->body.as_let.bindings = {
+            alloc(&parse_memory->bindings, bindings->len),
+            bindings->len,
+        };
+        for (usize i = 0; i < bindings->len; ++i) {
+            ExprBinding* binding = &copy->body.as_let.bindings.items[i];
+            binding->name = get_renamed(inner, bindings->items[i].name);
+            binding->expr = rename(parse_memory,
+                                   fuse_memory,
+                                   outer,
+                                   bindings->items[i].expr);
+        }
+        copy->body.as_let.expr =
+            rename(parse_memory, fuse_memory, inner, expr->body.as_let.expr);
+        return copy;
+    }
+    case EXPR_UNPACK: {
+        Expr* copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = EXPR_UNPACK;
+        copy->body.as_unpack.expr = rename(parse_memory,
+                                           fuse_memory,
+                                           renames,
+                                           expr->body.as_unpack.expr);
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        copy->body.as_unpack.branches = {
+            alloc(&parse_memory->branches, branches->len),
+            branches->len,
+        };
+        for (usize i = 0; i < branches->len; ++i) {
+            const ExprBranch* branch = &branches->items[i];
+            ExprBranch*       copy_branch =
+                &copy->body.as_unpack.branches.items[i];
+            const Rename* inner = renames;
+            copy_branch->tag = branch->tag;
+            copy_branch->args = {
+                alloc(&parse_memory->strings, branch->args.len),
+                branch->args.len,
+            };
+            for (usize j = 0; j < branch->args.len; ++j) {
+                const String arg = branch->args.items[j];
+                const String fresh = get_fresh(fuse_memory, arg);
+                inner = push_rename(fuse_memory, inner, arg, fresh);
+                copy_branch->args.items[j] = fresh;
+            }
+            copy_branch->expr =
+                rename(parse_memory, fuse_memory, inner, branch->expr);
+        }
+        return copy;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32: {
+        return expr;
+    }
+    }
+    EXIT();
+}
+
+template <usize E>
+static const Expr* get_call(Buffer<Expr, E>*   exprs,
+                            const Expr*        head,
+                            const Expr* const* args,
+                            usize              len) {
+    for (usize i = 0; i < len; ++i) {
+        head = get_app(exprs, head, args[i]);
+    }
+    return head;
+}
+
+template <usize E>
+static const Expr* get_fused_call(Buffer<Expr, E>* exprs,
+                                  const Fused*     fused,
+                                  const Spine*     producer) {
+    const Expr* call = get_var(exprs, fused->func->name.as_var);
+    for (usize i = 0; i < fused->func->args.len; ++i) {
+        if (i + 1 == fused->consumer->args.len) {
+            break;
+        }
+        call =
+            get_app(exprs, call, get_var(exprs, fused->func->args.items[i]));
+    }
+    return get_call(exprs, call, producer->args, producer->len);
+}
+
+template <usize E>
+static const Expr* get_consumer_call(Buffer<Expr, E>* exprs,
+                                     const Fused*     fused,
+                                     const Expr*      expr) {
+    const String* arg = fused->func->args.items;
+    const Expr*   call = get_var(exprs, fused->consumer->name.as_var);
+    for (usize i = 0; i < fused->consumer->args.len; ++i) {
+        if (i == fused->index) {
+            call = get_app(exprs, call, expr);
+            continue;
+        }
+        call = get_app(exprs, call, get_var(exprs, *arg++));
+    }
+    return call;
+}
+
+static bool is_producer_call(const Fused* fused, const Spine* spine) {
+    return is_var(spine->head, fused->producer->name.as_var) &&
+           (spine->len == fused->producer->args.len);
+}
+
+template <usize S, usize B, usize U, usize E, usize F>
+static const Expr* replace_calls(ParseMemory<S, B, U, E, F>* memory,
+                                 const Fused*                fused,
+                                 const String*               names,
+                                 const Spine*                calls,
+                                 usize                       len,
+                                 const Expr*                 expr) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        const Spine spine = get_spine(expr);
+        const usize n = fused->consumer->args.len;
+        if (is_var(spine.head, fused->consumer->name.as_var) &&
+            (n <= spine.len))
+        {
+            const String* arg = fused->func->args.items;
+            bool          params = true;
+            for (usize i = 0; i < n; ++i) {
+                if (i == fused->index) {
+                    continue;
+                }
+                params = params && is_var(spine.args[i], *arg++);
+            }
+            for (usize i = 0; params && (i < len); ++i) {
+                if (!is_var(spine.args[fused->index], names[i])) {
+                    continue;
+                }
+                Spine rest = {};
+                for (usize j = n; j < spine.len; ++j) {
+                    rest.args[rest.len++] = replace_calls(memory,
+                                                          fused,
+                                                          names,
+                                                          calls,
+                                                          len,
+                                                          spine.args[j]);
+                }
+                return get_call(
+                    &memory->exprs,
+                    get_fused_call(&memory->exprs, fused, &calls[i]),
+                    rest.args,
+                    rest.len);
+            }
+        }
+        const Expr* l = replace_calls(memory,
+                                      fused,
+                                      names,
+                                      calls,
+                                      len,
+                                      expr->body.as_app[0]);
+        const Expr* r = replace_calls(memory,
+                                      fused,
+                                      names,
+                                      calls,
+                                      len,
+                                      expr->body.as_app[1]);
+        if ((l == expr->body.as_app[0]) && (r == expr->body.as_app[1])) {
+            return expr;
+        }
+        return get_app(&memory->exprs, l, r);
+    }
+    case EXPR_BINOP: {
+        const Expr* l = replace_calls(memory,
+                                      fused,
+                                      names,
+                                      calls,
+                                      len,
+                                      expr->body.as_binop.args[0]);
+        const Expr* r = replace_calls(memory,
+                                      fused,
+                                      names,
+                                      calls,
+                                      len,
+                                      expr->body.as_binop.args[1]);
+        if ((l == expr->body.as_binop.args[0]) &&
+            (r == expr->body.as_binop.args[1]))
+        {
+            return expr;
+        }
+        return get_binop(&memory->exprs, expr->body.as_binop.op, l, r);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        Expr*                    copy = alloc(&memory->exprs);
+        *copy = {};
+        copy->tag = expr->tag;
+        copy->body.as_let.bindings = {
+            alloc(&memory->bindings, bindings->len),
+            bindings->len,
+        };
+        for (usize i = 0; i < bindings->len; ++i) {
+            ExprBinding* binding = &copy->body.as_let.bindings.items[i];
+            *binding = bindings->items[i];
+            binding->expr = replace_calls(memory,
+                                          fused,
+                                          names,
+                                          calls,
+                                          len,
+                                          bindings->items[i].expr);
+        }
+        copy->body.as_let.expr = replace_calls(memory,
+                                               fused,
+                                               names,
+                                               calls,
+                                               len,
+                                               expr->body.as_let.expr);
+        return copy;
+    }
+    case EXPR_UNPACK: {
+        Expr* copy = alloc(&memory->exprs);
+        *copy = {};
+        copy->tag = EXPR_UNPACK;
+        copy->body.as_unpack.expr = replace_calls(memory,
+                                                  fused,
+                                                  names,
+                                                  calls,
+                                                  len,
+                                                  expr->body.as_unpack.expr);
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        copy->body.as_unpack.branches = {
+            alloc(&memory->branches, branches->len),
+            branches->len,
+        };
+        for (usize i = 0; i < branches->len; ++i) {
+            ExprBranch* branch = &copy->body.as_unpack.branches.items[i];
+            *branch = branches->items[i];
+            branch->expr = replace_calls(memory,
+                                         fused,
+                                         names,
+                                         calls,
+                                         len,
+                                         branches->items[i].expr);
+        }
+        return copy;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        return expr;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: Binds the fields of `branch` to the arguments in `spine`. With `fused`
+// set, the consumer's calls on a field bound to a producer call become calls
+// of the fused function, unless the field is used elsewhere too; then the
+// field keeps its binding and its calls, so the producer still runs once.
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* bind_branch(ParseMemory<S, B, U, E, F>* parse_memory,
+                               FuseMemory<C, N, R>*        fuse_memory,
+                               const Fused*                fused,
+                               const Rename*               renames,
+                               const ExprBranch*           branch,
+                               const Spine*                spine) {
+    String names[CAP_SPINE];
+    Spine  calls[CAP_SPINE];
+    usize  len = 0;
+    for (usize i = 0; i < spine->len; ++i) {
+        const String arg = branch->args.items[i];
+        if (spine->args[i]->tag == EXPR_VAR) {
+            renames = push_rename(fuse_memory,
+                                  renames,
+                                  arg,
+                                  spine->args[i]->body.as_var);
+            continue;
+        }
+        const String fresh = get_fresh(fuse_memory, arg);
+        renames = push_rename(fuse_memory, renames, arg, fresh);
+        const Spine call = get_spine(spine->args[i]);
+        if (fused && is_producer_call(fused, &call)) {
+            names[len] = fresh;
+            calls[len++] = call;
+        }
+    }
+    const Expr* expr =
+        rename(parse_memory, fuse_memory, renames, branch->expr);
+    const Expr* body = expr;
+    if (fused) {
+        body = replace_calls(parse_memory, fused, names, calls, len, expr);
+        usize n = 0;
+        for (usize i = 0; i < len; ++i) {
+            if (!is_free(body, names[i])) {
+                names[n] = names[i];
+                calls[n++] = calls[i];
+            }
+        }
+        if (n != len) {
+            body = replace_calls(parse_memory, fused, names, calls, n, expr);
+        }
+    }
+    ExprBinding bindings[CAP_SPINE];
+    usize       n = 0;
+    for (usize i = 0; i < spine->len; ++i) {
+        if (spine->args[i]->tag == EXPR_VAR) {
+            continue;
+        }
+        const String name = get_renamed(renames, branch->args.items[i]);
+        if (!is_free(body, name)) {
+            continue;
+        }
+        bindings[n++] = {name, spine->args[i]};
+    }
+    if (n == 0) {
+        return body;
+    }
+    Expr* let = alloc(&parse_memory->exprs);
+    *let = {};
+    let->tag = EXPR_LET;
+    let->body.as_let.bindings = get_span(&parse_memory->bindings, bindings, n);
+    let->body.as_let.expr = body;
+    return let;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* fuse_result(ParseMemory<S, B, U, E, F>* parse_memory,
+                               FuseMemory<C, N, R>*        fuse_memory,
+                               const Fused*                fused,
+                               const Rename*               params,
+                               const Expr*                 expr) {
+    switch (expr->tag) {
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        Expr* copy = alloc(&parse_memory->exprs);
+        *copy = *expr;
+        copy->body.as_let.expr = fuse_result(parse_memory,
+                                             fuse_memory,
+                                             fused,
+                                             params,
+                                             expr->body.as_let.expr);
+        return copy;
+    }
+    case EXPR_UNPACK: {
+        Expr* copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = EXPR_UNPACK;
+        copy->body.as_unpack.expr = expr->body.as_unpack.expr;
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        copy->body.as_unpack.branches = {
+            alloc(&parse_memory->branches, branches->len),
+            branches->len,
+        };
+        for (usize i = 0; i < branches->len; ++i) {
+            ExprBranch* branch = &copy->body.as_unpack.branches.items[i];
+            *branch = branches->items[i];
+            branch->expr = fuse_result(parse_memory,
+                                       fuse_memory,
+                                       fused,
+                                       params,
+                                       branches->items[i].expr);
+        }
+        return copy;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_APP:
+    case EXPR_U32:
+    case EXPR_VAR:
+    case EXPR_BINOP: {
+        break;
+    }
+    }
+    const Spine spine = get_spine(expr);
+    if (is_var(spine.head, GET_STRING("if")) && (spine.len == 3)) {
+        const Expr* args[] = {
+            spine.args[0],
+            fuse_result(parse_memory,
+                        fuse_memory,
+                        fused,
+                        params,
+                        spine.args[1]),
+            fuse_result(parse_memory,
+                        fuse_memory,
+                        fused,
+                        params,
+                        spine.args[2]),
+        };
+        return get_call(&parse_memory->exprs, spine.head, args, 3);
+    }
+    if (is_producer_call(fused, &spine)) {
+        return get_fused_call(&parse_memory->exprs, fused, &spine);
+    }
+    u8                tag;
+    const ExprBranch* branch = null;
+    if (is_pack(&parse_memory->funcs, &spine, &tag)) {
+        branch = find_branch(fused->consumer->expr, tag);
+    }
+    if ((!branch) || (branch->args.len != spine.len)) {
+        return get_consumer_call(&parse_memory->exprs, fused, expr);
+    }
+    return bind_branch(parse_memory,
+                       fuse_memory,
+                       fused,
+                       params,
+                       branch,
+                       &spine);
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Func* fuse_funcs(ParseMemory<S, B, U, E, F>* parse_memory,
+                              FuseMemory<C, N, R>*        fuse_memory,
+                              const Func*                 consumer,
+                              const Func*                 producer,
+                              usize                       index) {
+    String name = {};
+    {
+        name.len = consumer->name.as_var.len + 1 + producer->name.as_var.len;
+        char* chars = alloc(&fuse_memory->chars, name.len);
+        memcpy(chars, consumer->name.as_var.chars, consumer->name.as_var.len);
+        chars[consumer->name.as_var.len] = '\'';
+        memcpy(&chars[consumer->name.as_var.len + 1],
+               producer->name.as_var.chars,
+               producer->name.as_var.len);
+        name.chars = chars;
+    }
+    {
+        const Func* func = find_func(&parse_memory->funcs, name);
+        if (func) {
+            fuse_memory->chars.len -= name.len;
+            return func;
+        }
+    }
+    Func* func = alloc(&parse_memory->funcs);
+    *func = {};
+    func->tag = FUNC_VAR;
+    func->name.as_var = name;
+    EXIT_IF(consumer->args.len <= index);
+    func->args.len = (consumer->args.len - 1) + producer->args.len;
+    func->args.items = alloc(&parse_memory->strings, func->args.len);
+    String*       arg = func->args.items;
+    const Rename* params = null;
+    for (usize i = 0; i < consumer->args.len; ++i) {
+        if (i == index) {
+            continue;
+        }
+        const String fresh = get_fresh(fuse_memory, consumer->args.items[i]);
+        params = push_rename(fuse_memory,
+                             params,
+                             consumer->args.items[i],
+                             fresh);
+        *arg++ = fresh;
+    }
+    const Rename* renames = null;
+    for (usize i = 0; i < producer->args.len; ++i) {
+        const String fresh = get_fresh(fuse_memory, producer->args.items[i]);
+        renames = push_rename(fuse_memory,
+                              renames,
+                              producer->args.items[i],
+                              fresh);
+        *arg++ = fresh;
+    }
+    const Fused fused = {consumer, producer, func, index};
+    func->expr = fuse_result(
+        parse_memory,
+        fuse_memory,
+        &fused,
+        params,
+        rename(parse_memory, fuse_memory, renames, producer->expr));
+    return func;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* fuse_expr(ParseMemory<S, B, U, E, F>* parse_memory,
+                             FuseMemory<C, N, R>*        fuse_memory,
+                             List<Fusion>*               fusions,
+                             String                      name,
+                             const Scope*                scope,
+                             const Expr*                 expr);
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* fuse_call(ParseMemory<S, B, U, E, F>* parse_memory,
+                             FuseMemory<C, N, R>*        fuse_memory,
+                             List<Fusion>*               fusions,
+                             String                      name,
+                             const Scope*                scope,
+                             const Spine*                spine) {
+    if ((spine->head->tag != EXPR_VAR) ||
+        is_bound(scope, spine->head->body.as_var))
+    {
+        return null;
+    }
+    const Func* consumer =
+        find_func(&parse_memory->funcs, spine->head->body.as_var);
+    usize index;
+    if ((!consumer) || (!get_index(consumer, &index)) ||
+        (spine->len < consumer->args.len))
+    {
+        return null;
+    }
+    const Spine call = get_spine(spine->args[index]);
+    if ((call.head->tag != EXPR_VAR) ||
+        is_bound(scope, call.head->body.as_var))
+    {
+        return null;
+    }
+    const Func* producer =
+        find_func(&parse_memory->funcs, call.head->body.as_var);
+    if ((!producer) || (producer == consumer) ||
+        (producer->args.len != call.len) ||
+        (!has_pack(&parse_memory->funcs, producer->expr)))
+    {
+        return null;
+    }
+    fuse_memory->renames.len = 0;
+    const Func* func =
+        fuse_funcs(parse_memory, fuse_memory, consumer, producer, index);
+    Spine args = {};
+    for (usize i = 0; i < consumer->args.len; ++i) {
+        if (i != index) {
+            args.args[args.len++] = spine->args[i];
+        }
+    }
+    for (usize i = 0; i < call.len; ++i) {
+        args.args[args.len++] = call.args[i];
+    }
+    for (usize i = consumer->args.len; i < spine->len; ++i) {
+        args.args[args.len++] = spine->args[i];
+    }
+    for (usize i = 0; i < args.len; ++i) {
+        args.args[i] = fuse_expr(parse_memory,
+                                 fuse_memory,
+                                 fusions,
+                                 name,
+                                 scope,
+                                 args.args[i]);
+    }
+    Fusion fusion = {name, consumer->name.as_var, producer->name.as_var};
+    append(&fuse_memory->fusions, fusions, fusion);
+    return get_call(&parse_memory->exprs,
+                    get_var(&parse_memory->exprs, func->name.as_var),
+                    args.args,
+                    args.len);
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* fuse_expr(ParseMemory<S, B, U, E, F>* parse_memory,
+                             FuseMemory<C, N, R>*        fuse_memory,
+                             List<Fusion>*               fusions,
+                             String                      name,
+                             const Scope*                scope,
+                             const Expr*                 expr) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        {
+            const Spine spine = get_spine(expr);
+            const Expr* call = fuse_call(parse_memory,
+                                         fuse_memory,
+                                         fusions,
+                                         name,
+                                         scope,
+                                         &spine);
+            if (call) {
+                return call;
+            }
+        }
+        const Expr* l = fuse_expr(parse_memory,
+                                  fuse_memory,
+                                  fusions,
+                                  name,
+                                  scope,
+                                  expr->body.as_app[0]);
+        const Expr* r = fuse_expr(parse_memory,
+                                  fuse_memory,
+                                  fusions,
+                                  name,
+                                  scope,
+                                  expr->body.as_app[1]);
+        if ((l == expr->body.as_app[0]) && (r == expr->body.as_app[1])) {
+            return expr;
+        }
+        return get_app(&parse_memory->exprs, l, r);
+    }
+    case EXPR_BINOP: {
+        const Expr* l = fuse_expr(parse_memory,
+                                  fuse_memory,
+                                  fusions,
+                                  name,
+                                  scope,
+                                  expr->body.as_binop.args[0]);
+        const Expr* r = fuse_expr(parse_memory,
+                                  fuse_memory,
+                                  fusions,
+                                  name,
+                                  scope,
+                                  expr->body.as_binop.args[1]);
+        if ((l == expr->body.as_binop.args[0]) &&
+            (r == expr->body.as_binop.args[1]))
+        {
+            return expr;
+        }
+        return get_binop(&parse_memory->exprs, expr->body.as_binop.op, l, r);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        Scope                    scopes[CAP_BINDERS];
+        const usize              len = bindings->len;
+        EXIT_IF(CAP_BINDERS < len);
+        for (usize i = 0; i < len; ++i) {
+            scopes[i].name = bindings->items[i].name;
+            scopes[i].next = i == 0 ? scope : &scopes[i - 1];
+        }
+        const Scope* inner = len == 0 ? scope : &scopes[len - 1];
+        const Scope* outer = expr->tag == EXPR_LET ? scope : inner;
+        Expr*        copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = expr->tag;
+        copy->body.as_let.bindings = {
+            alloc(&parse_memory->bindings, len),
+            len,
+        };
+        for (usize i = 0; i < len; ++i) {
+            ExprBinding* binding = &copy->body.as_let.bindings.items[i];
+            *binding = bindings->items[i];
+            binding->expr = fuse_expr(parse_memory,
+                                      fuse_memory,
+                                      fusions,
+                                      name,
+                                      outer,
+                                      bindings->items[i].expr);
+        }
+        copy->body.as_let.expr = fuse_expr(parse_memory,
+                                           fuse_memory,
+                                           fusions,
+                                           name,
+                                           inner,
+                                           expr->body.as_let.expr);
+        return copy;
+    }
+    case EXPR_UNPACK: {
+        Expr* copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = EXPR_UNPACK;
+        copy->body.as_unpack.expr = fuse_expr(parse_memory,
+                                              fuse_memory,
+                                              fusions,
+                                              name,
+                                              scope,
+                                              expr->body.as_unpack.expr);
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        copy->body.as_unpack.branches = {
+            alloc(&parse_memory->branches, branches->len),
+            branches->len,
+        };
+        for (usize i = 0; i < branches->len; ++i) {
+            ExprBranch* branch = &copy->body.as_unpack.branches.items[i];
+            *branch = branches->items[i];
+            Scope       scopes[CAP_BINDERS];
+            const usize len = branch->args.len;
+            EXIT_IF(CAP_BINDERS < len);
+            for (usize j = 0; j < len; ++j) {
+                scopes[j].name = branch->args.items[j];
+                scopes[j].next = j == 0 ? scope : &scopes[j - 1];
+            }
+            branch->expr = fuse_expr(parse_memory,
+                                     fuse_memory,
+                                     fusions,
+                                     name,
+                                     len == 0 ? scope : &scopes[len - 1],
+                                     branches->items[i].expr);
+        }
+        return copy;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        return expr;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: The fused functions are named out of `chars`, so a program compiled
+// from them needs `memory` to stay put.
+template <usize C, usize N, usize R>
+static void reset(FuseMemory<C, N, R>* memory) {
+    memory->chars.len = 0;
+    memory->renames.len = 0;
+    memory->fusions.len = 0;
+    memory->fresh = 0;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static List<Fusion> fuse_program(ParseMemory<S, B, U, E, F>* parse_memory,
+                                 FuseMemory<C, N, R>*        fuse_memory) {
+    List<Fusion> fusions = {};
+    const usize  len = parse_memory->funcs.len;
+    for (usize i = 0; i < len; ++i) {
+        Func*        func = &parse_memory->funcs.items[i];
+        Scope        scopes[CAP_BINDERS];
+        const Scope* scope = null;
+        EXIT_IF(CAP_BINDERS < func->args.len);
+        for (usize j = 0; j < func->args.len; ++j) {
+            scopes[j].name = func->args.items[j];
+            scopes[j].next = scope;
+            scope = &scopes[j];
+        }
+        func->expr = fuse_expr(parse_memory,
+                               fuse_memory,
+                               &fusions,
+                               func->name.as_var,
+                               scope,
+                               func->expr);
+    }
+    return fusions;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void test_fuse_program(Tokens<T>*                  tokens,
+                              ParseMemory<S, B, U, E, F>* parse_memory,
+                              FuseMemory<C, N, R>*        fuse_memory) {
+    {
+        set_tokens(GET_STRING("nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "take n xs {\n"
+                              "  if (n == 0) nil (unpack xs {\n"
+                              "    1 = nil;\n"
+                              "    2 y ys = cons y (take (n - 1) ys)\n"
+                              "  })\n"
+                              "}\n"
+                              "sum xs {\n"
+                              "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                              "}\n"
+                              "main xs { sum (take 3 xs) }\n"
+                              "f sum { sum (take 3 nil) }"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        const List<Fusion> fusions = fuse_program(parse_memory, fuse_memory);
+        EXIT_IF(!fusions.first);
+        EXIT_IF(fusions.first->next);
+        EXIT_IF(fusions.first->value.func != GET_STRING("main"));
+        EXIT_IF(fusions.first->value.consumer != GET_STRING("sum"));
+        EXIT_IF(fusions.first->value.producer != GET_STRING("take"));
+        EXIT_IF(parse_memory->funcs.len != 7);
+        const Func* func = &parse_memory->funcs.items[6];
+        EXIT_IF(func->name.as_var != GET_STRING("sum'take"));
+        EXIT_IF(func->args.len != 2);
+        EXIT_IF(is_free(func->expr, GET_STRING("nil")));
+        EXIT_IF(is_free(func->expr, GET_STRING("cons")));
+        EXIT_IF(is_free(func->expr, GET_STRING("take")));
+        EXIT_IF(is_free(func->expr, GET_STRING("sum")));
+        EXIT_IF(!is_free(func->expr, GET_STRING("sum'take")));
+        const Spine spine = get_spine(parse_memory->funcs.items[4].expr);
+        EXIT_IF(!is_var(spine.head, GET_STRING("sum'take")));
+        EXIT_IF(spine.len != 2);
+        EXIT_IF(spine.args[0]->body.as_u32 != 3);
+        EXIT_IF(!is_var(spine.args[1], GET_STRING("xs")));
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("fib n { if (n < 2) n (fib (n - 1) + "
+                              "fib (n - 2)) }\n"
+                              "nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "sum xs {\n"
+                              "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                              "}\n"
+                              "c xs {\n"
+                              "  unpack xs { 1 = 0; 2 y ys = sum ys + c ys }\n"
+                              "}\n"
+                              "p n {\n"
+                              "  if (n == 0) nil (cons (fib 18) (p (n - 1)))\n"
+                              "}\n"
+                              "main { c (p 10) }"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        const List<Fusion> fusions = fuse_program(parse_memory, fuse_memory);
+        EXIT_IF((!fusions.first) || fusions.first->next);
+        EXIT_IF(fusions.first->value.consumer != GET_STRING("c"));
+        EXIT_IF(fusions.first->value.producer != GET_STRING("p"));
+        EXIT_IF(parse_memory->funcs.len != 8);
+        const Func* func = &parse_memory->funcs.items[7];
+        EXIT_IF(func->name.as_var != GET_STRING("c'p"));
+        EXIT_IF(is_free(func->expr, GET_STRING("c'p")));
+        EXIT_IF(!is_free(func->expr, GET_STRING("c")));
+        EXIT_IF(!is_free(func->expr, GET_STRING("p")));
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef __GC_H__
+#define __GC_H__
+
+#include "inst.hpp"
+
+template <usize N>
+static bool is_in(const Buffer<Node, N>* nodes, const Node* node) {
+    return (&nodes->items[0] <= node) && (node < &nodes->items[nodes->len]);
+}
+
+static Node* follow_forward(Node* node) {
+    if (get_tag(node) == NODE_FORWARD) {
+        return reinterpret_cast<Node*>(node->header & ~NODE_TAG_MASK);
+    }
+    return node;
+}
+
+// NOTE: Per-cell side tables kept in step with the two halves of a heap; a
+// copied node takes the entry of its first cell along.
+struct CellTags {
+    const u32* from;
+    u32*       to;
+};
+
+// NOTE: The field an application of a selector global picks out once its
+// argument is a constructor, or null. The constructor may already have been
+// moved, in which case its copy is read instead.
+static Node* get_selected(const InstCode* codes, Node* node) {
+    if ((!codes) || (get_tag(node) != NODE_APP)) {
+        return null;
+    }
+    const Node* func = follow_forward(follow_indirs(get_app_func(node)));
+    if (get_tag(func) != NODE_GLOBAL) {
+        return null;
+    }
+    const InstSelect select = codes[func->body.as_global].select;
+    if (select.arity == 0) {
+        return null;
+    }
+    Node* arg = follow_forward(follow_indirs(get_app_arg(node)));
+    if ((get_tag(arg) != NODE_DATA) || (get_pack_tag(arg) != select.tag) ||
+        (get_arity(arg) != select.arity))
+    {
+        return null;
+    }
+    return get_fields(arg)[select.field];
+}
+
+// NOTE: With `codes`, selector thunks over evaluated constructors are
+// replaced by the selected field, so the rest of the constructor is not kept
+// alive by them. The thunk is marked as a black hole while its field is
+// copied, so a selector that picks itself out is left for the evaluator to
+// report instead of looping here.
+template <usize N>
+static Node* copy(const Buffer<Node, N>* from,
+                  Buffer<Node, N>*       to,
+                  const InstCode*        codes,
+                  const CellTags*        tags,
+                  Node*                  node) {
+    while (get_tag(node) == NODE_INDIR) {
+        node = node->body.as_node;
+    }
+    if (!is_in(from, node)) {
+        return node;
+    }
+    if (get_tag(node) == NODE_FORWARD) {
+        return follow_forward(node);
+    }
+    Node* field = get_selected(codes, node);
+    if (field) {
+        node->header = NODE_BLACKHOLE;
+        Node* result = copy(from, to, codes, tags, field);
+        node->header = reinterpret_cast<usize>(result) | NODE_FORWARD;
+        return result;
+    }
+    const usize n = get_cells(node);
+    Node*       copy = alloc(to, n);
+    memcpy(copy, node, sizeof(Node) * n);
+    if (tags) {
+        tags->to[static_cast<usize>(copy - to->items)] =
+            tags->from[static_cast<usize>(node - from->items)];
+    }
+    node->header = reinterpret_cast<usize>(copy) | NODE_FORWARD;
+    return copy;
+}
+
+template <usize N>
+static void copy_roots(const Buffer<Node, N>* from,
+                       Buffer<Node, N>*       to,
+                       const InstCode*        codes,
+                       const CellTags*        tags,
+                       Node**                 roots,
+                       usize                  len) {
+    for (usize i = 0; i < len; ++i) {
+        roots[i] = copy(from, to, codes, tags, roots[i]);
+    }
+}
+
+// NOTE: Copies everything reachable from the nodes at `to->items[i]` onwards;
+// the nodes before `i` have to be scanned already.
+template <usize N>
+static void scan(const Buffer<Node, N>* from,
+                 Buffer<Node, N>*       to,
+                 const InstCode*        codes,
+                 const CellTags*        tags,
+                 usize                  i) {
+    while (i < to->len) {
+        Node* node = &to->items[i];
+        switch (get_tag(node)) {
+        case NODE_APP: {
+            Node* func = copy(from, to, codes, tags, get_app_func(node));
+            Node* arg = copy(from, to, codes, tags, get_app_arg(node));
+            set_app(node, func, arg);
+            ++i;
+            break;
+        }
+        case NODE_DATA: {
+            const u8 arity = get_arity(node);
+            Node**   fields = get_fields(node);
+            for (u8 j = 0; j < arity; ++j) {
+                fields[j] = copy(from, to, codes, tags, fields[j]);
+            }
+            i += NODE_CELLS(arity);
+            break;
+        }
+        case NODE_ARRAY: {
+            i += get_cells(node);
+            break;
+        }
+        case NODE_UNDEF:
+        case NODE_I64:
+        case NODE_GLOBAL:
+        case NODE_BLACKHOLE: {
+            ++i;
+            break;
+        }
+        case NODE_INDIR:
+        case NODE_FORWARD: {
+            EXIT();
+        }
+        }
+    }
+}
+
+template <usize N>
+static void collect(Buffer<Node, N>* from,
+                    Buffer<Node, N>* to,
+                    const InstCode*  codes,
+                    Node**           roots,
+                    usize            len) {
+    to->len = 0;
+    copy_roots(from, to, codes, null, roots, len);
+    scan(from, to, codes, null, 0);
+    from->len = 0;
+}
+
+template <usize N>
+static void test_collect(Buffer<Node, N>* from,
+                         Buffer<Node, N>* to,
+                         NodeShared*      shared) {
+    {
+        from->len = 0;
+        alloc_i64(from, 1);
+        Node* x = alloc_i64(from, 2);
+        Node* f = alloc_global(from, 0, 2);
+        Node* a = alloc_app(from, f, x);
+        Node* b = alloc_indir(from, alloc_indir(from, a));
+        alloc_i64(from, 3);
+        Node* c = alloc_app(from, b, b);
+        Node* roots[] = {c, b};
+        collect(from, to, null, roots, sizeof(roots) / sizeof(roots[0]));
+        EXIT_IF(from->len != 0);
+        EXIT_IF(to->len != 4);
+        EXIT_IF(!is_in(to, roots[0]));
+        EXIT_IF(get_tag(roots[0]) != NODE_APP);
+        EXIT_IF(get_tag(roots[1]) != NODE_APP);
+        EXIT_IF(get_app_func(roots[0]) != roots[1]);
+        EXIT_IF(get_app_arg(roots[0]) != roots[1]);
+        EXIT_IF(get_tag(get_app_func(roots[1])) != NODE_GLOBAL);
+        EXIT_IF(get_app_arg(roots[1])->body.as_i64 != 2);
+        fprintf(stderr, ".");
+    }
+    {
+        from->len = 0;
+        Node* cons = get_pack(shared, from, 2, 2);
+        get_fields(cons)[0] = get_i64(shared, from, 0);
+        get_fields(cons)[1] = alloc_indir(from, get_pack(shared, from, 1, 0));
+        Node* roots[] = {alloc_indir(from, cons)};
+        collect(from, to, null, roots, sizeof(roots) / sizeof(roots[0]));
+        EXIT_IF(to->len != NODE_CELLS(2));
+        EXIT_IF(get_tag(roots[0]) != NODE_DATA);
+        EXIT_IF(get_fields(roots[0])[0] != get_i64(shared, to, 0));
+        EXIT_IF(get_fields(roots[0])[1] != get_pack(shared, to, 1, 0));
+        EXIT_IF(to->len != NODE_CELLS(2));
+        fprintf(stderr, ".");
+    }
+    {
+        from->len = 0;
+        InstCode codes[1] = {};
+        codes[0].select = {3, 2, 0};
+        Node* pair = get_pack(shared, from, 3, 2);
+        get_fields(pair)[0] = alloc_i64(from, 1000);
+        get_fields(pair)[1] = alloc_array(from, 16);
+        Node* f = alloc_global(from, 0, 1);
+        Node* a = alloc_app(from, f, alloc_indir(from, pair));
+        Node* roots[] = {a, alloc_app(from, f, a)};
+        collect(from, to, codes, roots, sizeof(roots) / sizeof(roots[0]));
+        EXIT_IF(to->len != 3);
+        EXIT_IF(get_tag(roots[0]) != NODE_I64);
+        EXIT_IF(roots[0]->body.as_i64 != 1000);
+        EXIT_IF(get_tag(roots[1]) != NODE_APP);
+        EXIT_IF(get_app_arg(roots[1]) != roots[0]);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif
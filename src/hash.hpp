@@ -33,7 +33,7 @@ static u32 hash(String string) {
 }
 
 template <typename K, typename V, usize N>
-static u32 find_slot(Table<K, V, N>* table, K key) {
+static u32 find_slot(const Table<K, V, N>* table, K key) {
     u32 h = hash(key);
     for (u32 i = 0; i < N; ++i) {
         u32 j = (h + i) % N;
@@ -53,6 +53,15 @@ static V* lookup(Table<K, V, N>* table, K key) {
     return null;
 }
 
+template <typename K, typename V, usize N>
+static const V* lookup(const Table<K, V, N>* table, K key) {
+    const Item<K, V>* item = &table->items[find_slot(table, key)];
+    if (item->alive) {
+        return &item->value;
+    }
+    return null;
+}
+
 template <typename K, typename V, usize N>
 static void insert(Table<K, V, N>* table, K key, V value) {
     EXIT_IF(N <= table->len);
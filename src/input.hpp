@@ -0,0 +1,95 @@
+#ifndef __INPUT_H__
+#define __INPUT_H__
+
+#include "inst.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef INPUT_WINDOW
+    #define INPUT_WINDOW 64
+#endif
+
+STATIC_ASSERT(0 < INPUT_WINDOW);
+
+// NOTE: Matches `nil` and `cons` from `examples/prelude.core`.
+#define INPUT_NIL  1
+#define INPUT_CONS 2
+
+#define INPUT_CELLS ((NODE_CELLS(2) * INPUT_WINDOW) + 2)
+
+struct Input {
+    const u8* bytes;
+    usize     len;
+};
+
+// NOTE: The mapping is read-only and faulted in on demand, so only the pages
+// the program actually walks over are ever resident.
+static Input map_input(File* file) {
+    struct stat info;
+    EXIT_IF(fstat(fileno(file), &info) != 0);
+    EXIT_IF(info.st_size < 0);
+    Input input = {null, static_cast<usize>(info.st_size)};
+    if (input.len == 0) {
+        return input;
+    }
+    void* bytes =
+        mmap(null, input.len, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    EXIT_IF(bytes == MAP_FAILED);
+    EXIT_IF(madvise(bytes, input.len, MADV_SEQUENTIAL) != 0);
+    input.bytes = reinterpret_cast<const u8*>(bytes);
+    return input;
+}
+
+// NOTE: The mapping outlives the file, which is closed right away. No path
+// maps nothing, so `input_from` sees an empty input.
+static Input map_input(const char* path) {
+    Input input = {null, 0};
+    if (!path) {
+        return input;
+    }
+    File* file = fopen(path, "r");
+    EXIT_IF(!file);
+    input = map_input(file);
+    EXIT_IF(fclose(file) != 0);
+    return input;
+}
+
+static void unmap_input(Input* input) {
+    if (input->bytes) {
+        EXIT_IF(munmap(const_cast<u8*>(input->bytes), input->len) != 0);
+    }
+    input->bytes = null;
+    input->len = 0;
+}
+
+// NOTE: Decodes the window starting at `offset` into a list whose last tail
+// is the thunk `func (offset + INPUT_WINDOW)`, or `nil` at the end of input.
+// Nothing points back at consumed cells, so the collector reclaims them and a
+// fold over the input runs in constant space. Needs `INPUT_CELLS` free nodes.
+template <usize N>
+static Node* decode_input(const Input*     input,
+                          NodeShared*      shared,
+                          Buffer<Node, N>* nodes,
+                          Node*            func,
+                          usize            offset) {
+    const usize low = offset < input->len ? offset : input->len;
+    const usize high =
+        INPUT_WINDOW < (input->len - low) ? low + INPUT_WINDOW : input->len;
+    Node* node =
+        high < input->len
+            ? alloc_app(nodes,
+                        func,
+                        get_i64(shared, nodes, static_cast<i64>(high)))
+            : get_pack(shared, nodes, INPUT_NIL, 0);
+    for (usize i = high; i != low; --i) {
+        Node*  cons = get_pack(shared, nodes, INPUT_CONS, 2);
+        Node** fields = get_fields(cons);
+        fields[0] = get_i64(shared, nodes, input->bytes[i - 1]);
+        fields[1] = node;
+        node = cons;
+    }
+    return node;
+}
+
+#endif
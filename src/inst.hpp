@@ -2,6 +2,7 @@
 #define __INST_H__
 
 #include "hash.hpp"
+#include "lang.hpp"
 #include "list.hpp"
 
 enum InstTag {
@@ -19,6 +20,8 @@ enum InstTag {
     INST_ALLOC,
     INST_SLIDE,
     INST_EVAL,
+    INST_CALL,
+    INST_TAIL_CALL,
 
     INST_PACK,
     INST_JUMP,
@@ -40,12 +43,28 @@ enum InstTag {
 
     INST_OR,
     INST_AND,
+
+    INST_PRIM,
+};
+
+enum Prim {
+    PRIM_FILL = 0,
+    PRIM_RANGE,
+    PRIM_LEN,
+    PRIM_GET,
+    PRIM_SLICE,
+    PRIM_ADD,
+    PRIM_SUB,
+    PRIM_MUL,
+    PRIM_SUM,
+    PRIM_EQ,
+    PRIM_INPUT,
 };
 
 typedef struct Inst Inst;
 
 struct InstCond {
-    List<Inst> insts[2];
+    const ListNode<Inst>* insts[2];
 };
 
 struct InstPack {
@@ -53,12 +72,29 @@ struct InstPack {
     u8 arity;
 };
 
+// NOTE: `depth` is only read by `INST_TAIL_CALL`: the number of items between
+// the frame's root and the arguments, dropped before the callee takes over.
+struct InstCall {
+    u32 global;
+    u32 depth;
+};
+
+// NOTE: `tags` is null for a dense table, indexed by `tag - low`; otherwise
+// the table is sparse and `tags` holds the sorted tag of each entry.
+struct InstJump {
+    const ListNode<Inst>* const* insts;
+    const u8*                    tags;
+    u16                          len;
+    u8                           low;
+};
+
 union InstBody {
-    String            as_string;
-    i64               as_i64;
-    InstCond          as_cond;
-    InstPack          as_pack;
-    const List<Inst>* as_jump;
+    i64      as_i64;
+    u32      as_global;
+    InstCond as_cond;
+    InstPack as_pack;
+    InstCall as_call;
+    InstJump as_jump;
 };
 
 struct Inst {
@@ -66,11 +102,33 @@ struct Inst {
     InstTag  tag;
 };
 
+static const ListNode<Inst>* get_jump(const InstJump* jump, u8 tag) {
+    if (!jump->tags) {
+        const usize i = static_cast<usize>(tag - jump->low);
+        return (jump->low <= tag) && (i < jump->len) ? jump->insts[i] : null;
+    }
+    usize l = 0;
+    usize r = jump->len;
+    while (l < r) {
+        const usize m = l + ((r - l) / 2);
+        if (jump->tags[m] < tag) {
+            l = m + 1;
+        } else {
+            r = m;
+        }
+    }
+    return (l < jump->len) && (jump->tags[l] == tag) ? jump->insts[l] : null;
+}
+
 typedef struct Node Node;
 
+// NOTE: A dump entry; `base` is the stack length below the node under
+// evaluation, so returning truncates the stack back to it, and `global` is
+// the global whose code `insts` belongs to.
 struct InstFrame {
-    List<Inst>  insts;
-    List<Node*> nodes;
+    const ListNode<Inst>* insts;
+    usize                 base;
+    u32                   global;
 };
 
 enum NodeTag {
@@ -80,38 +138,407 @@ enum NodeTag {
     NODE_GLOBAL,
     NODE_INDIR,
     NODE_DATA,
+    NODE_ARRAY,
+    NODE_BLACKHOLE,
+    NODE_FORWARD,
 };
 
-struct NodeGlobal {
-    List<Inst> insts;
-    u8         arity;
+// NOTE: Set for a one-argument global that unpacks its argument and, for a
+// constructor with this tag and arity, returns field `field` untouched. The
+// collector reduces an application of one to an evaluated constructor. An
+// arity of zero means the global is not a selector.
+struct InstSelect {
+    u8 tag;
+    u8 arity;
+    u8 field;
 };
 
-struct NodePack {
-    List<Node*> as_nodes;
-    u8          tag;
+// NOTE: `depth` is the most stack items a frame running `insts` holds at
+// once, counting its root and arguments.
+struct InstCode {
+    const ListNode<Inst>* insts;
+    InstSelect            select;
+    u8                    arity;
+    u32                   depth;
 };
 
+// NOTE: Nodes are aligned so the tag fits in the low bits of the header word.
+// For `NODE_APP` the rest of the header is the function pointer; otherwise it
+// holds the constructor tag and arity, or the length of a `NODE_ARRAY`.
+// `NODE_DATA` fields and `NODE_ARRAY` elements follow inline.
+#define NODE_TAG_BITS  4
+#define NODE_TAG_MASK  ((static_cast<usize>(1) << NODE_TAG_BITS) - 1)
+#define NODE_PACK_TAG  8
+#define NODE_ARITY     16
+#define NODE_ARRAY_LEN 8
+#define NODE_CELLS(x)  ((static_cast<usize>(x) + 2) / 2)
+
 union NodeBody {
-    i64        as_i64;
-    Node*      as_app[2];
-    NodeGlobal as_global;
-    Node*      as_indir;
-    NodePack   as_pack;
+    i64   as_i64;
+    Node* as_node;
+    u32   as_global;
 };
 
-struct Node {
+struct alignas(1 << NODE_TAG_BITS) Node {
+    usize    header;
     NodeBody body;
-    NodeTag  tag;
 };
 
-template <usize I, usize L, usize N, usize F, usize G>
+STATIC_ASSERT(sizeof(Node) == 16);
+
+static NodeTag get_tag(const Node* node) {
+    return static_cast<NodeTag>(node->header & NODE_TAG_MASK);
+}
+
+static u8 get_pack_tag(const Node* node) {
+    return static_cast<u8>(node->header >> NODE_PACK_TAG);
+}
+
+static u8 get_arity(const Node* node) {
+    return static_cast<u8>(node->header >> NODE_ARITY);
+}
+
+static Node* get_app_func(const Node* node) {
+    return reinterpret_cast<Node*>(node->header & ~NODE_TAG_MASK);
+}
+
+static Node* get_app_arg(const Node* node) {
+    return node->body.as_node;
+}
+
+static Node** get_fields(Node* node) {
+    return &node->body.as_node;
+}
+
+static usize get_array_len(const Node* node) {
+    return node->header >> NODE_ARRAY_LEN;
+}
+
+static i64* get_i64s(Node* node) {
+    return &node->body.as_i64;
+}
+
+static usize get_cells(const Node* node) {
+    switch (get_tag(node)) {
+    case NODE_DATA: {
+        return NODE_CELLS(get_arity(node));
+    }
+    case NODE_ARRAY: {
+        return NODE_CELLS(get_array_len(node));
+    }
+    case NODE_UNDEF:
+    case NODE_I64:
+    case NODE_APP:
+    case NODE_GLOBAL:
+    case NODE_INDIR:
+    case NODE_BLACKHOLE:
+    case NODE_FORWARD: {
+        return 1;
+    }
+    }
+    EXIT();
+}
+
+static void set_app(Node* node, Node* func, Node* arg) {
+    const usize header = reinterpret_cast<usize>(func);
+    EXIT_IF(header & NODE_TAG_MASK);
+    node->header = header | NODE_APP;
+    node->body.as_node = arg;
+}
+
+static void set_indir(Node* node, Node* target) {
+    node->header = NODE_INDIR;
+    node->body.as_node = target;
+}
+
+static Node* follow_indirs(Node* node) {
+    Node* target = node;
+    while (get_tag(target) == NODE_INDIR) {
+        target = target->body.as_node;
+    }
+    while (node != target) {
+        Node* next = node->body.as_node;
+        node->body.as_node = target;
+        node = next;
+    }
+    return target;
+}
+
+template <usize N>
+static Node* alloc_i64(Buffer<Node, N>* nodes, i64 value) {
+    Node* node = alloc(nodes);
+    node->header = NODE_I64;
+    node->body.as_i64 = value;
+    return node;
+}
+
+template <usize N>
+static Node* alloc_app(Buffer<Node, N>* nodes, Node* func, Node* arg) {
+    Node* node = alloc(nodes);
+    set_app(node, func, arg);
+    return node;
+}
+
+template <usize N>
+static Node* alloc_global(Buffer<Node, N>* nodes, u32 index, u8 arity) {
+    Node* node = alloc(nodes);
+    node->header = NODE_GLOBAL | (static_cast<usize>(arity) << NODE_ARITY);
+    node->body.as_global = index;
+    return node;
+}
+
+template <usize N>
+static Node* alloc_indir(Buffer<Node, N>* nodes, Node* target) {
+    Node* node = alloc(nodes);
+    set_indir(node, target);
+    return node;
+}
+
+template <usize N>
+static Node* alloc_pack(Buffer<Node, N>* nodes, u8 tag, u8 arity) {
+    Node* node = alloc(nodes, NODE_CELLS(arity));
+    node->header = NODE_DATA | (static_cast<usize>(tag) << NODE_PACK_TAG) |
+                   (static_cast<usize>(arity) << NODE_ARITY);
+    Node** fields = get_fields(node);
+    for (u8 i = 0; i < arity; ++i) {
+        fields[i] = null;
+    }
+    return node;
+}
+
+template <usize N>
+static Node* alloc_array(Buffer<Node, N>* nodes, usize len) {
+    Node* node = alloc(nodes, NODE_CELLS(len));
+    node->header = NODE_ARRAY | (len << NODE_ARRAY_LEN);
+    return node;
+}
+
+template <usize N>
+static void test_alloc_nodes(Buffer<Node, N>* nodes) {
+    {
+        nodes->len = 0;
+        Node* a = alloc_i64(nodes, -1);
+        Node* b = alloc_global(nodes, 3, 2);
+        Node* c = alloc_app(nodes, b, a);
+        EXIT_IF(nodes->len != 3);
+        EXIT_IF(get_tag(a) != NODE_I64);
+        EXIT_IF(a->body.as_i64 != -1);
+        EXIT_IF(get_tag(b) != NODE_GLOBAL);
+        EXIT_IF(get_arity(b) != 2);
+        EXIT_IF(b->body.as_global != 3);
+        EXIT_IF(get_tag(c) != NODE_APP);
+        EXIT_IF(get_app_func(c) != b);
+        EXIT_IF(get_app_arg(c) != a);
+        set_indir(c, a);
+        EXIT_IF(get_tag(c) != NODE_INDIR);
+        EXIT_IF(c->body.as_node != a);
+        fprintf(stderr, ".");
+    }
+    {
+        nodes->len = 0;
+        Node* nil = alloc_pack(nodes, 1, 0);
+        EXIT_IF(nodes->len != 1);
+        Node* x = alloc_i64(nodes, 0);
+        Node* cons = alloc_pack(nodes, 2, 2);
+        EXIT_IF(nodes->len != 4);
+        get_fields(cons)[0] = x;
+        get_fields(cons)[1] = nil;
+        EXIT_IF(get_tag(cons) != NODE_DATA);
+        EXIT_IF(get_pack_tag(cons) != 2);
+        EXIT_IF(get_arity(cons) != 2);
+        EXIT_IF(get_fields(cons)[0] != x);
+        EXIT_IF(get_fields(cons)[1] != nil);
+        EXIT_IF(get_pack_tag(nil) != 1);
+        EXIT_IF(get_arity(nil) != 0);
+        EXIT_IF(get_tag(x) != NODE_I64);
+        fprintf(stderr, ".");
+    }
+    {
+        nodes->len = 0;
+        Node* x = alloc_i64(nodes, 0);
+        Node* a = alloc_indir(nodes, x);
+        Node* b = alloc_indir(nodes, a);
+        Node* c = alloc_indir(nodes, b);
+        EXIT_IF(follow_indirs(c) != x);
+        EXIT_IF(a->body.as_node != x);
+        EXIT_IF(b->body.as_node != x);
+        EXIT_IF(c->body.as_node != x);
+        EXIT_IF(follow_indirs(x) != x);
+        fprintf(stderr, ".");
+    }
+    {
+        nodes->len = 0;
+        Node* a = alloc_array(nodes, 3);
+        Node* b = alloc_array(nodes, 0);
+        EXIT_IF(nodes->len != (NODE_CELLS(3) + NODE_CELLS(0)));
+        EXIT_IF(get_tag(a) != NODE_ARRAY);
+        EXIT_IF(get_array_len(a) != 3);
+        EXIT_IF(get_cells(a) != 2);
+        EXIT_IF(get_array_len(b) != 0);
+        get_i64s(a)[2] = -1;
+        EXIT_IF(b->header != NODE_ARRAY);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#ifndef SHARED_I64_LOW
+    #define SHARED_I64_LOW -16
+#endif
+
+#ifndef SHARED_I64_HIGH
+    #define SHARED_I64_HIGH 255
+#endif
+
+STATIC_ASSERT(SHARED_I64_LOW <= SHARED_I64_HIGH);
+
+struct NodeShared {
+    Node i64s[(SHARED_I64_HIGH - SHARED_I64_LOW) + 1];
+    Node packs[1 << 8];
+};
+
+static void set_shared_i64s(NodeShared* shared) {
+    for (i64 i = SHARED_I64_LOW; i <= SHARED_I64_HIGH; ++i) {
+        Node* node = &shared->i64s[i - SHARED_I64_LOW];
+        node->header = NODE_I64;
+        node->body.as_i64 = i;
+    }
+}
+
+static void set_shared_pack(NodeShared* shared, u8 tag) {
+    shared->packs[tag].header =
+        NODE_DATA | (static_cast<usize>(tag) << NODE_PACK_TAG);
+}
+
+static void set_shared_packs(NodeShared* shared, const Expr* expr) {
+    switch (expr->tag) {
+    case EXPR_PACK: {
+        if (expr->body.as_pack[1] == 0) {
+            set_shared_pack(shared, expr->body.as_pack[0]);
+        }
+        break;
+    }
+    case EXPR_APP: {
+        set_shared_packs(shared, expr->body.as_app[0]);
+        set_shared_packs(shared, expr->body.as_app[1]);
+        break;
+    }
+    case EXPR_BINOP: {
+        set_shared_packs(shared, expr->body.as_binop.args[0]);
+        set_shared_packs(shared, expr->body.as_binop.args[1]);
+        break;
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        for (usize i = 0; i < expr->body.as_let.bindings.len; ++i) {
+            const ExprBinding* binding = &expr->body.as_let.bindings.items[i];
+            set_shared_packs(shared, binding->expr);
+        }
+        set_shared_packs(shared, expr->body.as_let.expr);
+        break;
+    }
+    case EXPR_UNPACK: {
+        set_shared_packs(shared, expr->body.as_unpack.expr);
+        for (usize i = 0; i < expr->body.as_unpack.branches.len; ++i) {
+            const ExprBranch* branch = &expr->body.as_unpack.branches.items[i];
+            set_shared_packs(shared, branch->expr);
+        }
+        break;
+    }
+    case EXPR_UNDEF:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        break;
+    }
+    }
+}
+
+template <usize F>
+static void set_shared_packs(NodeShared*            shared,
+                             const Buffer<Func, F>* funcs) {
+    for (usize i = 0; i < funcs->len; ++i) {
+        set_shared_packs(shared, funcs->items[i].expr);
+    }
+}
+
+template <usize N>
+static Node* get_i64(NodeShared* shared, Buffer<Node, N>* nodes, i64 value) {
+    if ((SHARED_I64_LOW <= value) && (value <= SHARED_I64_HIGH)) {
+        return &shared->i64s[value - SHARED_I64_LOW];
+    }
+    return alloc_i64(nodes, value);
+}
+
+template <usize N>
+static Node* get_pack(NodeShared*      shared,
+                      Buffer<Node, N>* nodes,
+                      u8               tag,
+                      u8               arity) {
+    if ((arity == 0) && (get_tag(&shared->packs[tag]) == NODE_DATA)) {
+        return &shared->packs[tag];
+    }
+    return alloc_pack(nodes, tag, arity);
+}
+
+template <usize N>
+static void test_shared_nodes(NodeShared* shared, Buffer<Node, N>* nodes) {
+    set_shared_i64s(shared);
+    {
+        nodes->len = 0;
+        EXIT_IF(get_i64(shared, nodes, 0) != get_i64(shared, nodes, 0));
+        EXIT_IF(get_i64(shared, nodes, SHARED_I64_LOW)->body.as_i64 !=
+                SHARED_I64_LOW);
+        EXIT_IF(get_i64(shared, nodes, SHARED_I64_HIGH)->body.as_i64 !=
+                SHARED_I64_HIGH);
+        EXIT_IF(nodes->len != 0);
+        Node* node = get_i64(shared, nodes, SHARED_I64_HIGH + 1);
+        EXIT_IF(nodes->len != 1);
+        EXIT_IF(get_tag(node) != NODE_I64);
+        EXIT_IF(node->body.as_i64 != SHARED_I64_HIGH + 1);
+        fprintf(stderr, ".");
+    }
+    {
+        nodes->len = 0;
+        Expr            nil = {};
+        Expr            cons = {};
+        Expr            app = {};
+        Buffer<Func, 1> funcs = {};
+        nil.tag = EXPR_PACK;
+        nil.body.as_pack[0] = 1;
+        nil.body.as_pack[1] = 0;
+        cons.tag = EXPR_PACK;
+        cons.body.as_pack[0] = 2;
+        cons.body.as_pack[1] = 2;
+        app.tag = EXPR_APP;
+        app.body.as_app[0] = &cons;
+        app.body.as_app[1] = &nil;
+        alloc(&funcs)->expr = &app;
+        set_shared_packs(shared, &funcs);
+        Node* node = get_pack(shared, nodes, 1, 0);
+        EXIT_IF(node != get_pack(shared, nodes, 1, 0));
+        EXIT_IF(get_tag(node) != NODE_DATA);
+        EXIT_IF(get_pack_tag(node) != 1);
+        EXIT_IF(get_arity(node) != 0);
+        EXIT_IF(nodes->len != 0);
+        get_pack(shared, nodes, 2, 0);
+        EXIT_IF(nodes->len != 1);
+        get_pack(shared, nodes, 2, 2);
+        EXIT_IF(nodes->len != 3);
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+// NOTE: `depths` runs parallel to `insts`, holding the frame height each
+// instruction starts at once its code has been measured, or zero.
+template <usize N, usize J, usize G>
 struct InstMemory {
-    Buffer<Inst, I>                insts;
-    Buffer<List<Inst>, L>          lists;
-    Buffer<ListNode<Inst>, N>      nodes;
-    Buffer<ListNode<InstFrame>, F> frames;
-    Table<String, Node*, G>        globals;
+    Buffer<ListNode<Inst>, N>        insts;
+    u32                              depths[N];
+    Buffer<const ListNode<Inst>*, J> jumps;
+    Buffer<u8, J>                    tags;
+    Buffer<InstCode, G>              codes;
+    Table<String, u32, G>            globals;
 };
 
 #endif
@@ -0,0 +1,1270 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include "eval.hpp"
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifndef __x86_64__
+    #error "native code is only emitted for x86-64"
+#endif
+
+// NOTE: Registers as the x86-64 encoding numbers them. While native code
+// runs, `rbx` holds the `EvalRegs`, `r12` and `r13` the stack and its length,
+// `r14` the budget and `r15` and `rbp` the heap and its length; the rest are
+// scratch.
+enum JitReg {
+    JIT_RAX = 0,
+    JIT_RCX,
+    JIT_RDX,
+    JIT_RBX,
+    JIT_RSP,
+    JIT_RBP,
+    JIT_RSI,
+    JIT_RDI,
+    JIT_R8,
+    JIT_R9,
+    JIT_R10,
+    JIT_R11,
+    JIT_R12,
+    JIT_R13,
+    JIT_R14,
+    JIT_R15,
+};
+
+enum JitCond {
+    JIT_B = 0x2,
+    JIT_AE = 0x3,
+    JIT_E = 0x4,
+    JIT_NE = 0x5,
+    JIT_A = 0x7,
+    JIT_L = 0xC,
+    JIT_GE = 0xD,
+    JIT_LE = 0xE,
+    JIT_G = 0xF,
+};
+
+// NOTE: The register-to-register opcodes; the matching immediate forms take
+// `op >> 3` as their extension.
+enum JitAlu {
+    JIT_ADD = 0x01,
+    JIT_OR = 0x09,
+    JIT_AND = 0x21,
+    JIT_SUB = 0x29,
+    JIT_CMP = 0x39,
+};
+
+// NOTE: `[base + (index << shift) + disp]`; `rsp` cannot be an index, so as
+// one it means none.
+struct JitMem {
+    JitReg base;
+    JitReg index;
+    u8     shift;
+    i32    disp;
+};
+
+struct JitCode {
+    u8*   bytes;
+    usize len;
+    usize cap;
+};
+
+struct JitFixup {
+    u32 at;
+    u32 inst;
+};
+
+#define JIT_NONE   0xFFFFFFFFu
+#define JIT_QUEUED 0xFFFFFFFEu
+#define JIT_STUB   18
+
+// NOTE: Every instruction reachable from a code gets native code of its own at
+// `offsets`, and every instruction a stub that hands it back to the
+// interpreter: the budget check and every slow path jump there before
+// changing anything, so the interpreter runs the instruction from scratch.
+// Calls, tail calls and returns of evaluated nodes stay native as long as the
+// current segment has room; unwinding anything else, primitives and
+// anything that would link or unlink a segment are left to the interpreter.
+template <usize N, usize J>
+struct Jit {
+    JitCode                       code;
+    usize                         exit;
+    usize                         stubs;
+    u32                           offsets[N];
+    Buffer<u32, N>                work;
+    Buffer<JitFixup, (N * 2) + J> fixups;
+    const void*                   entries[N];
+    EvalNative                    native;
+};
+
+static JitMem mem_of(JitReg base, i32 disp) {
+    return {base, JIT_RSP, 0, disp};
+}
+
+static JitMem mem_regs(usize offset) {
+    return mem_of(JIT_RBX, static_cast<i32>(offset));
+}
+
+static JitMem mem_frame(usize offset) {
+    return mem_of(JIT_RSI, static_cast<i32>(offset));
+}
+
+static JitMem mem_top(usize offset) {
+    return {JIT_R12, JIT_R13, 3, -8 * static_cast<i32>(offset + 1)};
+}
+
+// NOTE: An opcode with a register or condition in its low bits.
+static u8 get_op(u32 op, u32 low) {
+    return static_cast<u8>(op | low);
+}
+
+static void emit_u8(JitCode* code, u8 byte) {
+    EXIT_IF(code->cap <= code->len);
+    code->bytes[code->len++] = byte;
+}
+
+static void emit_u32(JitCode* code, u32 value) {
+    for (u32 i = 0; i < 32; i += 8) {
+        emit_u8(code, static_cast<u8>(value >> i));
+    }
+}
+
+static void emit_u64(JitCode* code, u64 value) {
+    for (u32 i = 0; i < 64; i += 8) {
+        emit_u8(code, static_cast<u8>(value >> i));
+    }
+}
+
+static void emit_rex(JitCode* code, bool wide, u32 reg, u32 index, u32 base) {
+    emit_u8(code,
+            static_cast<u8>(0x40 | (wide ? 0x8 : 0) | ((reg >> 3) << 2) |
+                            ((index >> 3) << 1) | (base >> 3)));
+}
+
+static void emit_rr(JitCode* code, bool wide, u8 op, u32 reg, JitReg rm) {
+    emit_rex(code, wide, reg, 0, rm);
+    emit_u8(code, op);
+    emit_u8(code, static_cast<u8>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+static void emit_mem(JitCode* code, bool wide, u8 op, u32 reg, JitMem mem) {
+    emit_rex(code, wide, reg, mem.index, mem.base);
+    emit_u8(code, op);
+    emit_u8(code, static_cast<u8>(0x84 | ((reg & 7) << 3)));
+    emit_u8(code,
+            static_cast<u8>((mem.shift << 6) | ((mem.index & 7) << 3) |
+                            (mem.base & 7)));
+    emit_u32(code, static_cast<u32>(mem.disp));
+}
+
+static void emit_load(JitCode* code, JitReg dst, JitMem src) {
+    emit_mem(code, true, 0x8B, dst, src);
+}
+
+static void emit_load32(JitCode* code, JitReg dst, JitMem src) {
+    emit_mem(code, false, 0x8B, dst, src);
+}
+
+static void emit_store(JitCode* code, JitMem dst, JitReg src) {
+    emit_mem(code, true, 0x89, src, dst);
+}
+
+static void emit_store32(JitCode* code, JitMem dst, JitReg src) {
+    emit_mem(code, false, 0x89, src, dst);
+}
+
+static void emit_store_imm(JitCode* code, JitMem dst, i32 value) {
+    emit_mem(code, true, 0xC7, 0, dst);
+    emit_u32(code, static_cast<u32>(value));
+}
+
+static void emit_store32_imm(JitCode* code, JitMem dst, u32 value) {
+    emit_mem(code, false, 0xC7, 0, dst);
+    emit_u32(code, value);
+}
+
+static void emit_lea(JitCode* code, JitReg dst, JitMem src) {
+    emit_mem(code, true, 0x8D, dst, src);
+}
+
+static void emit_mov(JitCode* code, JitReg dst, JitReg src) {
+    emit_rr(code, true, 0x89, src, dst);
+}
+
+static void emit_mov_imm(JitCode* code, JitReg dst, u64 value) {
+    emit_rex(code, true, 0, 0, dst);
+    emit_u8(code, get_op(0xB8, dst & 7u));
+    emit_u64(code, value);
+}
+
+static void emit_alu(JitCode* code, JitAlu op, JitReg dst, JitReg src) {
+    emit_rr(code, true, op, src, dst);
+}
+
+static void emit_alu_imm(JitCode* code, JitAlu op, JitReg dst, i32 value) {
+    emit_rr(code, true, 0x81, static_cast<u32>(op) >> 3, dst);
+    emit_u32(code, static_cast<u32>(value));
+}
+
+static void emit_alu_mem(JitCode* code, JitAlu op, JitReg dst, JitMem src) {
+    emit_mem(code, true, static_cast<u8>(op + 2), dst, src);
+}
+
+static void emit_cmp_mem_imm(JitCode* code, JitMem mem, i32 value) {
+    emit_mem(code, true, 0x81, JIT_CMP >> 3, mem);
+    emit_u32(code, static_cast<u32>(value));
+}
+
+static void emit_test(JitCode* code, JitReg a, JitReg b) {
+    emit_rr(code, true, 0x85, b, a);
+}
+
+static void emit_inc(JitCode* code, JitReg reg) {
+    emit_rr(code, true, 0xFF, 0, reg);
+}
+
+static void emit_dec(JitCode* code, JitReg reg) {
+    emit_rr(code, true, 0xFF, 1, reg);
+}
+
+static void emit_shl(JitCode* code, JitReg reg, u8 n) {
+    emit_rr(code, true, 0xC1, 4, reg);
+    emit_u8(code, n);
+}
+
+static void emit_shr(JitCode* code, JitReg reg, u8 n) {
+    emit_rr(code, true, 0xC1, 5, reg);
+    emit_u8(code, n);
+}
+
+static void emit_imul(JitCode* code, JitReg dst, JitReg src) {
+    emit_rex(code, true, dst, 0, src);
+    emit_u8(code, 0x0F);
+    emit_u8(code, 0xAF);
+    emit_u8(code, static_cast<u8>(0xC0 | ((dst & 7) << 3) | (src & 7)));
+}
+
+// NOTE: `rax = rax / reg`, sign-extending `rax` into `rdx` first.
+static void emit_idiv(JitCode* code, JitReg reg) {
+    emit_u8(code, 0x48);
+    emit_u8(code, 0x99);
+    emit_rr(code, true, 0xF7, 7, reg);
+}
+
+// NOTE: Sets the low byte of `reg` (one of the first four) to the condition.
+static void emit_setcc(JitCode* code, JitCond cond, JitReg reg) {
+    emit_u8(code, 0x0F);
+    emit_u8(code, get_op(0x90, cond));
+    emit_u8(code, get_op(0xC0, reg));
+}
+
+// NOTE: `rax = al`.
+static void emit_zero_extend(JitCode* code) {
+    emit_u8(code, 0x0F);
+    emit_u8(code, 0xB6);
+    emit_u8(code, 0xC0);
+}
+
+static void emit_push(JitCode* code, JitReg reg) {
+    if (7 < reg) {
+        emit_u8(code, 0x41);
+    }
+    emit_u8(code, get_op(0x50, reg & 7u));
+}
+
+static void emit_pop(JitCode* code, JitReg reg) {
+    if (7 < reg) {
+        emit_u8(code, 0x41);
+    }
+    emit_u8(code, get_op(0x58, reg & 7u));
+}
+
+static void emit_jmp_reg(JitCode* code, JitReg reg) {
+    emit_rr(code, false, 0xFF, 4, reg);
+}
+
+// NOTE: Jumps return where their displacement goes, to be set with `patch`.
+static usize emit_jmp(JitCode* code) {
+    emit_u8(code, 0xE9);
+    emit_u32(code, 0);
+    return code->len - 4;
+}
+
+static usize emit_jcc(JitCode* code, JitCond cond) {
+    emit_u8(code, 0x0F);
+    emit_u8(code, get_op(0x80, cond));
+    emit_u32(code, 0);
+    return code->len - 4;
+}
+
+static void patch(JitCode* code, usize at, usize target) {
+    const u32 disp = static_cast<u32>(target - (at + 4));
+    for (u32 i = 0; i < 4; ++i) {
+        code->bytes[at + i] = static_cast<u8>(disp >> (i * 8));
+    }
+}
+
+// NOTE: Follows indirections from the node in `reg`, leaving its tag in `rcx`.
+static void emit_follow(JitCode* code, JitReg reg) {
+    const usize loop = code->len;
+    emit_load32(code, JIT_RCX, mem_of(reg, 0));
+    emit_alu_imm(code, JIT_AND, JIT_RCX, static_cast<i32>(NODE_TAG_MASK));
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_INDIR);
+    const usize done = emit_jcc(code, JIT_NE);
+    emit_load(code, reg, mem_of(reg, 8));
+    patch(code, emit_jmp(code), loop);
+    patch(code, done, code->len);
+}
+
+// NOTE: Takes `cells` cells off the heap into `reg`; `emit_heap` has checked
+// they are there.
+static void emit_alloc(JitCode* code, JitReg reg, usize cells) {
+    emit_mov(code, reg, JIT_RBP);
+    emit_shl(code, reg, 4);
+    emit_alu(code, JIT_ADD, reg, JIT_R15);
+    emit_alu_imm(code, JIT_ADD, JIT_RBP, static_cast<i32>(cells));
+}
+
+static void emit_push_node(JitCode* code, JitReg reg) {
+    emit_store(code, {JIT_R12, JIT_R13, 3, 0}, reg);
+    emit_inc(code, JIT_R13);
+}
+
+template <usize N, usize J>
+static usize get_stub(const Jit<N, J>* jit, u32 index) {
+    return jit->stubs + (index * JIT_STUB);
+}
+
+// NOTE: Past the stub's budget refund, for instructions that never start.
+template <usize N, usize J>
+static usize get_bail(const Jit<N, J>* jit, u32 index) {
+    return get_stub(jit, index) + 3;
+}
+
+template <usize N, usize J>
+static void emit_bail_if(Jit<N, J>* jit, JitCond cond, u32 index) {
+    patch(&jit->code, emit_jcc(&jit->code, cond), get_stub(jit, index));
+}
+
+template <usize N, usize J>
+static void emit_budget(Jit<N, J>* jit, u32 index) {
+    emit_alu_imm(&jit->code, JIT_SUB, JIT_R14, 1);
+    emit_bail_if(jit, JIT_L, index);
+}
+
+// NOTE: At least `n` items on the stack.
+template <usize N, usize J>
+static void emit_need(Jit<N, J>* jit, u32 index, usize n) {
+    if (n != 0) {
+        emit_alu_imm(&jit->code, JIT_CMP, JIT_R13, static_cast<i32>(n));
+        emit_bail_if(jit, JIT_B, index);
+    }
+}
+
+// NOTE: Room for the stack to reach its length plus `n`.
+template <usize N, usize J>
+static void emit_room(Jit<N, J>* jit, u32 index, i64 n) {
+    emit_lea(&jit->code,
+             JIT_RSI,
+             {JIT_R13, JIT_RSP, 0, static_cast<i32>(n)});
+    emit_alu_mem(&jit->code,
+                 JIT_CMP,
+                 JIT_RSI,
+                 mem_regs(offsetof(EvalRegs, stack_cap)));
+    emit_bail_if(jit, JIT_A, index);
+}
+
+template <usize N, usize J>
+static void emit_heap(Jit<N, J>* jit, u32 index, usize cells) {
+    emit_lea(&jit->code,
+             JIT_RDI,
+             {JIT_RBP, JIT_RSP, 0, static_cast<i32>(cells)});
+    emit_alu_mem(&jit->code,
+                 JIT_CMP,
+                 JIT_RDI,
+                 mem_regs(offsetof(EvalRegs, heap_cap)));
+    emit_bail_if(jit, JIT_A, index);
+}
+
+// NOTE: Unless the node in `rax` is evaluated, with its tag in `rcx`.
+template <usize N, usize J>
+static void emit_whnf(Jit<N, J>* jit, u32 index) {
+    JitCode*    code = &jit->code;
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_I64);
+    const usize number = emit_jcc(code, JIT_E);
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_DATA);
+    const usize data = emit_jcc(code, JIT_E);
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_ARRAY);
+    emit_bail_if(jit, JIT_NE, index);
+    patch(code, number, code->len);
+    patch(code, data, code->len);
+}
+
+// NOTE: `rsi` at dump entry `rcx`.
+static void emit_frame(JitCode* code) {
+    emit_lea(code, JIT_RDX, {JIT_RCX, JIT_RCX, 1, 0});
+    emit_load(code, JIT_RSI, mem_regs(offsetof(EvalRegs, dump)));
+    emit_lea(code, JIT_RSI, {JIT_RSI, JIT_RDX, 3, 0});
+}
+
+template <usize N, usize J, usize G>
+static u32 get_index(const InstMemory<N, J, G>* inst_memory,
+                     const ListNode<Inst>*      node) {
+    return static_cast<u32>(node - inst_memory->insts.items);
+}
+
+template <usize N, usize J, usize G>
+static u32 queue(Jit<N, J>*                 jit,
+                 const InstMemory<N, J, G>* inst_memory,
+                 const ListNode<Inst>*      node) {
+    const u32 index = get_index(inst_memory, node);
+    if (jit->offsets[index] == JIT_NONE) {
+        jit->offsets[index] = JIT_QUEUED;
+        *alloc(&jit->work) = index;
+    }
+    return index;
+}
+
+// NOTE: Jumps to `node`'s native code, queueing it if there is none yet.
+template <usize N, usize J, usize G>
+static void emit_goto(Jit<N, J>*                 jit,
+                      const InstMemory<N, J, G>* inst_memory,
+                      usize                      at,
+                      const ListNode<Inst>*      node) {
+    const u32 index = queue(jit, inst_memory, node);
+    if (jit->offsets[index] < JIT_QUEUED) {
+        patch(&jit->code, at, jit->offsets[index]);
+        return;
+    }
+    *alloc(&jit->fixups) = {static_cast<u32>(at), index};
+}
+
+static void emit_compare(JitCode* code, JitCond cond) {
+    emit_alu(code, JIT_CMP, JIT_RAX, JIT_RCX);
+    emit_setcc(code, cond, JIT_RAX);
+    emit_zero_extend(code);
+}
+
+// NOTE: Both operands have to be evaluated integers. Native add, sub and imul
+// wrap like the interpreter; division by zero or by -1 (whose overflow the
+// interpreter wraps) goes through the interpreter.
+template <usize N, usize J>
+static void emit_binop(Jit<N, J>* jit, u32 index, InstTag tag) {
+    JitCode* code = &jit->code;
+    emit_need(jit, index, 2);
+    emit_heap(jit, index, 1);
+    emit_load(code, JIT_RAX, mem_top(0));
+    emit_follow(code, JIT_RAX);
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_I64);
+    emit_bail_if(jit, JIT_NE, index);
+    emit_load(code, JIT_RDX, mem_top(1));
+    emit_follow(code, JIT_RDX);
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_I64);
+    emit_bail_if(jit, JIT_NE, index);
+    emit_load(code, JIT_RAX, mem_of(JIT_RAX, 8));
+    emit_load(code, JIT_RCX, mem_of(JIT_RDX, 8));
+    switch (tag) {
+    case INST_ADD: {
+        emit_alu(code, JIT_ADD, JIT_RAX, JIT_RCX);
+        break;
+    }
+    case INST_SUB: {
+        emit_alu(code, JIT_SUB, JIT_RAX, JIT_RCX);
+        break;
+    }
+    case INST_MUL: {
+        emit_imul(code, JIT_RAX, JIT_RCX);
+        break;
+    }
+    case INST_DIV: {
+        emit_test(code, JIT_RCX, JIT_RCX);
+        emit_bail_if(jit, JIT_E, index);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, -1);
+        emit_bail_if(jit, JIT_E, index);
+        emit_idiv(code, JIT_RCX);
+        break;
+    }
+    case INST_EQ: {
+        emit_compare(code, JIT_E);
+        break;
+    }
+    case INST_NE: {
+        emit_compare(code, JIT_NE);
+        break;
+    }
+    case INST_LT: {
+        emit_compare(code, JIT_L);
+        break;
+    }
+    case INST_LE: {
+        emit_compare(code, JIT_LE);
+        break;
+    }
+    case INST_GT: {
+        emit_compare(code, JIT_G);
+        break;
+    }
+    case INST_GE: {
+        emit_compare(code, JIT_GE);
+        break;
+    }
+    case INST_OR: {
+        emit_alu(code, JIT_OR, JIT_RAX, JIT_RCX);
+        emit_setcc(code, JIT_NE, JIT_RAX);
+        emit_zero_extend(code);
+        break;
+    }
+    case INST_AND: {
+        emit_test(code, JIT_RAX, JIT_RAX);
+        emit_setcc(code, JIT_NE, JIT_RAX);
+        emit_test(code, JIT_RCX, JIT_RCX);
+        emit_setcc(code, JIT_NE, JIT_RCX);
+        emit_u8(code, 0x20);
+        emit_u8(code, 0xC8);
+        emit_zero_extend(code);
+        break;
+    }
+    case INST_UNWIND:
+    case INST_PUSH_GLOBAL:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_ALLOC:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_CALL:
+    case INST_TAIL_CALL:
+    case INST_PACK:
+    case INST_JUMP:
+    case INST_SPLIT:
+    case INST_COND:
+    case INST_PRIM: {
+        EXIT();
+    }
+    }
+    emit_lea(code, JIT_RDX, mem_of(JIT_RAX, -SHARED_I64_LOW));
+    emit_alu_imm(code, JIT_CMP, JIT_RDX, SHARED_I64_HIGH - SHARED_I64_LOW);
+    const usize fresh = emit_jcc(code, JIT_A);
+    emit_shl(code, JIT_RDX, 4);
+    emit_alu_mem(code,
+                 JIT_ADD,
+                 JIT_RDX,
+                 mem_regs(offsetof(EvalRegs, i64s)));
+    const usize shared = emit_jmp(code);
+    patch(code, fresh, code->len);
+    emit_alloc(code, JIT_RDX, 1);
+    emit_store_imm(code, mem_of(JIT_RDX, 0), NODE_I64);
+    emit_store(code, mem_of(JIT_RDX, 8), JIT_RAX);
+    patch(code, shared, code->len);
+    emit_dec(code, JIT_R13);
+    emit_store(code, mem_top(0), JIT_RDX);
+}
+
+// NOTE: Returning an evaluated node to a frame of the current segment; the
+// frame's code is found by its index, `(insts - base) / size`, which is exact
+// so the division is a multiplication by the inverse of the odd part.
+template <usize N, usize J, usize G>
+static void emit_unwind(Jit<N, J>*                 jit,
+                        const InstMemory<N, J, G>* inst_memory,
+                        u32                        index) {
+    JitCode* code = &jit->code;
+    u64      size = sizeof(ListNode<Inst>);
+    u8       shift = 0;
+    for (; (size & 1) == 0; size >>= 1) {
+        ++shift;
+    }
+    u64 inverse = size;
+    for (u32 i = 0; i < 5; ++i) {
+        inverse *= 2 - (size * inverse);
+    }
+    emit_need(jit, index, 1);
+    emit_load(code, JIT_RAX, mem_top(0));
+    emit_follow(code, JIT_RAX);
+    emit_store(code, mem_top(0), JIT_RAX);
+    emit_whnf(jit, index);
+    emit_load(code, JIT_RCX, mem_regs(offsetof(EvalRegs, dump_len)));
+    emit_test(code, JIT_RCX, JIT_RCX);
+    emit_bail_if(jit, JIT_E, index);
+    emit_alu_imm(code, JIT_CMP, JIT_RCX, 1);
+    const usize inner = emit_jcc(code, JIT_NE);
+    emit_cmp_mem_imm(code, mem_regs(offsetof(EvalRegs, linked)), 0);
+    emit_bail_if(jit, JIT_NE, index);
+    patch(code, inner, code->len);
+    emit_dec(code, JIT_RCX);
+    emit_frame(code);
+    emit_load(code, JIT_RDI, mem_frame(offsetof(InstFrame, insts)));
+    emit_mov_imm(code,
+                 JIT_R8,
+                 reinterpret_cast<u64>(inst_memory->insts.items));
+    emit_alu(code, JIT_SUB, JIT_RDI, JIT_R8);
+    emit_shr(code, JIT_RDI, shift);
+    emit_mov_imm(code, JIT_R8, inverse);
+    emit_imul(code, JIT_RDI, JIT_R8);
+    emit_alu_imm(code,
+                 JIT_CMP,
+                 JIT_RDI,
+                 static_cast<i32>(inst_memory->insts.len));
+    emit_bail_if(jit, JIT_AE, index);
+    emit_mov_imm(code, JIT_R8, reinterpret_cast<u64>(jit->entries));
+    emit_load(code, JIT_R9, {JIT_R8, JIT_RDI, 3, 0});
+    emit_test(code, JIT_R9, JIT_R9);
+    emit_bail_if(jit, JIT_E, index);
+    emit_store(code, mem_regs(offsetof(EvalRegs, dump_len)), JIT_RCX);
+    emit_load32(code, JIT_RDX, mem_frame(offsetof(InstFrame, global)));
+    emit_store32(code, mem_regs(offsetof(EvalRegs, producer)), JIT_RDX);
+    emit_load(code, JIT_R13, mem_frame(offsetof(InstFrame, base)));
+    emit_push_node(code, JIT_RAX);
+    emit_jmp_reg(code, JIT_R9);
+}
+
+// NOTE: Emits the code for one instruction and returns the instruction it
+// falls through to, if any.
+template <usize N, usize J, usize G>
+static const ListNode<Inst>* emit_inst(Jit<N, J>*                 jit,
+                                       const InstMemory<N, J, G>* inst_memory,
+                                       u32                        index) {
+    JitCode*              code = &jit->code;
+    const ListNode<Inst>* node = &inst_memory->insts.items[index];
+    const Inst*           inst = &node->value;
+    switch (inst->tag) {
+    case INST_UNWIND: {
+        emit_budget(jit, index);
+        emit_unwind(jit, inst_memory, index);
+        return null;
+    }
+    case INST_PUSH_GLOBAL: {
+        emit_budget(jit, index);
+        emit_room(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_regs(offsetof(EvalRegs, roots)));
+        emit_load(code,
+                  JIT_RAX,
+                  mem_of(JIT_RAX, static_cast<i32>(inst->body.as_global) * 8));
+        emit_push_node(code, JIT_RAX);
+        return node->next;
+    }
+    case INST_PUSH_INT: {
+        const i64 value = inst->body.as_i64;
+        emit_budget(jit, index);
+        emit_room(jit, index, 1);
+        if ((SHARED_I64_LOW <= value) && (value <= SHARED_I64_HIGH)) {
+            emit_load(code, JIT_RAX, mem_regs(offsetof(EvalRegs, i64s)));
+            emit_alu_imm(code,
+                         JIT_ADD,
+                         JIT_RAX,
+                         static_cast<i32>((value - SHARED_I64_LOW) * 16));
+        } else {
+            emit_heap(jit, index, 1);
+            emit_alloc(code, JIT_RAX, 1);
+            emit_store_imm(code, mem_of(JIT_RAX, 0), NODE_I64);
+            emit_mov_imm(code, JIT_RCX, static_cast<u64>(value));
+            emit_store(code, mem_of(JIT_RAX, 8), JIT_RCX);
+        }
+        emit_push_node(code, JIT_RAX);
+        return node->next;
+    }
+    case INST_PUSH_UNDEF: {
+        emit_budget(jit, index);
+        emit_room(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_regs(offsetof(EvalRegs, undef)));
+        emit_push_node(code, JIT_RAX);
+        return node->next;
+    }
+    case INST_PUSH: {
+        const usize offset = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_need(jit, index, offset + 1);
+        emit_room(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_top(offset));
+        emit_follow(code, JIT_RAX);
+        emit_store(code, mem_top(offset), JIT_RAX);
+        emit_push_node(code, JIT_RAX);
+        return node->next;
+    }
+    case INST_APP: {
+        emit_budget(jit, index);
+        emit_need(jit, index, 2);
+        emit_heap(jit, index, 1);
+        emit_load(code, JIT_RCX, mem_top(0));
+        emit_load(code, JIT_RDX, mem_top(1));
+        emit_alloc(code, JIT_RAX, 1);
+        emit_alu_imm(code, JIT_OR, JIT_RCX, NODE_APP);
+        emit_store(code, mem_of(JIT_RAX, 0), JIT_RCX);
+        emit_store(code, mem_of(JIT_RAX, 8), JIT_RDX);
+        emit_dec(code, JIT_R13);
+        emit_store(code, mem_top(0), JIT_RAX);
+        return node->next;
+    }
+    case INST_UPDATE: {
+        const usize offset = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_need(jit, index, offset + 2);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_follow(code, JIT_RAX);
+        emit_dec(code, JIT_R13);
+        emit_lea(code, JIT_RDX, mem_top(offset));
+        emit_load(code, JIT_RSI, mem_of(JIT_RDX, 0));
+        emit_alu_mem(code,
+                     JIT_CMP,
+                     JIT_RSI,
+                     mem_regs(offsetof(EvalRegs, undef)));
+        const usize hole = emit_jcc(code, JIT_NE);
+        emit_store(code, mem_of(JIT_RDX, 0), JIT_RAX);
+        const usize filled = emit_jmp(code);
+        patch(code, hole, code->len);
+        emit_alu(code, JIT_CMP, JIT_RSI, JIT_RAX);
+        const usize same = emit_jcc(code, JIT_E);
+        emit_load(code, JIT_RDI, mem_of(JIT_RAX, 0));
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_I64);
+        const usize number = emit_jcc(code, JIT_E);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_DATA);
+        const usize indir = emit_jcc(code, JIT_NE);
+        emit_mov(code, JIT_RCX, JIT_RDI);
+        emit_shr(code, JIT_RCX, NODE_ARITY);
+        emit_alu_imm(code, JIT_AND, JIT_RCX, 0xFF);
+        const usize fields = emit_jcc(code, JIT_NE);
+        patch(code, number, code->len);
+        emit_store(code, mem_of(JIT_RSI, 0), JIT_RDI);
+        emit_load(code, JIT_RDI, mem_of(JIT_RAX, 8));
+        emit_store(code, mem_of(JIT_RSI, 8), JIT_RDI);
+        const usize copied = emit_jmp(code);
+        patch(code, indir, code->len);
+        patch(code, fields, code->len);
+        emit_store_imm(code, mem_of(JIT_RSI, 0), NODE_INDIR);
+        emit_store(code, mem_of(JIT_RSI, 8), JIT_RAX);
+        patch(code, filled, code->len);
+        patch(code, same, code->len);
+        patch(code, copied, code->len);
+        return node->next;
+    }
+    case INST_POP: {
+        const usize n = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_need(jit, index, n);
+        emit_alu_imm(code, JIT_SUB, JIT_R13, static_cast<i32>(n));
+        return node->next;
+    }
+    case INST_ALLOC: {
+        const usize n = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_room(jit, index, static_cast<i64>(n));
+        emit_heap(jit, index, n);
+        for (usize i = 0; i < n; ++i) {
+            emit_alloc(code, JIT_RAX, 1);
+            emit_store_imm(code, mem_of(JIT_RAX, 0), NODE_UNDEF);
+            emit_push_node(code, JIT_RAX);
+        }
+        return node->next;
+    }
+    case INST_SLIDE: {
+        const usize n = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_need(jit, index, n + 1);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_alu_imm(code, JIT_SUB, JIT_R13, static_cast<i32>(n));
+        emit_store(code, mem_top(0), JIT_RAX);
+        return node->next;
+    }
+    case INST_EVAL: {
+        emit_budget(jit, index);
+        emit_need(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_follow(code, JIT_RAX);
+        emit_store(code, mem_top(0), JIT_RAX);
+        emit_whnf(jit, index);
+        return node->next;
+    }
+    case INST_CALL: {
+        const u32       global = inst->body.as_call.global;
+        const InstCode* callee = &inst_memory->codes.items[global];
+        const usize     len = static_cast<usize>(callee->arity) + 1;
+        if ((!callee->insts) || (!node->next) || (callee->depth < len)) {
+            break;
+        }
+        emit_budget(jit, index);
+        emit_need(jit, index, len);
+        emit_room(jit, index, static_cast<i64>(callee->depth - len));
+        emit_load(code, JIT_RCX, mem_regs(offsetof(EvalRegs, dump_len)));
+        emit_alu_mem(code,
+                     JIT_CMP,
+                     JIT_RCX,
+                     mem_regs(offsetof(EvalRegs, dump_cap)));
+        emit_bail_if(jit, JIT_AE, index);
+        emit_frame(code);
+        emit_mov_imm(code, JIT_RAX, reinterpret_cast<u64>(node->next));
+        emit_store(code, mem_frame(offsetof(InstFrame, insts)), JIT_RAX);
+        emit_lea(code,
+                 JIT_RAX,
+                 {JIT_R13, JIT_RSP, 0, -static_cast<i32>(len)});
+        emit_store(code, mem_frame(offsetof(InstFrame, base)), JIT_RAX);
+        emit_load32(code, JIT_RAX, mem_regs(offsetof(EvalRegs, producer)));
+        emit_store32(code,
+                     mem_frame(offsetof(InstFrame, global)),
+                     JIT_RAX);
+        emit_inc(code, JIT_RCX);
+        emit_store(code, mem_regs(offsetof(EvalRegs, dump_len)), JIT_RCX);
+        emit_store32_imm(code,
+                         mem_regs(offsetof(EvalRegs, producer)),
+                         global);
+        emit_goto(jit, inst_memory, emit_jmp(code), callee->insts);
+        queue(jit, inst_memory, node->next);
+        return null;
+    }
+    case INST_TAIL_CALL: {
+        const u32       global = inst->body.as_call.global;
+        const InstCode* callee = &inst_memory->codes.items[global];
+        const usize     arity = callee->arity;
+        const usize     depth = inst->body.as_call.depth;
+        if ((!callee->insts) || (callee->depth < (arity + 1))) {
+            break;
+        }
+        emit_budget(jit, index);
+        emit_need(jit, index, depth + arity);
+        emit_room(jit,
+                  index,
+                  static_cast<i64>(callee->depth - (arity + 1)) -
+                      static_cast<i64>(depth));
+        if (depth != 0) {
+            for (usize i = 0; i < arity; ++i) {
+                emit_load(code, JIT_RAX, mem_top(arity - 1 - i));
+                emit_store(code, mem_top((arity - 1 - i) + depth), JIT_RAX);
+            }
+            emit_alu_imm(code, JIT_SUB, JIT_R13, static_cast<i32>(depth));
+        }
+        emit_store32_imm(code,
+                         mem_regs(offsetof(EvalRegs, producer)),
+                         global);
+        emit_goto(jit, inst_memory, emit_jmp(code), callee->insts);
+        return null;
+    }
+    case INST_PACK: {
+        const InstPack pack = inst->body.as_pack;
+        const i32      header =
+            static_cast<i32>(NODE_DATA | (pack.tag << NODE_PACK_TAG) |
+                             (pack.arity << NODE_ARITY));
+        emit_budget(jit, index);
+        if (pack.arity == 0) {
+            emit_room(jit, index, 1);
+            emit_load(code, JIT_RAX, mem_regs(offsetof(EvalRegs, packs)));
+            emit_alu_imm(code, JIT_ADD, JIT_RAX, pack.tag * 16);
+            emit_load32(code, JIT_RCX, mem_of(JIT_RAX, 0));
+            emit_alu_imm(code,
+                         JIT_AND,
+                         JIT_RCX,
+                         static_cast<i32>(NODE_TAG_MASK));
+            emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_DATA);
+            const usize shared = emit_jcc(code, JIT_E);
+            emit_heap(jit, index, 1);
+            emit_alloc(code, JIT_RAX, 1);
+            emit_store_imm(code, mem_of(JIT_RAX, 0), header);
+            patch(code, shared, code->len);
+            emit_push_node(code, JIT_RAX);
+            return node->next;
+        }
+        emit_need(jit, index, pack.arity);
+        emit_heap(jit, index, NODE_CELLS(pack.arity));
+        emit_alloc(code, JIT_RAX, NODE_CELLS(pack.arity));
+        emit_store_imm(code, mem_of(JIT_RAX, 0), header);
+        for (u8 i = 0; i < pack.arity; ++i) {
+            emit_load(code, JIT_RCX, mem_top(i));
+            emit_store(code, mem_of(JIT_RAX, 8 + (i * 8)), JIT_RCX);
+        }
+        emit_alu_imm(code, JIT_SUB, JIT_R13, pack.arity);
+        emit_push_node(code, JIT_RAX);
+        return node->next;
+    }
+    case INST_JUMP: {
+        const InstJump* jump = &inst->body.as_jump;
+        emit_budget(jit, index);
+        emit_need(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_follow(code, JIT_RAX);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_DATA);
+        emit_bail_if(jit, JIT_NE, index);
+        emit_load32(code, JIT_RCX, mem_of(JIT_RAX, 0));
+        emit_shr(code, JIT_RCX, NODE_PACK_TAG);
+        emit_alu_imm(code, JIT_AND, JIT_RCX, 0xFF);
+        for (u16 i = 0; i < jump->len; ++i) {
+            const u32 tag =
+                jump->tags ? jump->tags[i] : static_cast<u32>(jump->low + i);
+            if ((!jump->insts[i]) || (0xFF < tag)) {
+                continue;
+            }
+            emit_alu_imm(code, JIT_CMP, JIT_RCX, static_cast<i32>(tag));
+            emit_goto(jit, inst_memory, emit_jcc(code, JIT_E), jump->insts[i]);
+        }
+        patch(code, emit_jmp(code), get_stub(jit, index));
+        return null;
+    }
+    case INST_SPLIT: {
+        const usize n = static_cast<usize>(inst->body.as_i64);
+        emit_budget(jit, index);
+        emit_need(jit, index, 1);
+        emit_room(jit, index, static_cast<i64>(n) - 1);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_follow(code, JIT_RAX);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_DATA);
+        emit_bail_if(jit, JIT_NE, index);
+        emit_load(code, JIT_RCX, mem_of(JIT_RAX, 0));
+        emit_shr(code, JIT_RCX, NODE_ARITY);
+        emit_alu_imm(code, JIT_AND, JIT_RCX, 0xFF);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, static_cast<i32>(n));
+        emit_bail_if(jit, JIT_NE, index);
+        emit_dec(code, JIT_R13);
+        for (usize i = n; i != 0; --i) {
+            emit_load(code, JIT_RCX, mem_of(JIT_RAX, static_cast<i32>(i * 8)));
+            emit_push_node(code, JIT_RCX);
+        }
+        return node->next;
+    }
+    case INST_COND: {
+        emit_budget(jit, index);
+        emit_need(jit, index, 1);
+        emit_load(code, JIT_RAX, mem_top(0));
+        emit_follow(code, JIT_RAX);
+        emit_alu_imm(code, JIT_CMP, JIT_RCX, NODE_I64);
+        emit_bail_if(jit, JIT_NE, index);
+        emit_dec(code, JIT_R13);
+        emit_cmp_mem_imm(code, mem_of(JIT_RAX, 8), 0);
+        emit_goto(jit,
+                  inst_memory,
+                  emit_jcc(code, JIT_NE),
+                  inst->body.as_cond.insts[0]);
+        return inst->body.as_cond.insts[1];
+    }
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_EQ:
+    case INST_NE:
+    case INST_LT:
+    case INST_LE:
+    case INST_GT:
+    case INST_GE:
+    case INST_OR:
+    case INST_AND: {
+        emit_budget(jit, index);
+        emit_binop(jit, index, inst->tag);
+        return node->next;
+    }
+    case INST_PRIM: {
+        break;
+    }
+    }
+    patch(code, emit_jmp(code), get_bail(jit, index));
+    if (node->next) {
+        queue(jit, inst_memory, node->next);
+    }
+    return null;
+}
+
+// NOTE: Lays out the instructions from `index` in a straight line as far as
+// they fall through.
+template <usize N, usize J, usize G>
+static void emit_chain(Jit<N, J>*                 jit,
+                       const InstMemory<N, J, G>* inst_memory,
+                       u32                        index) {
+    for (;;) {
+        if (jit->offsets[index] < JIT_QUEUED) {
+            patch(&jit->code, emit_jmp(&jit->code), jit->offsets[index]);
+            return;
+        }
+        jit->offsets[index] = static_cast<u32>(jit->code.len);
+        const ListNode<Inst>* next = emit_inst(jit, inst_memory, index);
+        if (!next) {
+            return;
+        }
+        index = get_index(inst_memory, next);
+    }
+}
+
+// NOTE: Enough room for any one instruction's code.
+static usize get_bound(const Inst* inst) {
+    switch (inst->tag) {
+    case INST_ALLOC:
+    case INST_SPLIT: {
+        return 256 + (static_cast<usize>(inst->body.as_i64) * 32);
+    }
+    case INST_PACK: {
+        return 256 + (static_cast<usize>(inst->body.as_pack.arity) * 32);
+    }
+    case INST_JUMP: {
+        return 256 + (static_cast<usize>(inst->body.as_jump.len) * 16);
+    }
+    case INST_TAIL_CALL: {
+        return 256 + (static_cast<usize>(1 << 8) * 32);
+    }
+    case INST_UNWIND:
+    case INST_PUSH_GLOBAL:
+    case INST_PUSH_INT:
+    case INST_PUSH_UNDEF:
+    case INST_PUSH:
+    case INST_APP:
+    case INST_UPDATE:
+    case INST_POP:
+    case INST_SLIDE:
+    case INST_EVAL:
+    case INST_CALL:
+    case INST_COND:
+    case INST_ADD:
+    case INST_SUB:
+    case INST_MUL:
+    case INST_DIV:
+    case INST_EQ:
+    case INST_NE:
+    case INST_LT:
+    case INST_LE:
+    case INST_GT:
+    case INST_GE:
+    case INST_OR:
+    case INST_AND:
+    case INST_PRIM: {
+        return 256;
+    }
+    }
+    EXIT();
+}
+
+// NOTE: `run(regs, entry)` keeps the callee-saved registers it uses, loads
+// the `EvalRegs` into the rest and jumps to `entry`; every way out goes
+// through the exit, which stores them back along with the next instruction
+// from `rax`.
+template <usize N, usize J>
+static void emit_entry(Jit<N, J>* jit) {
+    JitCode*     code = &jit->code;
+    const JitReg saved[] =
+        {JIT_RBX, JIT_RBP, JIT_R12, JIT_R13, JIT_R14, JIT_R15};
+    for (u32 i = 0; i < 6; ++i) {
+        emit_push(code, saved[i]);
+    }
+    emit_mov(code, JIT_RBX, JIT_RDI);
+    emit_load(code, JIT_R12, mem_regs(offsetof(EvalRegs, stack)));
+    emit_load(code, JIT_R13, mem_regs(offsetof(EvalRegs, stack_len)));
+    emit_load(code, JIT_R14, mem_regs(offsetof(EvalRegs, budget)));
+    emit_load(code, JIT_R15, mem_regs(offsetof(EvalRegs, heap)));
+    emit_load(code, JIT_RBP, mem_regs(offsetof(EvalRegs, heap_len)));
+    emit_jmp_reg(code, JIT_RSI);
+    jit->exit = code->len;
+    emit_store(code, mem_regs(offsetof(EvalRegs, next)), JIT_RAX);
+    emit_store(code, mem_regs(offsetof(EvalRegs, stack_len)), JIT_R13);
+    emit_store(code, mem_regs(offsetof(EvalRegs, budget)), JIT_R14);
+    emit_store(code, mem_regs(offsetof(EvalRegs, heap_len)), JIT_RBP);
+    for (u32 i = 6; i != 0; --i) {
+        emit_pop(code, saved[i - 1]);
+    }
+    emit_u8(code, 0xC3);
+}
+
+// NOTE: Compiles every code in `inst_memory`; the result is only good for as
+// long as the instructions stay as they are, and for contexts running them.
+template <usize N, usize J, usize G>
+static void set_jit(Jit<N, J>* jit, const InstMemory<N, J, G>* inst_memory) {
+    const usize len = inst_memory->insts.len;
+    usize       size = 256;
+    for (usize i = 0; i < len; ++i) {
+        size += JIT_STUB + get_bound(&inst_memory->insts.items[i].value);
+    }
+    void* region = mmap(null,
+                        size,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0);
+    EXIT_IF(region == MAP_FAILED);
+    JitCode* code = &jit->code;
+    *code = {static_cast<u8*>(region), 0, size};
+    jit->work.len = 0;
+    jit->fixups.len = 0;
+    emit_entry(jit);
+    jit->stubs = code->len;
+    for (usize i = 0; i < len; ++i) {
+        jit->offsets[i] = JIT_NONE;
+        emit_inc(code, JIT_R14);
+        emit_mov_imm(code,
+                     JIT_RAX,
+                     reinterpret_cast<u64>(&inst_memory->insts.items[i]));
+        patch(code, emit_jmp(code), jit->exit);
+        EXIT_IF(code->len != (jit->stubs + ((i + 1) * JIT_STUB)));
+    }
+    for (usize i = 0; i < inst_memory->codes.len; ++i) {
+        if (inst_memory->codes.items[i].insts) {
+            queue(jit, inst_memory, inst_memory->codes.items[i].insts);
+        }
+    }
+    while (jit->work.len != 0) {
+        emit_chain(jit, inst_memory, jit->work.items[--jit->work.len]);
+    }
+    for (usize i = 0; i < jit->fixups.len; ++i) {
+        const JitFixup fixup = jit->fixups.items[i];
+        patch(code, fixup.at, jit->offsets[fixup.inst]);
+    }
+    EXIT_IF(mprotect(region, size, PROT_READ | PROT_EXEC) != 0);
+    for (usize i = 0; i < len; ++i) {
+        jit->entries[i] = jit->offsets[i] < JIT_QUEUED
+                              ? &code->bytes[jit->offsets[i]]
+                              : null;
+    }
+    jit->native = {inst_memory->insts.items,
+                   jit->entries,
+                   len,
+                   reinterpret_cast<void (*)(EvalRegs*, const void*)>(region)};
+}
+
+template <usize N, usize J>
+static void free_jit(Jit<N, J>* jit) {
+    EXIT_IF(munmap(jit->code.bytes, jit->code.cap) != 0);
+    jit->code = {};
+}
+
+// NOTE: Every program runs interpreted, then with native code, and has to
+// come to the same value in the same number of instructions; with native code
+// it also has to stop on the dot for small amounts of fuel and for the
+// deadline.
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize D>
+static void test_jit(Tokens<T>*                  tokens,
+                     ParseMemory<S, B, U, E, F>* parse_memory,
+                     InstMemory<I, J, G>*        inst_memory,
+                     EvalMemory<N, K, D, G>*     eval_memory,
+                     Jit<I, J>*                  jit) {
+    const String sources[] = {
+        GET_STRING("fib n { if (n < 2) n (fib (n - 1) + fib (n - 2)) }\n"
+                   "main { fib 15 }"),
+        GET_STRING("main {\n"
+                   "  (100 / 7) + ((0 - 9) / 2) + (3 < 4) + (4 <= 4) +\n"
+                   "  (5 > 6) + (6 >= 6) + (2 > 1) + (2 == 2) +\n"
+                   "  ((0 | 3) & 2) + (0 & 1) + (100000 * 3) - 300000\n"
+                   "}"),
+        GET_STRING("min { (2147483648 * 2147483648) * 2 }\n"
+                   "main { (min / (0 - 1)) + ((min - 1) > 0) + (min + min) }"),
+        GET_STRING("nil { pack 1 0 }\n"
+                   "cons x xs { pack 2 2 x xs }\n"
+                   "take n xs {\n"
+                   "  if (n == 0) nil (unpack xs {\n"
+                   "    1 = nil;\n"
+                   "    2 y ys = cons y (take (n - 1) ys)\n"
+                   "  })\n"
+                   "}\n"
+                   "sum xs {\n"
+                   "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                   "}\n"
+                   "main { letrec { xs = cons 2 xs } "
+                   "sum (take 40 xs) }"),
+        GET_STRING("pair x { pack 3 2 x 1 }\n"
+                   "go n acc {\n"
+                   "  if (n == 0) acc (unpack pair 1000 {\n"
+                   "    3 x y = if (acc < 0) 0 (go (n - y) (acc + x))\n"
+                   "  })\n"
+                   "}\n"
+                   "main { go 1000 0 }"),
+        GET_STRING("g x {\n"
+                   "  1 + (let { k = x * 3 }\n"
+                   "    if (x < 2) k (unpack pack 5 2 x x {\n"
+                   "      5 a b = let { c = a } k\n"
+                   "    }))\n"
+                   "}\n"
+                   "h n {\n"
+                   "  letrec {\n"
+                   "    xs = pack 2 2 n xs;\n"
+                   "    k = unpack xs {\n"
+                   "      2 y ys =\n"
+                   "        unpack ys { 2 z zs = y + z }\n"
+                   "    }\n"
+                   "  } if (n == 0) 0 k\n"
+                   "}\n"
+                   "main { g 1 + g 4 + h 2 + h 0 }"),
+        GET_STRING("add x y { x + y }\n"
+                   "twice f x { f (f x) }\n"
+                   "main {\n"
+                   "  let { a = array_range 0 10 }\n"
+                   "  twice (add 1) (array_sum (array_mul a (array_fill 10 "
+                   "3)))\n"
+                   "}"),
+    };
+    const i64 values[] = {610, 16, INT64_MIN + 1, 80, 1000000, 21, 137};
+    STATIC_ASSERT((sizeof(sources) / sizeof(sources[0])) ==
+                  (sizeof(values) / sizeof(values[0])));
+    for (usize i = 0; i < (sizeof(sources) / sizeof(sources[0])); ++i) {
+        set_tokens(sources[i], tokens);
+        parse_program(tokens, parse_memory);
+        compile_program(inst_memory, &parse_memory->funcs);
+        set_jit(jit, inst_memory);
+        const u32 global = get_global(inst_memory, GET_STRING("main"));
+        u64       steps[2];
+        for (usize j = 0; j < 2; ++j) {
+            eval_memory->native = j == 0 ? null : &jit->native;
+            set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+            start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+            u64 fuel = UINT64_MAX;
+            EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 0) !=
+                    EVAL_DONE);
+            EXIT_IF(pop_i64(eval_memory)->body.as_i64 != values[i]);
+            steps[j] = UINT64_MAX - fuel;
+        }
+        EXIT_IF(steps[0] != steps[1]);
+        {
+            set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+            start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+            u64 fuel = UINT64_MAX;
+            u32 slice = EVAL_SLICE;
+            const ListNode<Inst>* code =
+                run_native(eval_memory, eval_memory->code, &fuel, &slice);
+            EXIT_IF(code == eval_memory->code);
+            EXIT_IF((UINT64_MAX - fuel) != (EVAL_SLICE - slice));
+            eval_memory->code = code;
+            EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 0) !=
+                    EVAL_DONE);
+            EXIT_IF(pop_i64(eval_memory)->body.as_i64 != values[i]);
+            EXIT_IF((UINT64_MAX - fuel) != steps[0]);
+        }
+        {
+            set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+            start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+            u64 spent = 0;
+            for (;;) {
+                u64 fuel = 7;
+                const EvalStatus status =
+                    resume_eval(eval_memory, inst_memory, &fuel, 0);
+                spent += 7 - fuel;
+                if (status == EVAL_DONE) {
+                    break;
+                }
+                EXIT_IF(fuel != 0);
+            }
+            EXIT_IF(pop_i64(eval_memory)->body.as_i64 != values[i]);
+            EXIT_IF(spent != steps[0]);
+        }
+        {
+            set_globals(eval_memory, inst_memory, &parse_memory->funcs);
+            start_eval(eval_memory, inst_memory, eval_memory->roots[global]);
+            u64 fuel = UINT64_MAX;
+            if (steps[0] <= EVAL_SLICE) {
+                EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 1) !=
+                        EVAL_DONE);
+            } else {
+                EXIT_IF(resume_eval(eval_memory, inst_memory, &fuel, 1) !=
+                        EVAL_DEADLINE);
+                EXIT_IF(fuel != (UINT64_MAX - EVAL_SLICE));
+            }
+        }
+        eval_memory->native = null;
+        free_jit(jit);
+        fprintf(stderr, ".");
+    }
+}
+
+#endif
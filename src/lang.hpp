@@ -1,7 +1,7 @@
 #ifndef __LANG_H__
 #define __LANG_H__
 
-#include "list.hpp"
+#include "buffer.hpp"
 #include "string.hpp"
 
 typedef struct Expr Expr;
@@ -44,19 +44,24 @@ struct ExprBinding {
 };
 
 struct ExprLet {
-    List<ExprBinding> bindings;
+    Span<ExprBinding> bindings;
     const Expr*       expr;
 };
 
 struct ExprBranch {
-    List<String> args;
+    Span<String> args;
     const Expr*  expr;
     u8           tag;
 };
 
 struct ExprUnpack {
     const Expr*      expr;
-    List<ExprBranch> branches;
+    Span<ExprBranch> branches;
+};
+
+struct ExprBinOp {
+    const Expr* args[2];
+    BinOp       op;
 };
 
 union ExprBody {
@@ -66,7 +71,7 @@ union ExprBody {
     const Expr* as_app[2];
     ExprLet     as_let;
     ExprUnpack  as_unpack;
-    BinOp       as_binop;
+    ExprBinOp   as_binop;
 };
 
 struct Expr {
@@ -85,10 +90,108 @@ union FuncName {
 };
 
 struct Func {
-    List<String> args;
+    Span<String> args;
     const Expr*  expr;
     FuncName     name;
     FuncTag      tag;
 };
 
+#define CAP_SPINE (1 << 4)
+#define CAP_SPAN  (1 << 8)
+
+struct Spine {
+    const Expr* head;
+    const Expr* args[CAP_SPINE];
+    usize       len;
+};
+
+static Spine get_spine(const Expr* expr) {
+    Spine spine = {};
+    for (const Expr* app = expr; app->tag == EXPR_APP;
+         app = app->body.as_app[0])
+    {
+        ++spine.len;
+    }
+    EXIT_IF(CAP_SPINE < spine.len);
+    for (usize i = spine.len; expr->tag == EXPR_APP;
+         expr = expr->body.as_app[0])
+    {
+        spine.args[--i] = expr->body.as_app[1];
+    }
+    spine.head = expr;
+    return spine;
+}
+
+static bool is_var(const Expr* expr, String name) {
+    return (expr->tag == EXPR_VAR) && (expr->body.as_var == name);
+}
+
+static bool is_free(const Expr* expr, String name) {
+    switch (expr->tag) {
+    case EXPR_VAR: {
+        return expr->body.as_var == name;
+    }
+    case EXPR_APP: {
+        return is_free(expr->body.as_app[0], name) ||
+               is_free(expr->body.as_app[1], name);
+    }
+    case EXPR_BINOP: {
+        return is_free(expr->body.as_binop.args[0], name) ||
+               is_free(expr->body.as_binop.args[1], name);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        bool                     bound = false;
+        for (usize i = 0; i < bindings->len; ++i) {
+            bound = bound || (bindings->items[i].name == name);
+        }
+        if (bound && (expr->tag == EXPR_LETREC)) {
+            return false;
+        }
+        for (usize i = 0; i < bindings->len; ++i) {
+            if (is_free(bindings->items[i].expr, name)) {
+                return true;
+            }
+        }
+        return (!bound) && is_free(expr->body.as_let.expr, name);
+    }
+    case EXPR_UNPACK: {
+        if (is_free(expr->body.as_unpack.expr, name)) {
+            return true;
+        }
+        const Span<ExprBranch>* branches = &expr->body.as_unpack.branches;
+        for (usize i = 0; i < branches->len; ++i) {
+            const ExprBranch* branch = &branches->items[i];
+            if ((!contains(&branch->args, name)) &&
+                is_free(branch->expr, name))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32: {
+        return false;
+    }
+    }
+    EXIT();
+}
+
+struct Scope {
+    String       name;
+    const Scope* next;
+};
+
+static bool is_bound(const Scope* scope, String name) {
+    for (; scope; scope = scope->next) {
+        if (scope->name == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
 #endif
@@ -35,6 +35,16 @@ static void concat(List<T>* a, List<T>* b) {
     a->last = b->last;
 }
 
+template <typename T>
+static bool contains(const List<T>* list, T value) {
+    for (const ListNode<T>* node = list->first; node; node = node->next) {
+        if (node->value == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
 template <typename T>
 static void println(File* stream, List<T>* list) {
     fprintf(stream, "[");
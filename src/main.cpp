@@ -1,19 +1,167 @@
-#include "inst.hpp"
+#include "aot.hpp"
+#include "embed.hpp"
+#include "eval.hpp"
+#include "fuse.hpp"
+#include "jit.hpp"
 #include "parse.hpp"
+#include "repl.hpp"
+#include "serve.hpp"
+#include "simplify.hpp"
 
 #define CAP_LIST_STRINGS (1 << 5)
-#define CAP_TOKENS       (1 << 5)
-#define CAP_STRINGS      (1 << 5)
+#define CAP_TOKENS       (1 << 7)
+#define CAP_STRINGS      (1 << 6)
 #define CAP_BINDINGS     (1 << 5)
 #define CAP_UNPACKS      (1 << 5)
-#define CAP_EXPRS        (1 << 5)
+#define CAP_EXPRS        (1 << 8)
 #define CAP_FUNCS        (1 << 5)
+#define CAP_NODES        (1 << 5)
+#define CAP_CHARS        (1 << 10)
+#define CAP_DEFS         (1 << 4)
+#define CAP_RENAMES      (1 << 6)
+#define CAP_FUSIONS      (1 << 4)
+#define CAP_INSTS        (1 << 10)
+#define CAP_JUMPS        (1 << 8)
+#define CAP_HEAP         (1 << 10)
+#define CAP_STACK        (1 << 8)
+#define CAP_FRAMES       (1 << 6)
+#define CAP_CODES        (1 << 6)
+#define CAP_VALUES       (1 << 11)
+
+#ifndef SERVE_WORKERS
+    #define SERVE_WORKERS 4
+#endif
+
+STATIC_ASSERT(0 < SERVE_WORKERS);
+
+#ifndef PROFILE_INTERVAL
+    #define PROFILE_INTERVAL 10000000
+#endif
+
+#define SERVE_TOKENS   (1 << 14)
+#define SERVE_STRINGS  (1 << 12)
+#define SERVE_BINDINGS (1 << 12)
+#define SERVE_UNPACKS  (1 << 10)
+#define SERVE_EXPRS    (1 << 14)
+#define SERVE_FUNCS    (1 << 8)
+#define SERVE_INSTS    (1 << 14)
+#define SERVE_JUMPS    (1 << 12)
+#define SERVE_CODES    (1 << 8)
+#define SERVE_HEAP     (1 << 16)
+#define SERVE_STACK    (1 << 12)
+#define SERVE_FRAMES   (1 << 10)
+#define SERVE_VALUES   (1 << 16)
+#define SERVE_CHARS    (1 << 20)
+#define SERVE_NAMES    (1 << 14)
+#define SERVE_RENAMES  (1 << 10)
+#define SERVE_FUSIONS  (1 << 8)
+
+#define REPL_DEFS  (1 << 8)
+#define REPL_FUNCS (1 << 12)
+#define REPL_INSTS (1 << 16)
+#define REPL_JUMPS (1 << 14)
+#define REPL_CODES (1 << 12)
 
 struct Memory {
     Buffer<ListNode<String>, CAP_LIST_STRINGS> list_strings;
-    Buffer<Token, CAP_TOKENS>                  tokens;
+    Tokens<CAP_TOKENS>                         tokens;
     ParseMemory<CAP_STRINGS, CAP_BINDINGS, CAP_UNPACKS, CAP_EXPRS, CAP_FUNCS>
         parse_memory;
+    Buffer<Node, CAP_NODES> nodes[2];
+    NodeShared              shared;
+    Repl<CAP_CHARS,
+         CAP_TOKENS,
+         CAP_DEFS,
+         CAP_STRINGS,
+         CAP_BINDINGS,
+         CAP_UNPACKS,
+         CAP_EXPRS,
+         CAP_FUNCS,
+         CAP_INSTS,
+         CAP_JUMPS,
+         CAP_CODES,
+         CAP_HEAP,
+         CAP_STACK,
+         CAP_FRAMES,
+         CAP_VALUES>
+        repl;
+    FuseMemory<CAP_CHARS, CAP_RENAMES, CAP_FUSIONS>        fuse_memory;
+    InstMemory<CAP_INSTS, CAP_JUMPS, CAP_CODES>            inst_memory;
+    EvalMemory<CAP_HEAP, CAP_STACK, CAP_FRAMES, CAP_CODES> eval_memory;
+    Jit<CAP_INSTS, CAP_JUMPS>                              jit;
+    AotLayout<CAP_INSTS>                                   layout;
+    HeapProfile<CAP_HEAP, CAP_CODES>                       profile;
+    Program<CAP_INSTS, CAP_JUMPS, CAP_CODES>               program;
+    EvalMemory<CAP_HEAP, CAP_STACK, CAP_FRAMES, CAP_CODES> contexts[2];
+    Buffer<Value, CAP_VALUES>                              values;
+    Server<CAP_TOKENS,
+           CAP_INSTS,
+           CAP_JUMPS,
+           CAP_CODES,
+           CAP_HEAP,
+           CAP_STACK,
+           CAP_FRAMES,
+           CAP_VALUES,
+           CAP_CHARS,
+           2>
+        server;
+};
+
+struct ServeMemory {
+    Tokens<SERVE_TOKENS> tokens;
+    ParseMemory<SERVE_STRINGS,
+                SERVE_BINDINGS,
+                SERVE_UNPACKS,
+                SERVE_EXPRS,
+                SERVE_FUNCS>
+        parse_memory;
+    FuseMemory<SERVE_NAMES, SERVE_RENAMES, SERVE_FUSIONS> fuse_memory;
+    Program<SERVE_INSTS, SERVE_JUMPS, SERVE_CODES>        program;
+    Server<SERVE_TOKENS,
+           SERVE_INSTS,
+           SERVE_JUMPS,
+           SERVE_CODES,
+           SERVE_HEAP,
+           SERVE_STACK,
+           SERVE_FRAMES,
+           SERVE_VALUES,
+           SERVE_CHARS,
+           SERVE_WORKERS>
+        server;
+    Jit<SERVE_INSTS, SERVE_JUMPS> jit;
+};
+
+typedef Repl<SERVE_CHARS,
+             SERVE_TOKENS,
+             REPL_DEFS,
+             SERVE_STRINGS,
+             SERVE_BINDINGS,
+             SERVE_UNPACKS,
+             SERVE_EXPRS,
+             REPL_FUNCS,
+             REPL_INSTS,
+             REPL_JUMPS,
+             REPL_CODES,
+             SERVE_HEAP,
+             SERVE_STACK,
+             SERVE_FRAMES,
+             SERVE_VALUES>
+    ReplSession;
+
+struct ProfileMemory {
+    Tokens<SERVE_TOKENS> tokens;
+    ParseMemory<SERVE_STRINGS,
+                SERVE_BINDINGS,
+                SERVE_UNPACKS,
+                SERVE_EXPRS,
+                SERVE_FUNCS>
+        parse_memory;
+    FuseMemory<SERVE_NAMES, SERVE_RENAMES, SERVE_FUSIONS>          fuse_memory;
+    Program<SERVE_INSTS, SERVE_JUMPS, SERVE_CODES>                 program;
+    EvalMemory<SERVE_HEAP, SERVE_STACK, SERVE_FRAMES, SERVE_CODES> context;
+    HeapProfile<SERVE_HEAP, SERVE_CODES>                           profile;
+    Buffer<Value, SERVE_VALUES>                                    values;
+    Buffer<char, SERVE_CHARS>                                      chars;
 };
 
 template <usize N>
@@ -32,12 +180,228 @@ static void demo_list(Buffer<ListNode<String>, N>* list_strings) {
     println(stdout, &a);
 }
 
-i32 main() {
+// NOTE: Options may appear anywhere after the command. `--share` turns on
+// hash-consing of immutable nodes and reports what it saved at the end,
+// `--fusions` lists the calls that fusion rewrote before compiling,
+// `--jit` has `serve` run the program as native code where it can, and
+// `--input <file>` maps the file into every context for `input_from` to
+// read. An emitted binary takes that file as its only argument instead.
+struct Options {
+    const char* args[2];
+    const char* input;
+    usize       len;
+    bool        share;
+    bool        fusions;
+    bool        jit;
+};
+
+static Options get_options(i32 argc, const char** argv) {
+    Options options = {};
+    for (i32 i = 2; i < argc; ++i) {
+        if (!strcmp(argv[i], "--share")) {
+            options.share = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--fusions")) {
+            options.fusions = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--jit")) {
+            options.jit = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--input")) {
+            EXIT_IF(argc <= (i + 1));
+            options.input = argv[++i];
+            continue;
+        }
+        EXIT_IF(!strncmp(argv[i], "--", 2));
+        EXIT_IF(2 <= options.len);
+        options.args[options.len++] = argv[i];
+    }
+    return options;
+}
+
+// NOTE: `main serve <program.core> [socket]` compiles the program once and
+// answers requests from stdin, or from each client of the socket, until the
+// input is closed. The workers' counters go to stderr after each input.
+static void serve_program(const Options* options) {
+    File* file = fopen(options->args[0], "r");
+    EXIT_IF(!file);
+    Input        source = map_input(file);
+    ServeMemory* memory =
+        reinterpret_cast<ServeMemory*>(calloc(1, sizeof(ServeMemory)));
+    EXIT_IF(!memory);
+    List<Fusion> fusions =
+        set_program(&memory->program,
+                    &memory->tokens,
+                    &memory->parse_memory,
+                    &memory->fuse_memory,
+                    {reinterpret_cast<const char*>(source.bytes), source.len});
+    if (options->fusions) {
+        println(stderr, &fusions);
+    }
+    set_server(&memory->server, &memory->program, options->share);
+    Input input = map_input(options->input);
+    for (usize i = 0; i < SERVE_WORKERS; ++i) {
+        memory->server.workers[i].context.input = input;
+    }
+    if (options->jit) {
+        set_jit(&memory->jit, &memory->program.inst_memory);
+        for (usize i = 0; i < SERVE_WORKERS; ++i) {
+            memory->server.workers[i].context.native = &memory->jit.native;
+        }
+    }
+    if (options->len == 2) {
+        serve(&memory->server, options->args[1]);
+    } else {
+        serve(&memory->server, stdin, stdout);
+        print(stderr, &memory->server);
+    }
+    for (usize i = 0; i < SERVE_WORKERS; ++i) {
+        set_sharing(&memory->server.workers[i].context, false);
+    }
+    if (options->jit) {
+        free_jit(&memory->jit);
+    }
+    free(memory);
+    unmap_input(&input);
+    unmap_input(&source);
+    EXIT_IF(fclose(file) != 0);
+}
+
+// NOTE: `main profile <program.core>` evaluates `main` and prints it, while
+// writing a heap sample to stderr after each collection at least
+// `PROFILE_INTERVAL` nanoseconds after the last one, and the stack segments
+// used once done.
+static void profile_program(const Options* options) {
+    File* file = fopen(options->args[0], "r");
+    EXIT_IF(!file);
+    Input          source = map_input(file);
+    ProfileMemory* memory =
+        reinterpret_cast<ProfileMemory*>(calloc(1, sizeof(ProfileMemory)));
+    EXIT_IF(!memory);
+    List<Fusion> fusions =
+        set_program(&memory->program,
+                    &memory->tokens,
+                    &memory->parse_memory,
+                    &memory->fuse_memory,
+                    {reinterpret_cast<const char*>(source.bytes), source.len});
+    if (options->fusions) {
+        println(stderr, &fusions);
+    }
+    set_sharing(&memory->context, options->share);
+    set_globals(&memory->context,
+                &memory->program.inst_memory,
+                &memory->program.shared);
+    memory->context.input = map_input(options->input);
+    set_profile(&memory->profile,
+                &memory->program.inst_memory,
+                stderr,
+                PROFILE_INTERVAL,
+                get_nanos());
+    memory->context.profile = &memory->profile;
+    const Value* value = call(&memory->context,
+                              &memory->program,
+                              &memory->values,
+                              GET_STRING("main"),
+                              null,
+                              0);
+    if (!value) {
+        EXIT_WITH(FAILURE);
+    }
+    put_value(&memory->chars, value);
+    printf("%.*s\n",
+           static_cast<i32>(memory->chars.len),
+           memory->chars.items);
+    print(stderr, &memory->context.segments);
+    if (memory->context.conses) {
+        print(stderr, memory->context.conses);
+    }
+    set_sharing(&memory->context, false);
+    unmap_input(&memory->context.input);
+    free(memory);
+    unmap_input(&source);
+    EXIT_IF(fclose(file) != 0);
+}
+
+// NOTE: `main emit <program.core>` writes the program to stdout as C++ that
+// builds against the headers here into a binary printing `main`, see aot.hpp.
+static void emit_program(const Options* options) {
+    File* file = fopen(options->args[0], "r");
+    EXIT_IF(!file);
+    EXIT_IF(options->input);
+    Input      source = map_input(file);
+    AotMemory* memory =
+        reinterpret_cast<AotMemory*>(calloc(1, sizeof(AotMemory)));
+    EXIT_IF(!memory);
+    List<Fusion> fusions =
+        set_program(&memory->program,
+                    &memory->tokens,
+                    &memory->parse_memory,
+                    &memory->fuse_memory,
+                    {reinterpret_cast<const char*>(source.bytes), source.len});
+    if (options->fusions) {
+        println(stderr, &fusions);
+    }
+    emit_aot(stdout,
+             &memory->program.inst_memory,
+             &memory->program.shared,
+             &memory->layout);
+    free(memory);
+    unmap_input(&source);
+    EXIT_IF(fclose(file) != 0);
+}
+
+// NOTE: `main repl [program.core]` loads the program's definitions, if given,
+// then reads definitions and expressions from stdin until it is closed.
+static void repl_program(const Options* options) {
+    ReplSession* repl =
+        reinterpret_cast<ReplSession*>(calloc(1, sizeof(ReplSession)));
+    EXIT_IF(!repl);
+    set_repl(repl);
+    repl->context.input = map_input(options->input);
+    if (options->len == 1) {
+        File* file = fopen(options->args[0], "r");
+        EXIT_IF(!file);
+        run_repl(repl, file, stdout, "", true);
+        EXIT_IF(fclose(file) != 0);
+        update_defs(repl, stdout);
+    }
+    run_repl(repl, stdin, stdout, isatty(STDIN_FILENO) ? "> " : "", false);
+    unmap_input(&repl->context.input);
+    free(repl);
+}
+
+i32 main(i32 argc, const char** argv) {
+    if ((1 < argc) && (!strcmp(argv[1], "serve"))) {
+        const Options options = get_options(argc, argv);
+        EXIT_IF(options.len == 0);
+        serve_program(&options);
+        return EXIT_SUCCESS;
+    }
+    if ((1 < argc) && (!strcmp(argv[1], "profile"))) {
+        const Options options = get_options(argc, argv);
+        EXIT_IF(options.len != 1);
+        profile_program(&options);
+        return EXIT_SUCCESS;
+    }
+    if ((1 < argc) && (!strcmp(argv[1], "emit"))) {
+        const Options options = get_options(argc, argv);
+        EXIT_IF(options.len != 1);
+        emit_program(&options);
+        return EXIT_SUCCESS;
+    }
+    if ((1 < argc) && (!strcmp(argv[1], "repl"))) {
+        const Options options = get_options(argc, argv);
+        EXIT_IF(1 < options.len);
+        repl_program(&options);
+        return EXIT_SUCCESS;
+    }
     printf("\n"
            "sizeof(String)           : %zu\n"
            "sizeof(List<String>)     : %zu\n"
            "sizeof(ListNode<String>) : %zu\n"
-           "sizeof(Token)            : %zu\n"
            "sizeof(ExprBinding)      : %zu\n"
            "sizeof(ExprLet)          : %zu\n"
            "sizeof(ExprTag)          : %zu\n"
@@ -47,6 +411,7 @@ i32 main() {
            "sizeof(InstBody)         : %zu\n"
            "sizeof(Inst)             : %zu\n"
            "sizeof(InstFrame)        : %zu\n"
+           "sizeof(InstCode)         : %zu\n"
            "sizeof(NodeBody)         : %zu\n"
            "sizeof(Node)             : %zu\n"
            "sizeof(Memory)           : %zu\n"
@@ -54,7 +419,6 @@ i32 main() {
            sizeof(String),
            sizeof(List<String>),
            sizeof(ListNode<String>),
-           sizeof(Token),
            sizeof(ExprBinding),
            sizeof(ExprLet),
            sizeof(ExprTag),
@@ -64,6 +428,7 @@ i32 main() {
            sizeof(InstBody),
            sizeof(Inst),
            sizeof(InstFrame),
+           sizeof(InstCode),
            sizeof(NodeBody),
            sizeof(Node),
            sizeof(Memory));
@@ -71,6 +436,48 @@ i32 main() {
     test_set_tokens(&memory->tokens);
     demo_list(&memory->list_strings);
     test_parse_program(&memory->tokens, &memory->parse_memory);
+    test_fuse_program(&memory->tokens,
+                      &memory->parse_memory,
+                      &memory->fuse_memory);
+    test_simplify_program(&memory->tokens,
+                          &memory->parse_memory,
+                          &memory->fuse_memory);
+    test_compile_program(&memory->tokens,
+                         &memory->parse_memory,
+                         &memory->inst_memory);
+    test_eval(&memory->tokens,
+              &memory->parse_memory,
+              &memory->fuse_memory,
+              &memory->inst_memory,
+              &memory->eval_memory,
+              &memory->profile);
+    test_jit(&memory->tokens,
+             &memory->parse_memory,
+             &memory->inst_memory,
+             &memory->eval_memory,
+             &memory->jit);
+    test_aot(&memory->tokens,
+             &memory->parse_memory,
+             &memory->inst_memory,
+             &memory->program.shared,
+             &memory->layout);
+    test_call(&memory->tokens,
+              &memory->parse_memory,
+              &memory->fuse_memory,
+              &memory->program,
+              memory->contexts,
+              &memory->values);
+    test_serve(&memory->tokens,
+               &memory->parse_memory,
+               &memory->fuse_memory,
+               &memory->program,
+               &memory->server);
+    test_i64s();
+    test_alloc_nodes(&memory->nodes[0]);
+    test_shared_nodes(&memory->shared, &memory->nodes[0]);
+    test_collect(&memory->nodes[0], &memory->nodes[1], &memory->shared);
+    test_set_def(&memory->repl.memory);
+    test_repl(&memory->repl);
     free(memory);
     printf("Done!\n");
     return EXIT_SUCCESS;
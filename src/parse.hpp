@@ -36,26 +36,65 @@ enum TokenTag {
 
     TOKEN_U32,
     TOKEN_VAR,
-};
 
-union TokenBody {
-    String as_string;
-    u32    as_u32;
+    TOKEN_END,
 };
 
-struct Token {
-    TokenBody body;
-    TokenTag  tag;
-    usize     offset;
+// NOTE: Tokens are stored as parallel arrays so the parser's lookahead only
+// walks `tags`. `values` holds the literal of a `TOKEN_U32` or the length of a
+// `TOKEN_VAR`, whose characters are read back out of `source`.
+template <usize N>
+struct Tokens {
+    u8          tags[N];
+    u32         offsets[N];
+    u32         values[N];
+    const char* source;
+    usize       len;
 };
 
+template <usize N>
+static void push_token(Tokens<N>* tokens, TokenTag tag, usize offset) {
+    EXIT_IF(N <= tokens->len);
+    EXIT_IF(0xFFFFFFFF < offset);
+    tokens->tags[tokens->len] = static_cast<u8>(tag);
+    tokens->offsets[tokens->len] = static_cast<u32>(offset);
+    tokens->values[tokens->len] = 0;
+    ++tokens->len;
+}
+
+// NOTE: Unchecked unless built with `DEBUG`; the parser stops at `TOKEN_END`
+// and so never reads past it.
+template <usize N>
+static TokenTag get_tag(const Tokens<N>* tokens, usize i) {
+#ifdef DEBUG
+    EXIT_IF(tokens->len <= i);
+#endif
+    return static_cast<TokenTag>(tokens->tags[i]);
+}
+
+template <usize N>
+static u32 get_u32(const Tokens<N>* tokens, usize i) {
+#ifdef DEBUG
+    EXIT_IF(get_tag(tokens, i) != TOKEN_U32);
+#endif
+    return tokens->values[i];
+}
+
+template <usize N>
+static String get_string(const Tokens<N>* tokens, usize i) {
+#ifdef DEBUG
+    EXIT_IF(get_tag(tokens, i) != TOKEN_VAR);
+#endif
+    return {&tokens->source[tokens->offsets[i]], tokens->values[i]};
+}
+
 template <usize S, usize B, usize U, usize E, usize F>
 struct ParseMemory {
-    Buffer<ListNode<String>, S>      strings;
-    Buffer<ListNode<ExprBinding>, B> bindings;
-    Buffer<ListNode<ExprBranch>, U>  branches;
-    Buffer<Expr, E>                  exprs;
-    Buffer<Func, F>                  funcs;
+    Buffer<String, S>      strings;
+    Buffer<ExprBinding, B> bindings;
+    Buffer<ExprBranch, U>  branches;
+    Buffer<Expr, E>        exprs;
+    Buffer<Func, F>        funcs;
 };
 
 #define IS_ALPHA(x) \
@@ -65,6 +104,8 @@ struct ParseMemory {
 
 #define IS_PUNCT(x) ((x) == '_')
 
+#define IS_SPACE(x) (((x) == ' ') || ((x) == '\t') || ((x) == '\n'))
+
 #define IS_ALPHA_OR_DIGIT_OR_PUNCT(x) \
     (IS_ALPHA(x) || IS_DIGIT(x) || IS_PUNCT(x))
 
@@ -79,7 +120,8 @@ static u32 parse_u32(String string, usize* i) {
 }
 
 template <usize N>
-static void set_tokens(String source, Buffer<Token, N>* tokens) {
+static void set_tokens(String source, Tokens<N>* tokens) {
+    tokens->source = source.chars;
     tokens->len = 0;
     for (usize i = 0; i < source.len;) {
         switch (source.chars[i]) {
@@ -100,117 +142,90 @@ static void set_tokens(String source, Buffer<Token, N>* tokens) {
             break;
         }
         case '(': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_LPAREN;
-            token->offset = i++;
+            push_token(tokens, TOKEN_LPAREN, i++);
             break;
         }
         case ')': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_RPAREN;
-            token->offset = i++;
+            push_token(tokens, TOKEN_RPAREN, i++);
             break;
         }
         case '{': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_LBRACE;
-            token->offset = i++;
+            push_token(tokens, TOKEN_LBRACE, i++);
             break;
         }
         case '}': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_RBRACE;
-            token->offset = i++;
+            push_token(tokens, TOKEN_RBRACE, i++);
             break;
         }
         case ';': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_SCOLON;
-            token->offset = i++;
+            push_token(tokens, TOKEN_SCOLON, i++);
             break;
         }
         case '=': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_ASSIGN;
-            token->offset = i++;
-            if ((i < source.len) && (source.chars[i] == '=')) {
-                token->tag = TOKEN_EQ;
-                ++i;
+            if (((i + 1) < source.len) && (source.chars[i + 1] == '=')) {
+                push_token(tokens, TOKEN_EQ, i);
+                i += 2;
+            } else {
+                push_token(tokens, TOKEN_ASSIGN, i++);
             }
             break;
         }
         case '!': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_NE;
-            token->offset = i++;
+            push_token(tokens, TOKEN_NE, i++);
             EXIT_IF(source.len <= i);
             EXIT_IF(source.chars[i] == '=');
             ++i;
             break;
         }
         case '+': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_ADD;
-            token->offset = i++;
+            push_token(tokens, TOKEN_ADD, i++);
             break;
         }
         case '-': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_SUB;
-            token->offset = i++;
+            push_token(tokens, TOKEN_SUB, i++);
             break;
         }
         case '*': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_MUL;
-            token->offset = i++;
+            push_token(tokens, TOKEN_MUL, i++);
             break;
         }
         case '/': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_DIV;
-            token->offset = i++;
+            push_token(tokens, TOKEN_DIV, i++);
             break;
         }
         case '<': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_LT;
-            token->offset = i++;
-            if ((i < source.len) && (source.chars[i] == '=')) {
-                token->tag = TOKEN_LE;
-                ++i;
+            if (((i + 1) < source.len) && (source.chars[i + 1] == '=')) {
+                push_token(tokens, TOKEN_LE, i);
+                i += 2;
+            } else {
+                push_token(tokens, TOKEN_LT, i++);
             }
             break;
         }
         case '>': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_GT;
-            token->offset = i++;
-            if ((i < source.len) && (source.chars[i] == '=')) {
-                token->tag = TOKEN_GE;
-                ++i;
+            if (((i + 1) < source.len) && (source.chars[i + 1] == '=')) {
+                push_token(tokens, TOKEN_GE, i);
+                i += 2;
+            } else {
+                push_token(tokens, TOKEN_GT, i++);
             }
             break;
         }
         case '&': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_AND;
-            token->offset = i++;
+            push_token(tokens, TOKEN_AND, i++);
             break;
         }
         case '|': {
-            Token* token = alloc(tokens);
-            token->tag = TOKEN_OR;
-            token->offset = i++;
+            push_token(tokens, TOKEN_OR, i++);
             break;
         }
         default: {
-            EXIT_IF(!(IS_ALPHA_OR_DIGIT_OR_PUNCT(source.chars[i])));
-            Token* token = alloc(tokens);
-            token->offset = i;
+            if (!(IS_ALPHA_OR_DIGIT_OR_PUNCT(source.chars[i]))) {
+                EXIT_WITH("unexpected character");
+            }
             if (IS_DIGIT(source.chars[i])) {
-                token->body.as_u32 = parse_u32(source, &i);
-                token->tag = TOKEN_U32;
+                push_token(tokens, TOKEN_U32, i);
+                tokens->values[tokens->len - 1] = parse_u32(source, &i);
                 continue;
             }
             usize j = i;
@@ -222,295 +237,291 @@ static void set_tokens(String source, Buffer<Token, N>* tokens) {
             EXIT_IF(i == j);
             String var = {&source.chars[i], j - i};
             if (var == GET_STRING("undef")) {
-                token->tag = TOKEN_UNDEF;
+                push_token(tokens, TOKEN_UNDEF, i);
             } else if (var == GET_STRING("let")) {
-                token->tag = TOKEN_LET;
+                push_token(tokens, TOKEN_LET, i);
             } else if (var == GET_STRING("letrec")) {
-                token->tag = TOKEN_LETREC;
+                push_token(tokens, TOKEN_LETREC, i);
             } else if (var == GET_STRING("pack")) {
-                token->tag = TOKEN_PACK;
+                push_token(tokens, TOKEN_PACK, i);
             } else if (var == GET_STRING("unpack")) {
-                token->tag = TOKEN_UNPACK;
+                push_token(tokens, TOKEN_UNPACK, i);
             } else {
-                token->body.as_string = var;
-                token->tag = TOKEN_VAR;
+                EXIT_IF(0xFFFFFFFF < var.len);
+                push_token(tokens, TOKEN_VAR, i);
+                tokens->values[tokens->len - 1] = static_cast<u32>(var.len);
             }
             i = j;
         }
         }
     }
+    push_token(tokens, TOKEN_END, source.len);
 }
 
 template <usize N>
-static void test_set_tokens(Buffer<Token, N>* tokens) {
+static void test_set_tokens(Tokens<N>* tokens) {
     {
         set_tokens(GET_STRING("1234"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[0].body.as_u32 != 1234);
-        EXIT_IF(tokens->items[0].offset != 0);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 0) != 1234);
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_END);
+        EXIT_IF(tokens->offsets[1] != 4);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("\tundef"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_UNDEF);
-        EXIT_IF(tokens->items[0].offset != 1);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_UNDEF);
+        EXIT_IF(tokens->offsets[0] != 1);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("\n  negate"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[0].body.as_string != GET_STRING("negate"));
-        EXIT_IF(tokens->items[0].offset != 3);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 0) != GET_STRING("negate"));
+        EXIT_IF(tokens->offsets[0] != 3);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("\n\nlet"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_LET);
-        EXIT_IF(tokens->items[0].offset != 2);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_LET);
+        EXIT_IF(tokens->offsets[0] != 2);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING(" letrec "), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_LETREC);
-        EXIT_IF(tokens->items[0].offset != 1);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_LETREC);
+        EXIT_IF(tokens->offsets[0] != 1);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("f x {\n  pack 3 1 x\n}"), tokens);
-        EXIT_IF(tokens->len != 8);
-        EXIT_IF(tokens->items[0].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[0].body.as_string != GET_STRING("f"));
-        EXIT_IF(tokens->items[0].offset != 0);
-        EXIT_IF(tokens->items[1].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[1].body.as_string != GET_STRING("x"));
-        EXIT_IF(tokens->items[1].offset != 2);
-        EXIT_IF(tokens->items[2].tag != TOKEN_LBRACE);
-        EXIT_IF(tokens->items[2].offset != 4);
-        EXIT_IF(tokens->items[3].tag != TOKEN_PACK);
-        EXIT_IF(tokens->items[3].offset != 8);
-        EXIT_IF(tokens->items[4].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[4].body.as_u32 != 3);
-        EXIT_IF(tokens->items[4].offset != 13);
-        EXIT_IF(tokens->items[5].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[5].body.as_u32 != 1);
-        EXIT_IF(tokens->items[5].offset != 15);
-        EXIT_IF(tokens->items[6].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[6].body.as_string != GET_STRING("x"));
-        EXIT_IF(tokens->items[6].offset != 17);
-        EXIT_IF(tokens->items[7].tag != TOKEN_RBRACE);
-        EXIT_IF(tokens->items[7].offset != 19);
+        EXIT_IF(tokens->len != 9);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 0) != GET_STRING("f"));
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 1) != GET_STRING("x"));
+        EXIT_IF(tokens->offsets[1] != 2);
+        EXIT_IF(get_tag(tokens, 2) != TOKEN_LBRACE);
+        EXIT_IF(tokens->offsets[2] != 4);
+        EXIT_IF(get_tag(tokens, 3) != TOKEN_PACK);
+        EXIT_IF(tokens->offsets[3] != 8);
+        EXIT_IF(get_tag(tokens, 4) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 4) != 3);
+        EXIT_IF(tokens->offsets[4] != 13);
+        EXIT_IF(get_tag(tokens, 5) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 5) != 1);
+        EXIT_IF(tokens->offsets[5] != 15);
+        EXIT_IF(get_tag(tokens, 6) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 6) != GET_STRING("x"));
+        EXIT_IF(tokens->offsets[6] != 17);
+        EXIT_IF(get_tag(tokens, 7) != TOKEN_RBRACE);
+        EXIT_IF(tokens->offsets[7] != 19);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("if (a == b) _xy _uv"), tokens);
-        EXIT_IF(tokens->len != 8);
-        EXIT_IF(tokens->items[0].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[0].body.as_string != GET_STRING("if"));
-        EXIT_IF(tokens->items[0].offset != 0);
-        EXIT_IF(tokens->items[1].tag != TOKEN_LPAREN);
-        EXIT_IF(tokens->items[1].offset != 3);
-        EXIT_IF(tokens->items[2].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[2].body.as_string != GET_STRING("a"));
-        EXIT_IF(tokens->items[2].offset != 4);
-        EXIT_IF(tokens->items[3].tag != TOKEN_EQ);
-        EXIT_IF(tokens->items[3].offset != 6);
-        EXIT_IF(tokens->items[4].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[4].body.as_string != GET_STRING("b"));
-        EXIT_IF(tokens->items[4].offset != 9);
-        EXIT_IF(tokens->items[5].tag != TOKEN_RPAREN);
-        EXIT_IF(tokens->items[5].offset != 10);
-        EXIT_IF(tokens->items[6].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[6].body.as_string != GET_STRING("_xy"));
-        EXIT_IF(tokens->items[6].offset != 12);
-        EXIT_IF(tokens->items[7].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[7].body.as_string != GET_STRING("_uv"));
-        EXIT_IF(tokens->items[7].offset != 16);
+        EXIT_IF(tokens->len != 9);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 0) != GET_STRING("if"));
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_LPAREN);
+        EXIT_IF(tokens->offsets[1] != 3);
+        EXIT_IF(get_tag(tokens, 2) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 2) != GET_STRING("a"));
+        EXIT_IF(tokens->offsets[2] != 4);
+        EXIT_IF(get_tag(tokens, 3) != TOKEN_EQ);
+        EXIT_IF(tokens->offsets[3] != 6);
+        EXIT_IF(get_tag(tokens, 4) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 4) != GET_STRING("b"));
+        EXIT_IF(tokens->offsets[4] != 9);
+        EXIT_IF(get_tag(tokens, 5) != TOKEN_RPAREN);
+        EXIT_IF(tokens->offsets[5] != 10);
+        EXIT_IF(get_tag(tokens, 6) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 6) != GET_STRING("_xy"));
+        EXIT_IF(tokens->offsets[6] != 12);
+        EXIT_IF(get_tag(tokens, 7) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 7) != GET_STRING("_uv"));
+        EXIT_IF(tokens->offsets[7] != 16);
         fprintf(stderr, ".");
     }
     {
         set_tokens(
             GET_STRING("unpack xyz_123 { # ...\n  1 = 0;\n  2 x = x\n}"),
             tokens);
-        EXIT_IF(tokens->len != 12);
-        EXIT_IF(tokens->items[0].tag != TOKEN_UNPACK);
-        EXIT_IF(tokens->items[0].offset != 0);
-        EXIT_IF(tokens->items[1].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[1].body.as_string != GET_STRING("xyz_123"));
-        EXIT_IF(tokens->items[1].offset != 7);
-        EXIT_IF(tokens->items[2].tag != TOKEN_LBRACE);
-        EXIT_IF(tokens->items[2].offset != 15);
-        EXIT_IF(tokens->items[3].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[3].body.as_u32 != 1);
-        EXIT_IF(tokens->items[3].offset != 25);
-        EXIT_IF(tokens->items[4].tag != TOKEN_ASSIGN);
-        EXIT_IF(tokens->items[4].offset != 27);
-        EXIT_IF(tokens->items[5].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[5].body.as_u32 != 0);
-        EXIT_IF(tokens->items[5].offset != 29);
-        EXIT_IF(tokens->items[6].tag != TOKEN_SCOLON);
-        EXIT_IF(tokens->items[6].offset != 30);
-        EXIT_IF(tokens->items[7].tag != TOKEN_U32);
-        EXIT_IF(tokens->items[7].body.as_u32 != 2);
-        EXIT_IF(tokens->items[7].offset != 34);
-        EXIT_IF(tokens->items[8].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[8].body.as_string != GET_STRING("x"));
-        EXIT_IF(tokens->items[8].offset != 36);
-        EXIT_IF(tokens->items[9].tag != TOKEN_ASSIGN);
-        EXIT_IF(tokens->items[9].offset != 38);
-        EXIT_IF(tokens->items[10].tag != TOKEN_VAR);
-        EXIT_IF(tokens->items[10].body.as_string != GET_STRING("x"));
-        EXIT_IF(tokens->items[10].offset != 40);
-        EXIT_IF(tokens->items[11].tag != TOKEN_RBRACE);
-        EXIT_IF(tokens->items[11].offset != 42);
+        EXIT_IF(tokens->len != 13);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_UNPACK);
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 1) != GET_STRING("xyz_123"));
+        EXIT_IF(tokens->offsets[1] != 7);
+        EXIT_IF(get_tag(tokens, 2) != TOKEN_LBRACE);
+        EXIT_IF(tokens->offsets[2] != 15);
+        EXIT_IF(get_tag(tokens, 3) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 3) != 1);
+        EXIT_IF(tokens->offsets[3] != 25);
+        EXIT_IF(get_tag(tokens, 4) != TOKEN_ASSIGN);
+        EXIT_IF(tokens->offsets[4] != 27);
+        EXIT_IF(get_tag(tokens, 5) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 5) != 0);
+        EXIT_IF(tokens->offsets[5] != 29);
+        EXIT_IF(get_tag(tokens, 6) != TOKEN_SCOLON);
+        EXIT_IF(tokens->offsets[6] != 30);
+        EXIT_IF(get_tag(tokens, 7) != TOKEN_U32);
+        EXIT_IF(get_u32(tokens, 7) != 2);
+        EXIT_IF(tokens->offsets[7] != 34);
+        EXIT_IF(get_tag(tokens, 8) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 8) != GET_STRING("x"));
+        EXIT_IF(tokens->offsets[8] != 36);
+        EXIT_IF(get_tag(tokens, 9) != TOKEN_ASSIGN);
+        EXIT_IF(tokens->offsets[9] != 38);
+        EXIT_IF(get_tag(tokens, 10) != TOKEN_VAR);
+        EXIT_IF(get_string(tokens, 10) != GET_STRING("x"));
+        EXIT_IF(tokens->offsets[10] != 40);
+        EXIT_IF(get_tag(tokens, 11) != TOKEN_RBRACE);
+        EXIT_IF(tokens->offsets[11] != 42);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("<\t"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_LT);
-        EXIT_IF(tokens->items[0].offset != 0);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_LT);
+        EXIT_IF(tokens->offsets[0] != 0);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("\n<=\n"), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_LE);
-        EXIT_IF(tokens->items[0].offset != 1);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_LE);
+        EXIT_IF(tokens->offsets[0] != 1);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("> ="), tokens);
-        EXIT_IF(tokens->len != 2);
-        EXIT_IF(tokens->items[0].tag != TOKEN_GT);
-        EXIT_IF(tokens->items[0].offset != 0);
-        EXIT_IF(tokens->items[1].tag != TOKEN_ASSIGN);
-        EXIT_IF(tokens->items[1].offset != 2);
+        EXIT_IF(tokens->len != 3);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_GT);
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_ASSIGN);
+        EXIT_IF(tokens->offsets[1] != 2);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("\t >="), tokens);
-        EXIT_IF(tokens->len != 1);
-        EXIT_IF(tokens->items[0].tag != TOKEN_GE);
-        EXIT_IF(tokens->items[0].offset != 2);
+        EXIT_IF(tokens->len != 2);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_GE);
+        EXIT_IF(tokens->offsets[0] != 2);
         fprintf(stderr, ".");
     }
     {
         set_tokens(GET_STRING("+-*/&|"), tokens);
-        EXIT_IF(tokens->len != 6);
-        EXIT_IF(tokens->items[0].tag != TOKEN_ADD);
-        EXIT_IF(tokens->items[0].offset != 0);
-        EXIT_IF(tokens->items[1].tag != TOKEN_SUB);
-        EXIT_IF(tokens->items[1].offset != 1);
-        EXIT_IF(tokens->items[2].tag != TOKEN_MUL);
-        EXIT_IF(tokens->items[2].offset != 2);
-        EXIT_IF(tokens->items[3].tag != TOKEN_DIV);
-        EXIT_IF(tokens->items[3].offset != 3);
-        EXIT_IF(tokens->items[4].tag != TOKEN_AND);
-        EXIT_IF(tokens->items[4].offset != 4);
-        EXIT_IF(tokens->items[5].tag != TOKEN_OR);
-        EXIT_IF(tokens->items[5].offset != 5);
+        EXIT_IF(tokens->len != 7);
+        EXIT_IF(get_tag(tokens, 0) != TOKEN_ADD);
+        EXIT_IF(tokens->offsets[0] != 0);
+        EXIT_IF(get_tag(tokens, 1) != TOKEN_SUB);
+        EXIT_IF(tokens->offsets[1] != 1);
+        EXIT_IF(get_tag(tokens, 2) != TOKEN_MUL);
+        EXIT_IF(tokens->offsets[2] != 2);
+        EXIT_IF(get_tag(tokens, 3) != TOKEN_DIV);
+        EXIT_IF(tokens->offsets[3] != 3);
+        EXIT_IF(get_tag(tokens, 4) != TOKEN_AND);
+        EXIT_IF(tokens->offsets[4] != 4);
+        EXIT_IF(get_tag(tokens, 5) != TOKEN_OR);
+        EXIT_IF(tokens->offsets[5] != 5);
         fprintf(stderr, ".");
     }
     fprintf(stderr, "\n");
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-const Expr* parse_expr(const Buffer<Token, T>*,
+const Expr* parse_expr(const Tokens<T>*,
                        ParseMemory<S, B, U, E, F>*,
                        usize*);
 
 template <usize T, usize S, usize B, usize U, usize E, usize F, ExprTag X>
-static const Expr* parse_let(const Buffer<Token, T>*     tokens,
+static const Expr* parse_let(const Tokens<T>*            tokens,
                              ParseMemory<S, B, U, E, F>* memory,
                              usize*                      i) {
-    {
-        const Token token = get(tokens, (*i)++);
-        EXIT_IF(token.tag != TOKEN_LBRACE);
-    }
+    EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_LBRACE);
     Expr* expr = alloc(&memory->exprs);
+    *expr = {};
     expr->tag = X;
+    ExprBinding bindings[CAP_SPAN];
+    usize       len = 0;
     for (;;) {
         {
-            ExprBinding binding = {};
+            EXIT_IF(CAP_SPAN <= len);
+            ExprBinding* binding = &bindings[len++];
             {
-                const Token token = get(tokens, (*i)++);
-                EXIT_IF(token.tag != TOKEN_VAR);
-                binding.name = token.body.as_string;
+                EXIT_IF(get_tag(tokens, *i) != TOKEN_VAR);
+                binding->name = get_string(tokens, (*i)++);
             }
-            {
-                const Token token = get(tokens, (*i)++);
-                EXIT_IF(token.tag != TOKEN_ASSIGN);
-            }
-            binding.expr = parse_expr(tokens, memory, i);
-            append(&memory->bindings, &expr->body.as_let.bindings, binding);
+            EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_ASSIGN);
+            binding->expr = parse_expr(tokens, memory, i);
         }
-        const Token token = get(tokens, (*i)++);
-        if (token.tag == TOKEN_SCOLON) {
+        const TokenTag tag = get_tag(tokens, (*i)++);
+        if (tag == TOKEN_SCOLON) {
             continue;
         }
-        if (token.tag == TOKEN_RBRACE) {
-            break;
-        }
+        EXIT_IF(tag != TOKEN_RBRACE);
+        break;
     }
+    expr->body.as_let.bindings = get_span(&memory->bindings, bindings, len);
     expr->body.as_let.expr = parse_expr(tokens, memory, i);
     return expr;
 }
 
 template <usize T, usize S>
-static void parse_args(const Buffer<Token, T>*      tokens,
-                       Buffer<ListNode<String>, S>* strings,
-                       List<String>*                list,
-                       usize*                       i) {
+static Span<String> parse_args(const Tokens<T>*   tokens,
+                               Buffer<String, S>* strings,
+                               usize*             i) {
+    Span<String> args = {&strings->items[strings->len], 0};
     for (;;) {
-        const Token token = get(tokens, *i);
-        if (token.tag != TOKEN_VAR) {
-            return;
+        if (get_tag(tokens, *i) != TOKEN_VAR) {
+            return args;
         }
-        ++(*i);
-        append(strings, list, token.body.as_string);
+        *alloc(strings) = get_string(tokens, (*i)++);
+        ++args.len;
     }
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_unpack(const Buffer<Token, T>*     tokens,
+static const Expr* parse_unpack(const Tokens<T>*            tokens,
                                 ParseMemory<S, B, U, E, F>* memory,
                                 usize*                      i) {
     Expr* expr = alloc(&memory->exprs);
+    *expr = {};
     expr->tag = EXPR_UNPACK;
     expr->body.as_unpack.expr = parse_expr(tokens, memory, i);
-    {
-        const Token token = get(tokens, (*i)++);
-        EXIT_IF(token.tag != TOKEN_LBRACE);
-    }
+    EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_LBRACE);
+    ExprBranch branches[CAP_SPAN];
+    usize      len = 0;
     for (;;) {
         {
-            ExprBranch branch = {};
-            {
-                const Token token = get(tokens, (*i)++);
-                EXIT_IF(token.tag != TOKEN_U32);
-                EXIT_IF(0xFF < token.body.as_u32);
-                branch.tag = static_cast<u8>(token.body.as_u32);
-            }
-            parse_args(tokens, &memory->strings, &branch.args, i);
+            EXIT_IF(CAP_SPAN <= len);
+            ExprBranch* branch = &branches[len++];
             {
-                const Token token = get(tokens, (*i)++);
-                EXIT_IF(token.tag != TOKEN_ASSIGN);
+                EXIT_IF(get_tag(tokens, *i) != TOKEN_U32);
+                EXIT_IF(0xFF < get_u32(tokens, *i));
+                branch->tag = static_cast<u8>(get_u32(tokens, (*i)++));
             }
-            branch.expr = parse_expr(tokens, memory, i);
-            append(&memory->branches, &expr->body.as_unpack.branches, branch);
+            branch->args = parse_args(tokens, &memory->strings, i);
+            EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_ASSIGN);
+            branch->expr = parse_expr(tokens, memory, i);
         }
-        const Token token = get(tokens, (*i)++);
-        if (token.tag == TOKEN_SCOLON) {
+        const TokenTag tag = get_tag(tokens, (*i)++);
+        if (tag == TOKEN_SCOLON) {
             continue;
         }
-        if (token.tag == TOKEN_RBRACE) {
-            return expr;
-        }
+        EXIT_IF(tag != TOKEN_RBRACE);
+        expr->body.as_unpack.branches =
+            get_span(&memory->branches, branches, len);
+        return expr;
     }
 }
 
@@ -525,61 +536,67 @@ static const Expr* get_app(Buffer<Expr, E>* exprs,
     return app;
 }
 
+template <usize E>
+static const Expr* get_binop(Buffer<Expr, E>* exprs,
+                             BinOp            op,
+                             const Expr*      l,
+                             const Expr*      r) {
+    Expr* binop = alloc(exprs);
+    binop->tag = EXPR_BINOP;
+    binop->body.as_binop.args[0] = l;
+    binop->body.as_binop.args[1] = r;
+    binop->body.as_binop.op = op;
+    return binop;
+}
+
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_atomic(const Buffer<Token, T>*     tokens,
+static const Expr* parse_atomic(const Tokens<T>*            tokens,
                                 ParseMemory<S, B, U, E, F>* memory,
                                 usize*                      i) {
-    const Token token = get(tokens, *i);
-    if (token.tag == TOKEN_UNDEF) {
+    const TokenTag tag = get_tag(tokens, *i);
+    if (tag == TOKEN_UNDEF) {
         ++(*i);
         Expr* expr = alloc(&memory->exprs);
         expr->tag = EXPR_UNDEF;
         return expr;
-    } else if (token.tag == TOKEN_PACK) {
+    } else if (tag == TOKEN_PACK) {
         ++(*i);
         Expr* expr = alloc(&memory->exprs);
         expr->tag = EXPR_PACK;
         {
-            const Token token0 = get(tokens, (*i)++);
-            EXIT_IF(token0.tag != TOKEN_U32);
-            EXIT_IF(0xFF < token0.body.as_u32);
-            expr->body.as_pack[0] = static_cast<u8>(token0.body.as_u32);
+            EXIT_IF(get_tag(tokens, *i) != TOKEN_U32);
+            EXIT_IF(0xFF < get_u32(tokens, *i));
+            expr->body.as_pack[0] = static_cast<u8>(get_u32(tokens, (*i)++));
         }
         {
-            const Token token0 = get(tokens, (*i)++);
-            EXIT_IF(token0.tag != TOKEN_U32);
-            EXIT_IF(0xFF < token0.body.as_u32);
-            expr->body.as_pack[1] = static_cast<u8>(token0.body.as_u32);
+            EXIT_IF(get_tag(tokens, *i) != TOKEN_U32);
+            EXIT_IF(0xFF < get_u32(tokens, *i));
+            expr->body.as_pack[1] = static_cast<u8>(get_u32(tokens, (*i)++));
         }
         return expr;
-    } else if (token.tag == TOKEN_LPAREN) {
+    } else if (tag == TOKEN_LPAREN) {
         ++(*i);
         const Expr* expr = parse_expr(tokens, memory, i);
-        {
-            const Token token0 = get(tokens, (*i)++);
-            EXIT_IF(token0.tag != TOKEN_RPAREN);
-        }
+        EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_RPAREN);
         return expr;
-    } else if (token.tag == TOKEN_VAR) {
-        ++(*i);
+    } else if (tag == TOKEN_VAR) {
         Expr* expr = alloc(&memory->exprs);
         expr->tag = EXPR_VAR;
-        expr->body.as_var = token.body.as_string;
+        expr->body.as_var = get_string(tokens, (*i)++);
         return expr;
-    } else if (token.tag == TOKEN_U32) {
-        ++(*i);
+    } else if (tag == TOKEN_U32) {
         Expr* expr = alloc(&memory->exprs);
         expr->tag = EXPR_U32;
-        expr->body.as_u32 = token.body.as_u32;
+        expr->body.as_u32 = get_u32(tokens, (*i)++);
         return expr;
     }
     return null;
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr6(const Buffer<Token, T>*     tokens,
-                               ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
+static const Expr* parse_app(const Tokens<T>*            tokens,
+                             ParseMemory<S, B, U, E, F>* memory,
+                             usize*                      i) {
     const Expr* l = parse_atomic(tokens, memory, i);
     EXIT_IF(!l);
     for (;;) {
@@ -591,203 +608,120 @@ static const Expr* parse_expr6(const Buffer<Token, T>*     tokens,
     }
 }
 
-template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr5(const Buffer<Token, T>*     tokens,
-                               ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
-    const Expr* l = parse_expr6(tokens, memory, i);
-    {
-        const Token token = get(tokens, *i);
-        if (token.tag == TOKEN_MUL) {
-            ++(*i);
-            const Expr* r = parse_expr5(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_MUL;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_DIV) {
-            ++(*i);
-            const Expr* r = parse_expr6(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_DIV;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        }
-    }
-    return l;
-}
+struct Infix {
+    BinOp op;
+    u8    power;
+    bool  right;
+};
 
-template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr4(const Buffer<Token, T>*     tokens,
-                               ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
-    const Expr* l = parse_expr5(tokens, memory, i);
-    {
-        const Token token = get(tokens, *i);
-        if (token.tag == TOKEN_ADD) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_ADD;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_SUB) {
-            ++(*i);
-            const Expr* r = parse_expr5(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_SUB;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        }
-    }
-    return l;
-}
+// NOTE: Indexed by `TokenTag`. A token with zero `power` ends the infix
+// expression; a right-associative operator parses its right operand at one
+// below its own power so an equal operator there nests to the right.
+static const Infix INFIXES[] = {
+    {BINOP_ADD, 0, false}, // TOKEN_UNDEF
+    {BINOP_ADD, 0, false}, // TOKEN_LET
+    {BINOP_ADD, 0, false}, // TOKEN_LETREC
+    {BINOP_ADD, 0, false}, // TOKEN_PACK
+    {BINOP_ADD, 0, false}, // TOKEN_UNPACK
+    {BINOP_ADD, 0, false}, // TOKEN_LPAREN
+    {BINOP_ADD, 0, false}, // TOKEN_RPAREN
+    {BINOP_ADD, 0, false}, // TOKEN_LBRACE
+    {BINOP_ADD, 0, false}, // TOKEN_RBRACE
+    {BINOP_ADD, 0, false}, // TOKEN_SCOLON
+    {BINOP_ADD, 0, false}, // TOKEN_ASSIGN
+    {BINOP_ADD, 4, true},  // TOKEN_ADD
+    {BINOP_SUB, 4, false}, // TOKEN_SUB
+    {BINOP_MUL, 5, true},  // TOKEN_MUL
+    {BINOP_DIV, 5, false}, // TOKEN_DIV
+    {BINOP_LT, 3, false},  // TOKEN_LT
+    {BINOP_LE, 3, false},  // TOKEN_LE
+    {BINOP_GT, 3, false},  // TOKEN_GT
+    {BINOP_GE, 3, false},  // TOKEN_GE
+    {BINOP_EQ, 3, false},  // TOKEN_EQ
+    {BINOP_NE, 3, false},  // TOKEN_NE
+    {BINOP_AND, 2, true},  // TOKEN_AND
+    {BINOP_OR, 1, true},   // TOKEN_OR
+    {BINOP_ADD, 0, false}, // TOKEN_U32
+    {BINOP_ADD, 0, false}, // TOKEN_VAR
+    {BINOP_ADD, 0, false}, // TOKEN_END
+};
 
-template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr3(const Buffer<Token, T>*     tokens,
-                               ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
-    const Expr* l = parse_expr4(tokens, memory, i);
-    {
-        const Token token = get(tokens, *i);
-        if (token.tag == TOKEN_LT) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_LT;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_LE) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_LE;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_GT) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_GT;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_GE) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_GE;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_EQ) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_EQ;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        } else if (token.tag == TOKEN_NE) {
-            ++(*i);
-            const Expr* r = parse_expr4(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_NE;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        }
-    }
-    return l;
-}
+STATIC_ASSERT((sizeof(INFIXES) / sizeof(INFIXES[0])) == (TOKEN_END + 1));
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr2(const Buffer<Token, T>*     tokens,
+static const Expr* parse_binop(const Tokens<T>*            tokens,
                                ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
-    const Expr* l = parse_expr3(tokens, memory, i);
-    {
-        const Token token = get(tokens, *i);
-        if (token.tag == TOKEN_AND) {
-            ++(*i);
-            const Expr* r = parse_expr2(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_AND;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
-        }
-    }
-    return l;
-}
-
-template <usize T, usize S, usize B, usize U, usize E, usize F>
-static const Expr* parse_expr1(const Buffer<Token, T>*     tokens,
-                               ParseMemory<S, B, U, E, F>* memory,
-                               usize*                      i) {
-    const Expr* l = parse_expr2(tokens, memory, i);
-    {
-        const Token token = get(tokens, *i);
-        if (token.tag == TOKEN_OR) {
-            ++(*i);
-            const Expr* r = parse_expr1(tokens, memory, i);
-            Expr*       op = alloc(&memory->exprs);
-            op->tag = EXPR_BINOP;
-            op->body.as_binop = BINOP_OR;
-            return get_app(&memory->exprs, get_app(&memory->exprs, op, l), r);
+                               usize*                      i,
+                               u8                          power) {
+    const Expr* l = parse_app(tokens, memory, i);
+    for (;;) {
+        const Infix infix = INFIXES[get_tag(tokens, *i)];
+        if (infix.power <= power) {
+            return l;
         }
+        ++(*i);
+        const Expr* r =
+            parse_binop(tokens,
+                        memory,
+                        i,
+                        infix.right ? static_cast<u8>(infix.power - 1)
+                                    : infix.power);
+        l = get_binop(&memory->exprs, infix.op, l, r);
     }
-    return l;
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-const Expr* parse_expr(const Buffer<Token, T>*     tokens,
+const Expr* parse_expr(const Tokens<T>*            tokens,
                        ParseMemory<S, B, U, E, F>* memory,
                        usize*                      i) {
-    const Token token = get(tokens, *i);
-    if (token.tag == TOKEN_LET) {
+    const TokenTag tag = get_tag(tokens, *i);
+    if (tag == TOKEN_LET) {
         ++(*i);
         return parse_let<T, S, B, U, E, F, EXPR_LET>(tokens, memory, i);
-    } else if (token.tag == TOKEN_LETREC) {
+    } else if (tag == TOKEN_LETREC) {
         ++(*i);
         return parse_let<T, S, B, U, E, F, EXPR_LETREC>(tokens, memory, i);
-    } else if (token.tag == TOKEN_UNPACK) {
+    } else if (tag == TOKEN_UNPACK) {
         ++(*i);
         return parse_unpack(tokens, memory, i);
     }
-    return parse_expr1(tokens, memory, i);
+    return parse_binop(tokens, memory, i, 0);
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static void parse_func(const Buffer<Token, T>*     tokens,
-                       ParseMemory<S, B, U, E, F>* memory,
-                       usize*                      i) {
+static const Func* parse_func(const Tokens<T>*            tokens,
+                              ParseMemory<S, B, U, E, F>* memory,
+                              usize*                      i) {
     Func* func = alloc(&memory->funcs);
+    *func = {};
     {
-        const Token token = get(tokens, (*i)++);
-        EXIT_IF(token.tag != TOKEN_VAR);
-        func->name.as_var = token.body.as_string;
-    }
-    parse_args(tokens, &memory->strings, &func->args, i);
-    {
-        const Token token = get(tokens, (*i)++);
-        EXIT_IF(token.tag != TOKEN_LBRACE);
+        EXIT_IF(get_tag(tokens, *i) != TOKEN_VAR);
+        func->name.as_var = get_string(tokens, (*i)++);
     }
+    func->args = parse_args(tokens, &memory->strings, i);
+    EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_LBRACE);
     func->expr = parse_expr(tokens, memory, i);
-    {
-        const Token token = get(tokens, (*i)++);
-        EXIT_IF(token.tag != TOKEN_RBRACE);
-    }
+    EXIT_IF(get_tag(tokens, (*i)++) != TOKEN_RBRACE);
+    return func;
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static void parse_program(const Buffer<Token, T>*     tokens,
+static void parse_program(const Tokens<T>*            tokens,
                           ParseMemory<S, B, U, E, F>* memory) {
-    memset(memory, 0, sizeof(ParseMemory<S, B, U, E, F>));
+    memory->strings.len = 0;
+    memory->bindings.len = 0;
+    memory->branches.len = 0;
+    memory->exprs.len = 0;
+    memory->funcs.len = 0;
     usize i = 0;
-    while (i < tokens->len) {
+    while (get_tag(tokens, i) != TOKEN_END) {
         parse_func(tokens, memory, &i);
     }
     EXIT_IF(memory->funcs.len == 0);
 }
 
 template <usize T, usize S, usize B, usize U, usize E, usize F>
-static void test_parse_program(Buffer<Token, T>*           tokens,
+static void test_parse_program(Tokens<T>*                  tokens,
                                ParseMemory<S, B, U, E, F>* memory) {
     {
         set_tokens(GET_STRING("main { 1234 }"), tokens);
@@ -796,8 +730,7 @@ static void test_parse_program(Buffer<Token, T>*           tokens,
         {
             EXIT_IF(memory->funcs.items[0].tag != FUNC_VAR);
             EXIT_IF(memory->funcs.items[0].name.as_var != GET_STRING("main"));
-            EXIT_IF(memory->funcs.items[0].args.first);
-            EXIT_IF(memory->funcs.items[0].args.last);
+            EXIT_IF(memory->funcs.items[0].args.len != 0);
             EXIT_IF(memory->funcs.items[0].expr->tag != EXPR_U32);
             EXIT_IF(memory->funcs.items[0].expr->body.as_u32 != 1234);
         }
@@ -814,62 +747,40 @@ static void test_parse_program(Buffer<Token, T>*           tokens,
         {
             EXIT_IF(memory->funcs.items[0].tag != FUNC_VAR);
             EXIT_IF(memory->funcs.items[0].name.as_var != GET_STRING("f"));
-            EXIT_IF(memory->funcs.items[0].args.first->value !=
-                    GET_STRING("x"));
-            EXIT_IF(memory->funcs.items[0].args.first->next);
-            EXIT_IF(memory->funcs.items[0].args.last->value !=
-                    GET_STRING("x"));
+            EXIT_IF(memory->funcs.items[0].args.len != 1);
+            EXIT_IF(memory->funcs.items[0].args.items[0] != GET_STRING("x"));
         }
         {
             EXIT_IF(memory->funcs.items[1].tag != FUNC_VAR);
             EXIT_IF(memory->funcs.items[1].name.as_var != GET_STRING("g"));
             {
-                ListNode<String>* arg = memory->funcs.items[1].args.first;
-                EXIT_IF(arg->value != GET_STRING("a"));
-                arg = arg->next;
-                EXIT_IF(arg->value != GET_STRING("b"));
-                arg = arg->next;
-                EXIT_IF(arg->value != GET_STRING("c"));
-                EXIT_IF(arg->next);
+                const Span<String>* args = &memory->funcs.items[1].args;
+                EXIT_IF(args->len != 3);
+                EXIT_IF(args->items[0] != GET_STRING("a"));
+                EXIT_IF(args->items[1] != GET_STRING("b"));
+                EXIT_IF(args->items[2] != GET_STRING("c"));
             }
             {
                 const Expr* expr = memory->funcs.items[1].expr;
-                EXIT_IF(expr->tag != EXPR_APP);
-                EXIT_IF(expr->body.as_app[0]->tag != EXPR_APP);
+                EXIT_IF(expr->tag != EXPR_BINOP);
+                EXIT_IF(expr->body.as_binop.op != BINOP_ADD);
                 {
-                    const Expr* l0 = expr->body.as_app[0];
-                    EXIT_IF(l0->tag != EXPR_APP);
+                    const Expr* l0 = expr->body.as_binop.args[0];
+                    EXIT_IF(l0->tag != EXPR_BINOP);
+                    EXIT_IF(l0->body.as_binop.op != BINOP_SUB);
                     {
-                        const Expr* l1 = l0->body.as_app[0];
-                        EXIT_IF(l1->tag != EXPR_BINOP);
-                        EXIT_IF(l1->body.as_binop != BINOP_ADD);
+                        const Expr* l1 = l0->body.as_binop.args[0];
+                        EXIT_IF(l1->tag != EXPR_VAR);
+                        EXIT_IF(l1->body.as_var != GET_STRING("a"));
                     }
                     {
-                        const Expr* r1 = l0->body.as_app[1];
-                        EXIT_IF(r1->tag != EXPR_APP);
-                        {
-                            const Expr* l2 = r1->body.as_app[0];
-                            EXIT_IF(l2->tag != EXPR_APP);
-                            {
-                                const Expr* l3 = l2->body.as_app[0];
-                                EXIT_IF(l3->tag != EXPR_BINOP);
-                                EXIT_IF(l3->body.as_binop != BINOP_SUB);
-                            }
-                            {
-                                const Expr* r3 = l2->body.as_app[1];
-                                EXIT_IF(r3->tag != EXPR_VAR);
-                                EXIT_IF(r3->body.as_var != GET_STRING("a"));
-                            }
-                        }
-                        {
-                            const Expr* r2 = r1->body.as_app[1];
-                            EXIT_IF(r2->tag != EXPR_VAR);
-                            EXIT_IF(r2->body.as_var != GET_STRING("b"));
-                        }
+                        const Expr* r1 = l0->body.as_binop.args[1];
+                        EXIT_IF(r1->tag != EXPR_VAR);
+                        EXIT_IF(r1->body.as_var != GET_STRING("b"));
                     }
                 }
                 {
-                    const Expr* r0 = expr->body.as_app[1];
+                    const Expr* r0 = expr->body.as_binop.args[1];
                     EXIT_IF(r0->tag != EXPR_VAR);
                     EXIT_IF(r0->body.as_var != GET_STRING("c"));
                 }
@@ -878,7 +789,7 @@ static void test_parse_program(Buffer<Token, T>*           tokens,
         {
             EXIT_IF(memory->funcs.items[2].tag != FUNC_VAR);
             EXIT_IF(memory->funcs.items[2].name.as_var != GET_STRING("h"));
-            EXIT_IF(memory->funcs.items[2].args.first);
+            EXIT_IF(memory->funcs.items[2].args.len != 0);
             {
                 const Expr* expr = memory->funcs.items[2].expr;
                 EXIT_IF(expr->tag != EXPR_PACK);
@@ -888,6 +799,35 @@ static void test_parse_program(Buffer<Token, T>*           tokens,
         }
         fprintf(stderr, ".");
     }
+    {
+        set_tokens(GET_STRING("f { a - b - c * d + e | x & y == z }"), tokens);
+        parse_program(tokens, memory);
+        EXIT_IF(memory->funcs.len != 1);
+        {
+            const Expr* expr = memory->funcs.items[0].expr;
+            EXIT_IF(expr->tag != EXPR_BINOP);
+            EXIT_IF(expr->body.as_binop.op != BINOP_OR);
+            {
+                const Expr* l0 = expr->body.as_binop.args[0];
+                EXIT_IF(l0->body.as_binop.op != BINOP_ADD);
+                EXIT_IF(!is_var(l0->body.as_binop.args[1], GET_STRING("e")));
+                const Expr* l1 = l0->body.as_binop.args[0];
+                EXIT_IF(l1->body.as_binop.op != BINOP_SUB);
+                EXIT_IF(l1->body.as_binop.args[0]->body.as_binop.op !=
+                        BINOP_SUB);
+                EXIT_IF(l1->body.as_binop.args[1]->body.as_binop.op !=
+                        BINOP_MUL);
+            }
+            {
+                const Expr* r0 = expr->body.as_binop.args[1];
+                EXIT_IF(r0->body.as_binop.op != BINOP_AND);
+                EXIT_IF(!is_var(r0->body.as_binop.args[0], GET_STRING("x")));
+                EXIT_IF(r0->body.as_binop.args[1]->body.as_binop.op !=
+                        BINOP_EQ);
+            }
+        }
+        fprintf(stderr, ".");
+    }
     {
         set_tokens(GET_STRING("f { let { x = 1; y = 2 } x * y }"), tokens);
         parse_program(tokens, memory);
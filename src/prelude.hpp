@@ -1,12 +1,15 @@
 #ifndef __PRELUDE_H__
 #define __PRELUDE_H__
 
+#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
 typedef uint8_t  u8;
+typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 typedef size_t   usize;
 
 typedef int32_t i32;
@@ -16,16 +19,39 @@ typedef FILE File;
 
 #define null nullptr
 
-#define EXIT()                                                       \
-    {                                                                \
-        fprintf(stderr, "%s:%s:%d\n", __FILE__, __func__, __LINE__); \
-        exit(EXIT_FAILURE);                                          \
+// NOTE: A thread that points `RECOVER` at a `jmp_buf` gets its failures back
+// through `longjmp`, with the message in `FAILURE`, instead of ending the
+// process. Nothing is unwound on the way, so whatever the failed code was
+// working on has to be reset before it is used again. `FAILURE` may be read
+// after the thread is gone, so a failure without a message of its own gets
+// a fixed one rather than one formatted on the spot.
+static thread_local jmp_buf*    RECOVER = null;
+static thread_local const char* FAILURE = null;
+
+[[noreturn]] static void fail(const char* file,
+                              const char* func,
+                              i32         line,
+                              const char* message) {
+    if (RECOVER) {
+        FAILURE = message ? message : "internal error";
+        longjmp(*RECOVER, 1);
+    }
+    if (message) {
+        fprintf(stderr, "%s:%s:%d `%s`\n", file, func, line, message);
+    } else {
+        fprintf(stderr, "%s:%s:%d\n", file, func, line);
+    }
+    exit(EXIT_FAILURE);
+}
+
+#define EXIT()                                    \
+    {                                             \
+        fail(__FILE__, __func__, __LINE__, null); \
     }
 
-#define EXIT_WITH(x)                                                         \
-    {                                                                        \
-        fprintf(stderr, "%s:%s:%d `%s`\n", __FILE__, __func__, __LINE__, x); \
-        exit(EXIT_FAILURE);                                                  \
+#define EXIT_WITH(x)                           \
+    {                                          \
+        fail(__FILE__, __func__, __LINE__, x); \
     }
 
 #define EXIT_IF(condition)     \
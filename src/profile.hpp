@@ -0,0 +1,176 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "gc.hpp"
+
+#include <inttypes.h>
+
+// NOTE: Tags every heap cell with the global whose code allocated it, in step
+// with the two halves of the heap. Cells are attributed in bulk whenever the
+// running global changes, so allocation itself is untouched. The global `G`
+// stands for anything allocated outside of a global's code. The counters hold
+// the latest sample, except `by_retainer`, which the collector fills in with
+// the cells each root (a global, then the stack, then the handles) keeps alive
+// that no root before it does.
+template <usize N, usize G>
+struct HeapProfile {
+    u32    producers[2][N];
+    String names[G];
+    usize  by_producer[G + 1];
+    usize  by_kind[NODE_FORWARD + 1];
+    usize  by_tag[1 << 8];
+    usize  by_retainer[G + 2];
+    File*  stream;
+    u64    interval;
+    u64    start;
+    u64    last;
+    usize  samples;
+    usize  marked;
+};
+
+template <usize N, usize G, usize I, usize J>
+static void set_profile(HeapProfile<N, G>*         profile,
+                        const InstMemory<I, J, G>* inst_memory,
+                        File*                      stream,
+                        u64                        interval,
+                        u64                        nanos) {
+    memset(profile, 0, sizeof(HeapProfile<N, G>));
+    for (usize i = 0; i < G; ++i) {
+        const Item<String, u32> item = inst_memory->globals.items[i];
+        if (item.alive) {
+            profile->names[item.value] = item.key;
+        }
+    }
+    profile->stream = stream;
+    profile->interval = interval;
+    profile->start = nanos;
+    profile->last = nanos;
+}
+
+// NOTE: Attributes the cells allocated since the last call to `global`. A
+// node handed back to a sharing table rewinds the heap, so the mark follows.
+template <usize N, usize G>
+static void mark(HeapProfile<N, G>*     profile,
+                 u8                     heap,
+                 const Buffer<Node, N>* nodes,
+                 u32                    global) {
+    if (nodes->len < profile->marked) {
+        profile->marked = nodes->len;
+    }
+    for (usize i = profile->marked; i < nodes->len; ++i) {
+        profile->producers[heap][i] = global;
+    }
+    profile->marked = nodes->len;
+}
+
+static const char* get_kind(NodeTag tag) {
+    switch (tag) {
+    case NODE_UNDEF: {
+        return "undef";
+    }
+    case NODE_I64: {
+        return "i64";
+    }
+    case NODE_APP: {
+        return "app";
+    }
+    case NODE_GLOBAL: {
+        return "global";
+    }
+    case NODE_INDIR: {
+        return "indir";
+    }
+    case NODE_DATA: {
+        return "data";
+    }
+    case NODE_ARRAY: {
+        return "array";
+    }
+    case NODE_BLACKHOLE: {
+        return "blackhole";
+    }
+    case NODE_FORWARD: {
+        return "forward";
+    }
+    }
+    EXIT();
+}
+
+template <usize N, usize G>
+static void print_producer(const HeapProfile<N, G>* profile, usize global) {
+    if (global == G) {
+        fprintf(profile->stream, "-");
+    } else if (profile->names[global].len == 0) {
+        fprintf(profile->stream, "#%zu", global);
+    } else {
+        print(profile->stream, profile->names[global]);
+    }
+}
+
+// NOTE: Runs right after a collection, so everything in `nodes` is live. Each
+// sample is a block of `<kind> <name> <cells>` lines, headed by the elapsed
+// time and the live total; names with no cells are left out.
+template <usize N, usize G>
+static void sample(HeapProfile<N, G>*     profile,
+                   u8                     heap,
+                   const Buffer<Node, N>* nodes,
+                   u64                    nanos) {
+    profile->marked = nodes->len;
+    if ((nanos - profile->last) < profile->interval) {
+        return;
+    }
+    profile->last = nanos;
+    memset(profile->by_producer, 0, sizeof(profile->by_producer));
+    memset(profile->by_kind, 0, sizeof(profile->by_kind));
+    memset(profile->by_tag, 0, sizeof(profile->by_tag));
+    for (usize i = 0; i < nodes->len;) {
+        const Node* node = &nodes->items[i];
+        const usize n = get_cells(node);
+        profile->by_producer[profile->producers[heap][i]] += n;
+        profile->by_kind[get_tag(node)] += n;
+        if (get_tag(node) == NODE_DATA) {
+            profile->by_tag[get_pack_tag(node)] += n;
+        }
+        i += n;
+    }
+    File* stream = profile->stream;
+    fprintf(stream,
+            "sample %zu %" PRIu64 " live %zu\n",
+            profile->samples++,
+            nanos - profile->start,
+            nodes->len);
+    for (usize i = 0; i <= G; ++i) {
+        if (profile->by_producer[i] != 0) {
+            fprintf(stream, "producer ");
+            print_producer(profile, i);
+            fprintf(stream, " %zu\n", profile->by_producer[i]);
+        }
+    }
+    for (u8 i = 0; i <= NODE_FORWARD; ++i) {
+        if (profile->by_kind[i] != 0) {
+            fprintf(stream,
+                    "kind %s %zu\n",
+                    get_kind(static_cast<NodeTag>(i)),
+                    profile->by_kind[i]);
+        }
+    }
+    for (usize i = 0; i < (1 << 8); ++i) {
+        if (profile->by_tag[i] != 0) {
+            fprintf(stream, "tag %zu %zu\n", i, profile->by_tag[i]);
+        }
+    }
+    for (usize i = 0; i < (G + 2); ++i) {
+        if (profile->by_retainer[i] == 0) {
+            continue;
+        }
+        fprintf(stream, "retainer ");
+        if (i < G) {
+            print_producer(profile, i);
+        } else {
+            fprintf(stream, "%s", i == G ? "stack" : "handles");
+        }
+        fprintf(stream, " %zu\n", profile->by_retainer[i]);
+    }
+}
+
+#endif
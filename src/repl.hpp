@@ -0,0 +1,835 @@
+#ifndef __REPL_H__
+#define __REPL_H__
+
+#include "embed.hpp"
+
+#define CAP_CHUNK (1 << 12)
+
+// NOTE: `global` is the code the definition compiles to, or 0 until it is
+// first compiled; it stays the same across edits.
+struct Def {
+    String       source;
+    const Func*  func;
+    Span<String> refs;
+    u32          global;
+    bool         dirty;
+};
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+struct ReplMemory {
+    Buffer<char, C>            chars;
+    Tokens<T>                  tokens;
+    Table<String, Def, D>      defs;
+    ParseMemory<S, B, U, E, F> parse_memory;
+};
+
+template <usize S>
+static void set_refs(Buffer<String, S>*,
+                     Span<String>*,
+                     const Scope*,
+                     const Expr*);
+
+template <usize S>
+static void set_refs(Buffer<String, S>* strings,
+                     Span<String>*      refs,
+                     const Scope*       scope,
+                     const String*      args,
+                     usize              len,
+                     const Expr*        expr) {
+    if (len == 0) {
+        set_refs(strings, refs, scope, expr);
+        return;
+    }
+    const Scope next = {args[0], scope};
+    set_refs(strings, refs, &next, &args[1], len - 1, expr);
+}
+
+template <usize S>
+static void set_refs(Buffer<String, S>* strings,
+                     Span<String>*      refs,
+                     const Scope*       scope,
+                     const ExprBinding* bindings,
+                     usize              len,
+                     const Expr*        expr) {
+    if (len == 0) {
+        set_refs(strings, refs, scope, expr);
+        return;
+    }
+    const Scope next = {bindings[0].name, scope};
+    set_refs(strings, refs, &next, &bindings[1], len - 1, expr);
+}
+
+// NOTE: Nothing else is allocated from `strings` during the walk, so the
+// references stay contiguous behind `refs->items`.
+template <usize S>
+static void set_refs(Buffer<String, S>* strings,
+                     Span<String>*      refs,
+                     const Scope*       scope,
+                     const Expr*        expr) {
+    switch (expr->tag) {
+    case EXPR_VAR: {
+        if (is_bound(scope, expr->body.as_var) ||
+            contains(refs, expr->body.as_var))
+        {
+            return;
+        }
+        EXIT_IF(&refs->items[refs->len] != &strings->items[strings->len]);
+        *alloc(strings) = expr->body.as_var;
+        ++refs->len;
+        break;
+    }
+    case EXPR_APP: {
+        set_refs(strings, refs, scope, expr->body.as_app[0]);
+        set_refs(strings, refs, scope, expr->body.as_app[1]);
+        break;
+    }
+    case EXPR_BINOP: {
+        set_refs(strings, refs, scope, expr->body.as_binop.args[0]);
+        set_refs(strings, refs, scope, expr->body.as_binop.args[1]);
+        break;
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        for (usize i = 0; i < bindings->len; ++i) {
+            const Expr* binding = bindings->items[i].expr;
+            if (expr->tag == EXPR_LET) {
+                set_refs(strings, refs, scope, binding);
+            } else {
+                set_refs(strings,
+                         refs,
+                         scope,
+                         bindings->items,
+                         bindings->len,
+                         binding);
+            }
+        }
+        set_refs(strings,
+                 refs,
+                 scope,
+                 bindings->items,
+                 bindings->len,
+                 expr->body.as_let.expr);
+        break;
+    }
+    case EXPR_UNPACK: {
+        set_refs(strings, refs, scope, expr->body.as_unpack.expr);
+        for (usize i = 0; i < expr->body.as_unpack.branches.len; ++i) {
+            const ExprBranch* branch = &expr->body.as_unpack.branches.items[i];
+            set_refs(strings,
+                     refs,
+                     scope,
+                     branch->args.items,
+                     branch->args.len,
+                     branch->expr);
+        }
+        break;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32: {
+        break;
+    }
+    }
+}
+
+template <usize D>
+static void set_dirty(Table<String, Def, D>* defs, String name) {
+    for (usize i = 0; i < D; ++i) {
+        Item<String, Def>* item = &defs->items[i];
+        if (item->alive && (!item->value.dirty) &&
+            contains(&item->value.refs, name))
+        {
+            item->value.dirty = true;
+            set_dirty(defs, item->key);
+        }
+    }
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void parse_def(ReplMemory<C, T, D, S, B, U, E, F>* memory,
+                      Def*                                def) {
+    usize i = 0;
+    def->func = parse_func(&memory->tokens, &memory->parse_memory, &i);
+    EXIT_IF(get_tag(&memory->tokens, i) != TOKEN_END);
+    Buffer<String, S>* strings = &memory->parse_memory.strings;
+    def->refs.items = &strings->items[strings->len];
+    def->refs.len = 0;
+    set_refs(strings,
+             &def->refs,
+             null,
+             def->func->args.items,
+             def->func->args.len,
+             def->func->expr);
+}
+
+template <typename T, usize N>
+static bool is_half_full(const Buffer<T, N>* buffer) {
+    return (N / 2) < buffer->len;
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static bool is_half_full(const ReplMemory<C, T, D, S, B, U, E, F>* memory) {
+    const ParseMemory<S, B, U, E, F>* parse_memory = &memory->parse_memory;
+    return is_half_full(&memory->chars) ||
+           is_half_full(&parse_memory->strings) ||
+           is_half_full(&parse_memory->bindings) ||
+           is_half_full(&parse_memory->branches) ||
+           is_half_full(&parse_memory->exprs) ||
+           is_half_full(&parse_memory->funcs);
+}
+
+// NOTE: Each edit leaves the source and parse it replaces behind, so the live
+// definitions are moved down over them and parsed again. Sources are moved in
+// the order they were added, none of them past the start of the next.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void compact_defs(ReplMemory<C, T, D, S, B, U, E, F>* memory) {
+    ParseMemory<S, B, U, E, F>* parse_memory = &memory->parse_memory;
+    parse_memory->strings.len = 0;
+    parse_memory->bindings.len = 0;
+    parse_memory->branches.len = 0;
+    parse_memory->exprs.len = 0;
+    parse_memory->funcs.len = 0;
+    const char* chars = memory->chars.items;
+    usize       from = 0;
+    memory->chars.len = 0;
+    for (;;) {
+        Item<String, Def>* next = null;
+        for (usize i = 0; i < D; ++i) {
+            Item<String, Def>* item = &memory->defs.items[i];
+            if ((!item->alive) || (item->value.source.chars < &chars[from])) {
+                continue;
+            }
+            if ((!next) ||
+                (item->value.source.chars < next->value.source.chars))
+            {
+                next = item;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        Def* def = &next->value;
+        from = static_cast<usize>(def->source.chars - chars) + def->source.len;
+        char* source = alloc(&memory->chars, def->source.len);
+        memmove(source, def->source.chars, def->source.len);
+        def->source.chars = source;
+        set_tokens(def->source, &memory->tokens);
+        parse_def(memory, def);
+        next->key = def->func->name.as_var;
+    }
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Def* set_def(ReplMemory<C, T, D, S, B, U, E, F>* memory,
+                          String                              source) {
+    set_tokens(source, &memory->tokens);
+    EXIT_IF(get_tag(&memory->tokens, 0) != TOKEN_VAR);
+    const Def* prev = lookup(&memory->defs, get_string(&memory->tokens, 0));
+    if (prev && (prev->source == source)) {
+        return prev;
+    }
+    {
+        char* chars = alloc(&memory->chars, source.len);
+        memcpy(chars, source.chars, source.len);
+        source.chars = chars;
+        memory->tokens.source = chars;
+    }
+    Def def = {};
+    def.source = source;
+    def.global = prev ? prev->global : 0;
+    def.dirty = true;
+    parse_def(memory, &def);
+    insert(&memory->defs, def.func->name.as_var, def);
+    set_dirty(&memory->defs, def.func->name.as_var);
+    return lookup(&memory->defs, def.func->name.as_var);
+}
+
+template <usize D>
+static void set_clean(Table<String, Def, D>* defs) {
+    for (usize i = 0; i < D; ++i) {
+        defs->items[i].value.dirty = false;
+    }
+}
+
+// NOTE: A session keeps one context for as long as it runs, so the globals
+// it has evaluated survive any edit that does not reach them.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+struct Repl {
+    ReplMemory<C, T, D, S, B, U, E, F> memory;
+    Program<I, J, G>                   program;
+    EvalMemory<N, K, R, G>             context;
+    Buffer<Value, V>                   values;
+    Buffer<char, C>                    chars;
+};
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void set_repl(Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl) {
+    compile_prims(&repl->program.inst_memory);
+    memset(&repl->program.shared, 0, sizeof(NodeShared));
+    set_shared_i64s(&repl->program.shared);
+    set_globals(&repl->context,
+                &repl->program.inst_memory,
+                &repl->program.shared);
+}
+
+template <usize N, usize J, usize G>
+static void compile_stub(InstMemory<N, J, G>* inst_memory, const Def* def) {
+    Expr undef = {};
+    undef.tag = EXPR_UNDEF;
+    Func func = *def->func;
+    func.expr = &undef;
+    compile_func(inst_memory, &inst_memory->codes.items[def->global], &func);
+}
+
+// NOTE: A definition that does not compile is left dirty and runs as `undef`
+// until it, or something it refers to, changes. Code it was compiled to
+// before stays behind in `inst_memory` until `compact_repl`.
+template <usize N, usize J, usize G>
+static bool compile_def(InstMemory<N, J, G>* inst_memory,
+                        const Def*           def,
+                        File*                output) {
+    const String name = def->func->name.as_var;
+    for (usize i = 0; i < def->refs.len; ++i) {
+        if (!lookup(&inst_memory->globals, def->refs.items[i])) {
+            fprintf(output,
+                    "error %.*s: unknown name %.*s\n",
+                    static_cast<i32>(name.len),
+                    name.chars,
+                    static_cast<i32>(def->refs.items[i].len),
+                    def->refs.items[i].chars);
+            compile_stub(inst_memory, def);
+            return false;
+        }
+    }
+    jmp_buf* outer = RECOVER;
+    jmp_buf  recover;
+    RECOVER = &recover;
+    if (setjmp(recover) != 0) {
+        RECOVER = outer;
+        fprintf(output,
+                "error %.*s: %s\n",
+                static_cast<i32>(name.len),
+                name.chars,
+                FAILURE);
+        compile_stub(inst_memory, def);
+        return false;
+    }
+    compile_func(inst_memory,
+                 &inst_memory->codes.items[def->global],
+                 def->func);
+    RECOVER = outer;
+    return true;
+}
+
+// NOTE: Compiles the dirty definitions one function at a time, in place of
+// their previous code, and points their globals (and those of any code lifted
+// out of them) back at it. Arities go first, so calls between the
+// definitions being compiled are made directly.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void update_defs(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl,
+    File*                                              output) {
+    Table<String, Def, D>* defs = &repl->memory.defs;
+    InstMemory<I, J, G>*   inst_memory = &repl->program.inst_memory;
+    const usize            len = inst_memory->codes.len;
+    for (usize i = 0; i < D; ++i) {
+        Item<String, Def>* item = &defs->items[i];
+        if ((!item->alive) || (!item->value.dirty)) {
+            continue;
+        }
+        if (item->value.global == 0) {
+            item->value.global = static_cast<u32>(inst_memory->codes.len);
+            alloc(&inst_memory->codes);
+            insert(&inst_memory->globals, item->key, item->value.global);
+        }
+        inst_memory->codes.items[item->value.global].arity =
+            static_cast<u8>(item->value.func->args.len);
+    }
+    for (usize i = 0; i < D; ++i) {
+        Item<String, Def>* item = &defs->items[i];
+        if ((!item->alive) || (!item->value.dirty)) {
+            continue;
+        }
+        if (compile_def(inst_memory, &item->value, output)) {
+            set_shared_packs(&repl->program.shared, item->value.func->expr);
+            set_shared_packs(&repl->context.shared, item->value.func->expr);
+            item->value.dirty = false;
+        }
+        reset_global(&repl->context, inst_memory, item->value.global);
+    }
+    for (usize i = len; i < inst_memory->codes.len; ++i) {
+        reset_global(&repl->context, inst_memory, i);
+    }
+}
+
+template <usize T>
+static bool is_def(const Tokens<T>* tokens) {
+    usize i = 0;
+    while (get_tag(tokens, i) == TOKEN_VAR) {
+        ++i;
+    }
+    return (i != 0) && (get_tag(tokens, i) == TOKEN_LBRACE);
+}
+
+template <usize N, usize J, usize G>
+static bool is_half_full(const InstMemory<N, J, G>* memory) {
+    return is_half_full(&memory->insts) || is_half_full(&memory->jumps) ||
+           is_half_full(&memory->tags) || is_half_full(&memory->codes);
+}
+
+// NOTE: Code lifted out of a definition takes a new global each time it is
+// compiled, so rather than reuse any of it everything is compiled again from
+// the live definitions by the next `update_defs`. Globals are numbered
+// afresh, so the context starts over as well.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void compact_repl(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl) {
+    compact_defs(&repl->memory);
+    compile_prims(&repl->program.inst_memory);
+    for (usize i = 0; i < D; ++i) {
+        Item<String, Def>* item = &repl->memory.defs.items[i];
+        if (item->alive) {
+            item->value.global = 0;
+            item->value.dirty = true;
+        }
+    }
+    set_globals(&repl->context,
+                &repl->program.inst_memory,
+                &repl->program.shared);
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void add_def(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl,
+    String                                             source) {
+    const u32* index = lookup(&repl->program.inst_memory.globals,
+                              get_string(&repl->memory.tokens, 0));
+    if (index && (*index < GLOBAL_FUNCS)) {
+        EXIT_WITH("reserved name");
+    }
+    if (is_half_full(&repl->memory) ||
+        is_half_full(&repl->program.inst_memory))
+    {
+        compact_repl(repl);
+    }
+    set_def(&repl->memory, source);
+}
+
+// NOTE: A failed evaluation is passed on to `run_chunk` once `call` has set
+// the context up again from the program.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void print_it(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl,
+    File*                                              output) {
+    repl->values.len = 0;
+    repl->chars.len = 0;
+    const Value* value = call(&repl->context,
+                              &repl->program,
+                              &repl->values,
+                              GET_STRING("it"),
+                              null,
+                              0);
+    if (!value) {
+        EXIT_WITH(FAILURE);
+    }
+    put_value(&repl->chars, value);
+    fprintf(output,
+            "%.*s\n",
+            static_cast<i32>(repl->chars.len),
+            repl->chars.items);
+}
+
+// NOTE: A chunk is either a definition, which replaces any earlier one of
+// the same name, or an expression, which is defined as `it` and printed.
+// Definitions are compiled right away unless `defer` is set, in which case
+// they wait for the next expression or `update_defs`.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void run_chunk(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl,
+    String                                             chunk,
+    File*                                              output,
+    bool                                               defer) {
+    jmp_buf recover;
+    RECOVER = &recover;
+    if (setjmp(recover) != 0) {
+        RECOVER = null;
+        fprintf(output, "error %s\n", FAILURE);
+        return;
+    }
+    set_tokens(chunk, &repl->memory.tokens);
+    if (is_def(&repl->memory.tokens)) {
+        add_def(repl, chunk);
+        if (!defer) {
+            update_defs(repl, output);
+        }
+        RECOVER = null;
+        return;
+    }
+    char      chars[CAP_CHUNK + 8];
+    const i32 len = snprintf(chars,
+                             sizeof(chars),
+                             "it { %.*s }",
+                             static_cast<i32>(chunk.len),
+                             chunk.chars);
+    EXIT_IF((len <= 0) || (sizeof(chars) <= static_cast<usize>(len)));
+    const String source = {chars, static_cast<usize>(len)};
+    set_tokens(source, &repl->memory.tokens);
+    add_def(repl, source);
+    update_defs(repl, output);
+    if (!lookup(&repl->memory.defs, GET_STRING("it"))->dirty) {
+        print_it(repl, output);
+    }
+    RECOVER = null;
+}
+
+// NOTE: Joins lines until their braces balance, so a definition can span
+// several of them. Returns 0 only once `input` has ended.
+static usize read_chunk(File* input, char* chunk, usize cap) {
+    usize len = 0;
+    i32   depth = 0;
+    bool  blank = true;
+    for (;;) {
+        EXIT_IF((cap - len) < 2);
+        if (!fgets(&chunk[len], static_cast<i32>(cap - len), input)) {
+            return blank ? 0 : len;
+        }
+        bool comment = false;
+        for (; chunk[len] != '\0'; ++len) {
+            const char c = chunk[len];
+            if (comment || IS_SPACE(c)) {
+                continue;
+            }
+            if (c == '#') {
+                comment = true;
+                continue;
+            }
+            blank = false;
+            if (c == '{') {
+                ++depth;
+            } else if (c == '}') {
+                --depth;
+            }
+        }
+        if (blank) {
+            len = 0;
+        } else if (depth <= 0) {
+            return len;
+        }
+    }
+}
+
+// NOTE: `prompt` is written before each chunk is read; evaluation errors are
+// answered with `error` and what went wrong, after which the session goes on.
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void run_repl(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl,
+    File*                                              input,
+    File*                                              output,
+    const char*                                        prompt,
+    bool                                               defer) {
+    char chunk[CAP_CHUNK];
+    for (;;) {
+        fprintf(output, "%s", prompt);
+        EXIT_IF(fflush(output) != 0);
+        const usize len = read_chunk(input, chunk, CAP_CHUNK);
+        if (len == 0) {
+            return;
+        }
+        run_chunk(repl, {chunk, len}, output, defer);
+    }
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void test_set_def(ReplMemory<C, T, D, S, B, U, E, F>* memory) {
+    {
+        set_def(memory, GET_STRING("nil { pack 1 0 }"));
+        set_def(memory, GET_STRING("cons x xs { pack 2 2 x xs }"));
+        set_def(memory, GET_STRING("single x { cons x nil }"));
+        set_def(memory, GET_STRING("main { let { nil = 0 } single nil }"));
+        set_def(memory, GET_STRING("other xs { unpack xs { 1 = 0 } }"));
+        EXIT_IF(memory->defs.len != 5);
+        EXIT_IF(memory->parse_memory.funcs.len != 5);
+        {
+            const Def* def = lookup(&memory->defs, GET_STRING("single"));
+            EXIT_IF(!def->dirty);
+            EXIT_IF(def->refs.len != 2);
+            EXIT_IF(def->refs.items[0] != GET_STRING("cons"));
+            EXIT_IF(def->refs.items[1] != GET_STRING("nil"));
+        }
+        {
+            const Def* def = lookup(&memory->defs, GET_STRING("main"));
+            EXIT_IF(def->refs.len != 1);
+            EXIT_IF(def->refs.items[0] != GET_STRING("single"));
+        }
+        EXIT_IF(lookup(&memory->defs, GET_STRING("other"))->refs.len != 0);
+        fprintf(stderr, ".");
+    }
+    {
+        set_clean(&memory->defs);
+        set_def(memory, GET_STRING("nil { pack 1 0 }"));
+        EXIT_IF(memory->parse_memory.funcs.len != 5);
+        for (usize i = 0; i < D; ++i) {
+            EXIT_IF(memory->defs.items[i].value.dirty);
+        }
+        fprintf(stderr, ".");
+    }
+    {
+        set_def(memory, GET_STRING("nil { pack 3 0 }"));
+        EXIT_IF(memory->parse_memory.funcs.len != 6);
+        EXIT_IF(memory->defs.len != 5);
+        EXIT_IF(!lookup(&memory->defs, GET_STRING("nil"))->dirty);
+        EXIT_IF(!lookup(&memory->defs, GET_STRING("single"))->dirty);
+        EXIT_IF(!lookup(&memory->defs, GET_STRING("main"))->dirty);
+        EXIT_IF(lookup(&memory->defs, GET_STRING("cons"))->dirty);
+        EXIT_IF(lookup(&memory->defs, GET_STRING("other"))->dirty);
+        {
+            const Expr* expr =
+                lookup(&memory->defs, GET_STRING("nil"))->func->expr;
+            EXIT_IF(expr->body.as_pack[0] != 3);
+        }
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+template <usize C,
+          usize T,
+          usize D,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize R,
+          usize V>
+static void test_repl(
+    Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>* repl) {
+    memset(repl, 0, sizeof(Repl<C, T, D, S, B, U, E, F, I, J, G, N, K, R, V>));
+    set_repl(repl);
+    File* output = tmpfile();
+    EXIT_IF(!output);
+    const char* chunks[] = {
+        "nil { pack 1 0 }",
+        "cons x xs { pack 2 2 x xs }",
+        "n { 3 }",
+        "range a b {\n  if (b <= a) nil (cons a (range (a + 1) b))\n}",
+        "range 0 n",
+        "total { sum (range 0 n) }",
+        "sum xs { unpack xs { 1 = 0; 2 y ys = y + sum ys } }",
+        "total",
+    };
+    for (usize i = 0; i < (sizeof(chunks) / sizeof(chunks[0])); ++i) {
+        run_chunk(repl, {chunks[i], strlen(chunks[i])}, output, false);
+    }
+    const InstMemory<I, J, G>* inst_memory = &repl->program.inst_memory;
+    const u32 total = get_global(inst_memory, GET_STRING("total"));
+    const u32 range = get_global(inst_memory, GET_STRING("range"));
+    const ListNode<Inst>* insts = inst_memory->codes.items[range].insts;
+    EXIT_IF(get_tag(repl->context.roots[total]) != NODE_I64);
+    run_chunk(repl, GET_STRING("one { 1 }"), output, false);
+    EXIT_IF(get_tag(repl->context.roots[total]) != NODE_I64);
+    run_chunk(repl, GET_STRING("n { 4 }"), output, false);
+    EXIT_IF(get_tag(repl->context.roots[total]) != NODE_GLOBAL);
+    EXIT_IF(inst_memory->codes.items[range].insts != insts);
+    run_chunk(repl, GET_STRING("total"), output, false);
+    run_chunk(repl, GET_STRING("total / 0"), output, false);
+    run_chunk(repl, GET_STRING("total + one"), output, false);
+    run_chunk(repl, GET_STRING("if { 1 }"), output, false);
+    rewind(output);
+    const char* expected[] = {
+        "(pack 2 2 0 (pack 2 2 1 (pack 2 2 2 (pack 1 0))))\n",
+        "error total: unknown name sum\n",
+        "3\n",
+        "6\n",
+        "error division by zero\n",
+        "7\n",
+        "error reserved name\n",
+    };
+    char line[CAP_CHUNK];
+    for (usize i = 0; i < (sizeof(expected) / sizeof(expected[0])); ++i) {
+        EXIT_IF(!fgets(line, CAP_CHUNK, output));
+        EXIT_IF(strcmp(line, expected[i]) != 0);
+    }
+    EXIT_IF(fgets(line, CAP_CHUNK, output));
+    EXIT_IF(fclose(output) != 0);
+    output = tmpfile();
+    EXIT_IF(!output);
+    for (usize i = 0; i <= I; ++i) {
+        const i32 len = snprintf(line, CAP_CHUNK, "n { %zu }", i);
+        EXIT_IF(len <= 0);
+        run_chunk(repl, {line, static_cast<usize>(len)}, output, false);
+    }
+    run_chunk(repl, GET_STRING("n + one"), output, false);
+    rewind(output);
+    {
+        char      value[32];
+        const i32 len = snprintf(value, sizeof(value), "%zu\n", I + 1);
+        EXIT_IF((len <= 0) || (!fgets(line, CAP_CHUNK, output)));
+        EXIT_IF(strcmp(line, value) != 0);
+    }
+    EXIT_IF(fgets(line, CAP_CHUNK, output));
+    EXIT_IF(fclose(output) != 0);
+    fprintf(stderr, ".\n");
+}
+
+#endif
@@ -0,0 +1,560 @@
+#ifndef __SERVE_H__
+#define __SERVE_H__
+
+#include "embed.hpp"
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef SERVE_BATCH
+    #define SERVE_BATCH 64
+#endif
+
+STATIC_ASSERT(0 < SERVE_BATCH);
+
+#define CAP_LINE (1 << 10)
+
+// NOTE: One line of input, `name value*`, where a value is an integer
+// literal, optionally negated, or `(pack tag arity value*)`. The response
+// is the fully evaluated result in the same syntax, a tab, and the time
+// spent evaluating it in nanoseconds. A request that cannot be read or fails
+// to evaluate is answered with `error` and what went wrong instead.
+struct Request {
+    char         chars[CAP_LINE];
+    String       name;
+    const Value* args;
+    String       result;
+    const char*  error;
+    u64          nanos;
+    u8           len;
+};
+
+template <usize N, usize S, usize D, usize G, usize V, usize C>
+struct Worker {
+    EvalMemory<N, S, D, G> context;
+    Buffer<Value, V>       values;
+    Buffer<char, C>        chars;
+};
+
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+struct Server {
+    const Program<I, J, G>*  program;
+    Tokens<T>                tokens;
+    Buffer<Value, V>         args;
+    Request                  requests[SERVE_BATCH];
+    usize                    len;
+    Worker<N, S, D, G, V, C> workers[W];
+    pthread_t                threads[W];
+};
+
+template <usize T>
+static u8 parse_u8(const Tokens<T>* tokens, usize* i) {
+    if ((get_tag(tokens, *i) != TOKEN_U32) || (0xFF < get_u32(tokens, *i))) {
+        EXIT_WITH("expected a number below 256");
+    }
+    return static_cast<u8>(get_u32(tokens, (*i)++));
+}
+
+template <usize T, usize V>
+static Value parse_value(const Tokens<T>*  tokens,
+                         Buffer<Value, V>* values,
+                         usize*            i) {
+    switch (get_tag(tokens, *i)) {
+    case TOKEN_U32: {
+        return get_value(static_cast<i64>(get_u32(tokens, (*i)++)));
+    }
+    case TOKEN_SUB: {
+        ++(*i);
+        if (get_tag(tokens, *i) != TOKEN_U32) {
+            EXIT_WITH("expected a number");
+        }
+        return get_value(-static_cast<i64>(get_u32(tokens, (*i)++)));
+    }
+    case TOKEN_LPAREN: {
+        ++(*i);
+        if (get_tag(tokens, (*i)++) != TOKEN_PACK) {
+            EXIT_WITH("expected `pack`");
+        }
+        const u8 tag = parse_u8(tokens, i);
+        const u8 arity = parse_u8(tokens, i);
+        Value*   fields = alloc(values, arity);
+        for (u8 j = 0; j < arity; ++j) {
+            fields[j] = parse_value(tokens, values, i);
+        }
+        if (get_tag(tokens, (*i)++) != TOKEN_RPAREN) {
+            EXIT_WITH("expected `)`");
+        }
+        return get_value(tag, fields, arity);
+    }
+    case TOKEN_UNDEF:
+    case TOKEN_LET:
+    case TOKEN_LETREC:
+    case TOKEN_PACK:
+    case TOKEN_UNPACK:
+    case TOKEN_RPAREN:
+    case TOKEN_LBRACE:
+    case TOKEN_RBRACE:
+    case TOKEN_SCOLON:
+    case TOKEN_ASSIGN:
+    case TOKEN_ADD:
+    case TOKEN_MUL:
+    case TOKEN_DIV:
+    case TOKEN_LT:
+    case TOKEN_LE:
+    case TOKEN_GT:
+    case TOKEN_GE:
+    case TOKEN_EQ:
+    case TOKEN_NE:
+    case TOKEN_AND:
+    case TOKEN_OR:
+    case TOKEN_VAR:
+    case TOKEN_END: {
+        EXIT_WITH("expected a value");
+    }
+    }
+    EXIT();
+}
+
+template <usize T, usize V, usize I, usize J, usize G>
+static void parse_request(Tokens<T>*                 tokens,
+                          Buffer<Value, V>*          values,
+                          const InstMemory<I, J, G>* inst_memory,
+                          Request*                   request) {
+    set_tokens({request->chars, strlen(request->chars)}, tokens);
+    usize i = 0;
+    if (get_tag(tokens, i) != TOKEN_VAR) {
+        EXIT_WITH("expected a name");
+    }
+    request->name = get_string(tokens, i++);
+    const u32* index = lookup(&inst_memory->globals, request->name);
+    if (!index) {
+        EXIT_WITH("unknown name");
+    }
+    Value args[CAP_SPINE];
+    request->len = 0;
+    while (get_tag(tokens, i) != TOKEN_END) {
+        if (CAP_SPINE <= request->len) {
+            EXIT_WITH("too many arguments");
+        }
+        args[request->len++] = parse_value(tokens, values, &i);
+    }
+    if (inst_memory->codes.items[*index].arity != request->len) {
+        EXIT_WITH("wrong number of arguments");
+    }
+    request->args = get_span(values, args, request->len).items;
+}
+
+// NOTE: A request that fails to parse leaves `values` as it was when it
+// started, so the rest of the batch is unaffected.
+template <usize T, usize V, usize I, usize J, usize G>
+static void read_request(Tokens<T>*                 tokens,
+                         Buffer<Value, V>*          values,
+                         const InstMemory<I, J, G>* inst_memory,
+                         Request*                   request) {
+    const usize len = values->len;
+    jmp_buf     recover;
+    request->error = null;
+    request->nanos = 0;
+    RECOVER = &recover;
+    if (setjmp(recover) != 0) {
+        RECOVER = null;
+        request->error = FAILURE;
+        values->len = len;
+        return;
+    }
+    parse_request(tokens, values, inst_memory, request);
+    RECOVER = null;
+}
+
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+struct Job {
+    Server<T, I, J, G, N, S, D, V, C, W>* server;
+    usize                                 worker;
+};
+
+// NOTE: `call` sets the context up again after a failed evaluation, so what
+// is left to fail here, writing the result out, leaves the context alone.
+template <usize N,
+          usize S,
+          usize D,
+          usize G,
+          usize V,
+          usize C,
+          usize I,
+          usize J>
+static void run_request(Worker<N, S, D, G, V, C>* worker,
+                        const Program<I, J, G>*   program,
+                        Request*                  request) {
+    worker->values.len = 0;
+    const Value* value = call(&worker->context,
+                              program,
+                              &worker->values,
+                              request->name,
+                              request->args,
+                              request->len);
+    if (!value) {
+        request->error = FAILURE;
+        return;
+    }
+    jmp_buf recover;
+    RECOVER = &recover;
+    if (setjmp(recover) != 0) {
+        RECOVER = null;
+        request->error = FAILURE;
+        return;
+    }
+    const usize offset = worker->chars.len;
+    put_value(&worker->chars, value);
+    request->result = {&worker->chars.items[offset],
+                       worker->chars.len - offset};
+    RECOVER = null;
+}
+
+// NOTE: Worker `k` takes every `W`th request of the batch, so each request
+// runs against exactly one context and nothing but the program is shared.
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static void* run_worker(void* data) {
+    const Job<T, I, J, G, N, S, D, V, C, W>* job =
+        reinterpret_cast<const Job<T, I, J, G, N, S, D, V, C, W>*>(data);
+    Server<T, I, J, G, N, S, D, V, C, W>* server = job->server;
+    Worker<N, S, D, G, V, C>*             worker =
+        &server->workers[job->worker];
+    worker->chars.len = 0;
+    for (usize i = job->worker; i < server->len; i += W) {
+        Request* request = &server->requests[i];
+        if (request->error) {
+            continue;
+        }
+        const u64 start = get_nanos();
+        run_request(worker, server->program, request);
+        request->nanos = get_nanos() - start;
+    }
+    return null;
+}
+
+// NOTE: With `share` set, each worker's context gets its own sharing table.
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static void set_server(Server<T, I, J, G, N, S, D, V, C, W>* server,
+                       const Program<I, J, G>*               program,
+                       bool                                  share) {
+    server->program = program;
+    for (usize i = 0; i < W; ++i) {
+        set_sharing(&server->workers[i].context, share);
+        set_globals(&server->workers[i].context,
+                    &program->inst_memory,
+                    &program->shared);
+    }
+}
+
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static void print(File*                                       stream,
+                  const Server<T, I, J, G, N, S, D, V, C, W>* server) {
+    for (usize i = 0; i < W; ++i) {
+        const EvalMemory<N, S, D, G>* context = &server->workers[i].context;
+        fprintf(stream, "worker %zu ", i);
+        print(stream, &context->segments);
+        if (context->conses) {
+            fprintf(stream, "worker %zu ", i);
+            print(stream, context->conses);
+        }
+    }
+}
+
+// NOTE: Discards what is left of a line that did not fit, returning whether
+// there was anything left at all.
+static bool skip_line(File* input) {
+    i32 c = fgetc(input);
+    if ((c == '\n') || (c == EOF)) {
+        return false;
+    }
+    while ((c != '\n') && (c != EOF)) {
+        c = fgetc(input);
+    }
+    return true;
+}
+
+// NOTE: A batch ends after `SERVE_BATCH` requests, at an empty line, or at
+// the end of input; its requests are spread over the workers and answered
+// in order. With a single worker every line is answered as it arrives. Stops
+// early, returning false, once `output` can no longer be written to.
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static bool serve(Server<T, I, J, G, N, S, D, V, C, W>* server,
+                  File*                                 input,
+                  File*                                 output) {
+    const usize batch = W == 1 ? 1 : SERVE_BATCH;
+    for (;;) {
+        server->len = 0;
+        server->args.len = 0;
+        bool done = false;
+        while (server->len < batch) {
+            Request* request = &server->requests[server->len];
+            if (!fgets(request->chars, CAP_LINE, input)) {
+                done = true;
+                break;
+            }
+            const usize len = strlen(request->chars);
+            if ((len == 0) || (request->chars[0] == '\n')) {
+                break;
+            }
+            if ((len == (CAP_LINE - 1)) && (request->chars[len - 1] != '\n') &&
+                skip_line(input))
+            {
+                request->error = "line too long";
+                request->nanos = 0;
+            } else {
+                read_request(&server->tokens,
+                             &server->args,
+                             &server->program->inst_memory,
+                             request);
+            }
+            ++server->len;
+        }
+        if (server->len != 0) {
+            Job<T, I, J, G, N, S, D, V, C, W> jobs[W];
+            for (usize i = 0; i < W; ++i) {
+                jobs[i] = {server, i};
+            }
+            void* (*run)(void*) = run_worker<T, I, J, G, N, S, D, V, C, W>;
+            for (usize i = 1; i < W; ++i) {
+                EXIT_IF(
+                    pthread_create(&server->threads[i], null, run, &jobs[i]) !=
+                    0);
+            }
+            run(&jobs[0]);
+            for (usize i = 1; i < W; ++i) {
+                EXIT_IF(pthread_join(server->threads[i], null) != 0);
+            }
+            for (usize i = 0; i < server->len; ++i) {
+                const Request* request = &server->requests[i];
+                i32            len;
+                if (request->error) {
+                    len = fprintf(output,
+                                  "error %s\t%" PRIu64 "\n",
+                                  request->error,
+                                  request->nanos);
+                } else {
+                    len = fprintf(output,
+                                  "%.*s\t%" PRIu64 "\n",
+                                  static_cast<i32>(request->result.len),
+                                  request->result.chars,
+                                  request->nanos);
+                }
+                if (len < 0) {
+                    return false;
+                }
+            }
+            if (fflush(output) != 0) {
+                return false;
+            }
+        }
+        if (done) {
+            return true;
+        }
+    }
+}
+
+// NOTE: Connections are served one after another, each until the client
+// closes its end, after which the workers' counters go to stderr. A client
+// that goes away early only loses its own replies.
+template <usize T,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize S,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static void serve(Server<T, I, J, G, N, S, D, V, C, W>* server,
+                  const char*                           path) {
+    struct sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    EXIT_IF(sizeof(address.sun_path) <= strlen(path));
+    memcpy(address.sun_path, path, strlen(path));
+    const i32 listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    EXIT_IF(listener < 0);
+    unlink(path);
+    EXIT_IF(bind(listener,
+                 reinterpret_cast<const struct sockaddr*>(&address),
+                 sizeof(address)) != 0);
+    EXIT_IF(listen(listener, SOMAXCONN) != 0);
+    EXIT_IF(signal(SIGPIPE, SIG_IGN) == SIG_ERR);
+    for (;;) {
+        const i32 connection = accept(listener, null, null);
+        EXIT_IF(connection < 0);
+        File* input = fdopen(connection, "r");
+        EXIT_IF(!input);
+        File* output = fdopen(dup(connection), "w");
+        EXIT_IF(!output);
+        const bool written = serve(server, input, output);
+        EXIT_IF((fclose(output) != 0) && written);
+        EXIT_IF(fclose(input) != 0);
+        print(stderr, server);
+    }
+}
+
+template <usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F,
+          usize L,
+          usize R,
+          usize Q,
+          usize I,
+          usize J,
+          usize G,
+          usize N,
+          usize K,
+          usize D,
+          usize V,
+          usize C,
+          usize W>
+static void test_serve(Tokens<T>*                            tokens,
+                       ParseMemory<S, B, U, E, F>*           parse_memory,
+                       FuseMemory<L, R, Q>*                  fuse_memory,
+                       Program<I, J, G>*                     program,
+                       Server<T, I, J, G, N, K, D, V, C, W>* server) {
+    set_program(program,
+                tokens,
+                parse_memory,
+                fuse_memory,
+                GET_STRING("nil { pack 1 0 }\n"
+                           "cons x xs { pack 2 2 x xs }\n"
+                           "range a b {\n"
+                           "  if (b <= a) nil (cons a (range (a + 1) b))\n"
+                           "}\n"
+                           "sum xs {\n"
+                           "  unpack xs { 1 = 0; 2 y ys = y + sum ys }\n"
+                           "}\n"
+                           "add x y { x + y }\n"
+                           "quot x y { x / y }\n"
+                           "oops { undef }\n"
+                           "max {\n"
+                           "  ((2147483648 * 2147483648) - 1) +\n"
+                           "    (2147483648 * 2147483648)\n"
+                           "}\n"
+                           "wide { array_len (array_range (0 - max) max) }"));
+    set_server(server, program, true);
+    File* input = tmpfile();
+    File* output = tmpfile();
+    EXIT_IF((!input) || (!output));
+    fprintf(input,
+            "add 1 2\n"
+            "range 3 5\n"
+            "\n"
+            "sum (pack 2 2 4 (pack 2 2 -6 (pack 1 0)))\n"
+            "add -3 0\n"
+            "range 0 0\n"
+            "nope 1\n"
+            "add 1\n"
+            "add 1 (pack 2)\n"
+            "add 1 -x\n"
+            "quot 1 0\n"
+            "oops\n"
+            "sum (pack 3 0)\n"
+            "wide\n"
+            "quot 7 2\n"
+            "add ");
+    for (usize i = 0; i < CAP_LINE; ++i) {
+        EXIT_IF(fputc('1', input) == EOF);
+    }
+    fprintf(input, "\nadd 2 2\n");
+    rewind(input);
+    serve(server, input, output);
+    rewind(output);
+    const char* expected[] = {
+        "3",
+        "(pack 2 2 3 (pack 2 2 4 (pack 1 0)))",
+        "-2",
+        "-3",
+        "(pack 1 0)",
+        "error unknown name",
+        "error wrong number of arguments",
+        "error expected a number below 256",
+        "error expected a number",
+        "error division by zero",
+        "error undef",
+        "error no matching branch",
+        "error heap exhausted",
+        "3",
+        "error line too long",
+        "4",
+    };
+    char line[CAP_LINE];
+    for (usize i = 0; i < (sizeof(expected) / sizeof(expected[0])); ++i) {
+        EXIT_IF(!fgets(line, CAP_LINE, output));
+        const usize len = strlen(expected[i]);
+        EXIT_IF(memcmp(line, expected[i], len) != 0);
+        EXIT_IF(line[len] != '\t');
+    }
+    EXIT_IF(fgets(line, CAP_LINE, output));
+    EXIT_IF(fclose(output) != 0);
+    EXIT_IF(fclose(input) != 0);
+    for (usize i = 0; i < W; ++i) {
+        set_sharing(&server->workers[i].context, false);
+    }
+    fprintf(stderr, ".\n");
+}
+
+#endif
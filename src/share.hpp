@@ -0,0 +1,100 @@
+#ifndef __SHARE_H__
+#define __SHARE_H__
+
+#include "gc.hpp"
+#include "hash.hpp"
+
+// NOTE: A weak hash-cons table over immutable `NODE_I64` and `NODE_DATA`
+// nodes, keyed on the header and the field pointers. Entries do not keep
+// nodes alive; `sweep` drops the ones a collection did not reach and rehashes
+// the rest at their new addresses into the other half of `slots`. Callers
+// pass a null table when sharing is off.
+template <usize N>
+struct NodeTable {
+    Node* slots[2][N];
+    usize saved;
+    u8    current;
+};
+
+static usize get_key_len(const Node* node) {
+    const usize fields = get_tag(node) == NODE_I64 ? 1 : get_arity(node);
+    return sizeof(usize) * (1 + fields);
+}
+
+static u32 hash(const Node* node) {
+    return fnv_1a_32(reinterpret_cast<const u8*>(node), get_key_len(node));
+}
+
+static bool is_same(const Node* a, const Node* b) {
+    return (a->header == b->header) && (!memcmp(a, b, get_key_len(a)));
+}
+
+template <usize N>
+static Node** find_slot(NodeTable<N>* table, const Node* node) {
+    Node**    slots = table->slots[table->current];
+    const u32 h = hash(node);
+    for (u32 i = 0; i < N; ++i) {
+        Node** slot = &slots[(h + i) % N];
+        if ((!*slot) || is_same(*slot, node)) {
+            return slot;
+        }
+    }
+    EXIT();
+}
+
+template <usize N>
+static void reset(NodeTable<N>* table) {
+    memset(table->slots[table->current], 0, sizeof(Node*) * N);
+    table->saved = 0;
+}
+
+// NOTE: `node` has to be the latest allocation in `nodes`, so when an equal
+// node already exists it is handed back by rewinding the heap.
+template <usize N, usize M>
+static Node* share(NodeTable<N>* table, Buffer<Node, M>* nodes, Node* node) {
+    if ((!table) || (!is_in(nodes, node))) {
+        return node;
+    }
+    Node** slot = find_slot(table, node);
+    if (!*slot) {
+        *slot = node;
+        return node;
+    }
+    const usize cells = get_cells(node);
+    EXIT_IF(&nodes->items[nodes->len - cells] != node);
+    nodes->len -= cells;
+    table->saved += cells;
+    return *slot;
+}
+
+// NOTE: Runs after a collection, while forwarding headers are still readable.
+template <usize N>
+static void sweep(NodeTable<N>* table) {
+    if (!table) {
+        return;
+    }
+    Node** from = table->slots[table->current];
+    table->current ^= 1;
+    memset(table->slots[table->current], 0, sizeof(Node*) * N);
+    for (usize i = 0; i < N; ++i) {
+        if ((!from[i]) || (get_tag(from[i]) != NODE_FORWARD)) {
+            continue;
+        }
+        Node* node =
+            reinterpret_cast<Node*>(from[i]->header & ~NODE_TAG_MASK);
+        Node** slot = find_slot(table, node);
+        if (!*slot) {
+            *slot = node;
+        }
+    }
+}
+
+template <usize N>
+static void print(File* stream, const NodeTable<N>* table) {
+    fprintf(stream,
+            "shared %zu nodes (%zu bytes)\n",
+            table->saved,
+            table->saved * sizeof(Node));
+}
+
+#endif
@@ -0,0 +1,486 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include "fuse.hpp"
+
+#define CAP_CASE_OF_CASE (1 << 5)
+
+struct Known {
+    String            name;
+    const ExprBranch* branch;
+    const Known*      next;
+};
+
+static bool is_killed(const Known* known, String name) {
+    for (; known; known = known->next) {
+        if (known->name == name) {
+            return !known->branch;
+        }
+    }
+    return false;
+}
+
+static const ExprBranch* find_known(const Known* known, String name) {
+    const Known* entry = known;
+    for (; entry; entry = entry->next) {
+        if (entry->name == name) {
+            break;
+        }
+    }
+    if ((!entry) || (!entry->branch)) {
+        return null;
+    }
+    for (; known != entry; known = known->next) {
+        if ((!known->branch) && contains(&entry->branch->args, known->name)) {
+            return null;
+        }
+    }
+    return entry->branch;
+}
+
+static usize get_size(const Expr* expr) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        return 1 + get_size(expr->body.as_app[0]) +
+               get_size(expr->body.as_app[1]);
+    }
+    case EXPR_BINOP: {
+        return 1 + get_size(expr->body.as_binop.args[0]) +
+               get_size(expr->body.as_binop.args[1]);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        usize size = 1 + get_size(expr->body.as_let.expr);
+        for (usize i = 0; i < expr->body.as_let.bindings.len; ++i) {
+            const ExprBinding* binding = &expr->body.as_let.bindings.items[i];
+            size += get_size(binding->expr);
+        }
+        return size;
+    }
+    case EXPR_UNPACK: {
+        usize size = 1 + get_size(expr->body.as_unpack.expr);
+        for (usize i = 0; i < expr->body.as_unpack.branches.len; ++i) {
+            const ExprBranch* branch = &expr->body.as_unpack.branches.items[i];
+            size += get_size(branch->expr);
+        }
+        return size;
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        return 1;
+    }
+    }
+    EXIT();
+}
+
+template <usize F>
+static bool is_known_pack(const Buffer<Func, F>* funcs,
+                          const Known*           known,
+                          const Expr*            expr) {
+    const Spine spine = get_spine(expr);
+    if ((spine.head->tag == EXPR_VAR) &&
+        is_killed(known, spine.head->body.as_var))
+    {
+        return false;
+    }
+    u8 tag;
+    return is_pack(funcs, &spine, &tag);
+}
+
+template <usize E>
+static const Expr* get_unpack(Buffer<Expr, E>* exprs,
+                              const Expr*      expr,
+                              const Expr*      unpack) {
+    Expr* copy = alloc(exprs);
+    *copy = *unpack;
+    copy->body.as_unpack.expr = expr;
+    return copy;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* simplify_expr(ParseMemory<S, B, U, E, F>*,
+                                 FuseMemory<C, N, R>*,
+                                 const Known*,
+                                 const Expr*);
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* simplify_unpack(ParseMemory<S, B, U, E, F>* parse_memory,
+                                   FuseMemory<C, N, R>*        fuse_memory,
+                                   const Known*                known,
+                                   const Expr*                 expr,
+                                   const Expr*                 unpack) {
+    const Spine spine = get_spine(expr);
+    if ((spine.head->tag != EXPR_VAR) ||
+        (!is_killed(known, spine.head->body.as_var)))
+    {
+        u8 tag;
+        if (is_pack(&parse_memory->funcs, &spine, &tag)) {
+            const ExprBranch* branch = find_branch(unpack, tag);
+            if (branch && (branch->args.len == spine.len)) {
+                return simplify_expr(parse_memory,
+                                     fuse_memory,
+                                     known,
+                                     bind_branch(parse_memory,
+                                                 fuse_memory,
+                                                 null,
+                                                 null,
+                                                 branch,
+                                                 &spine));
+            }
+        }
+    }
+    if (expr->tag == EXPR_VAR) {
+        const ExprBranch* known_branch = find_known(known, expr->body.as_var);
+        const ExprBranch* branch =
+            known_branch ? find_branch(unpack, known_branch->tag) : null;
+        if (branch && (branch->args.len == known_branch->args.len)) {
+            const Rename* renames = null;
+            for (usize i = 0; i < branch->args.len; ++i) {
+                renames = push_rename(fuse_memory,
+                                      renames,
+                                      branch->args.items[i],
+                                      known_branch->args.items[i]);
+            }
+            return simplify_expr(
+                parse_memory,
+                fuse_memory,
+                known,
+                rename(parse_memory, fuse_memory, renames, branch->expr));
+        }
+    }
+    const Span<ExprBranch>* branches = &unpack->body.as_unpack.branches;
+    usize                   size = 0;
+    for (usize i = 0; i < branches->len; ++i) {
+        size += get_size(branches->items[i].expr);
+    }
+    if (size <= CAP_CASE_OF_CASE) {
+        if (is_var(spine.head, GET_STRING("if")) && (spine.len == 3) &&
+            (!is_killed(known, GET_STRING("if"))) &&
+            (is_known_pack(&parse_memory->funcs, known, spine.args[1]) ||
+             is_known_pack(&parse_memory->funcs, known, spine.args[2])))
+        {
+            const Expr* args[] = {
+                spine.args[0],
+                get_unpack(&parse_memory->exprs, spine.args[1], unpack),
+                get_unpack(&parse_memory->exprs, spine.args[2], unpack),
+            };
+            return simplify_expr(
+                parse_memory,
+                fuse_memory,
+                known,
+                get_call(&parse_memory->exprs, spine.head, args, 3));
+        }
+        if (expr->tag == EXPR_UNPACK) {
+            const Span<ExprBranch>* inners = &expr->body.as_unpack.branches;
+            bool                    pack = false;
+            for (usize i = 0; i < inners->len; ++i) {
+                pack = pack || is_known_pack(&parse_memory->funcs,
+                                             known,
+                                             inners->items[i].expr);
+            }
+            if (pack) {
+                const Expr* inner =
+                    rename(parse_memory, fuse_memory, null, expr);
+                const Span<ExprBranch>* from = &inner->body.as_unpack.branches;
+                Span<ExprBranch>        to = {
+                    alloc(&parse_memory->branches, from->len),
+                    from->len,
+                };
+                for (usize i = 0; i < from->len; ++i) {
+                    to.items[i] = from->items[i];
+                    to.items[i].expr = get_unpack(&parse_memory->exprs,
+                                                  from->items[i].expr,
+                                                  unpack);
+                }
+                Expr* copy = alloc(&parse_memory->exprs);
+                *copy = {};
+                copy->tag = EXPR_UNPACK;
+                copy->body.as_unpack.expr = inner->body.as_unpack.expr;
+                copy->body.as_unpack.branches = to;
+                return simplify_expr(parse_memory, fuse_memory, known, copy);
+            }
+        }
+    }
+    Expr* copy = alloc(&parse_memory->exprs);
+    *copy = {};
+    copy->tag = EXPR_UNPACK;
+    copy->body.as_unpack.expr = expr;
+    copy->body.as_unpack.branches = {
+        alloc(&parse_memory->branches, branches->len),
+        branches->len,
+    };
+    for (usize i = 0; i < branches->len; ++i) {
+        const ExprBranch* branch = &branches->items[i];
+        Known             kills[CAP_BINDERS + 1];
+        const usize       len = branch->args.len;
+        EXIT_IF(CAP_BINDERS < len);
+        for (usize j = 0; j < len; ++j) {
+            kills[j].name = branch->args.items[j];
+            kills[j].branch = null;
+            kills[j].next = j == 0 ? known : &kills[j - 1];
+        }
+        const Known* inner = len == 0 ? known : &kills[len - 1];
+        if ((expr->tag == EXPR_VAR) &&
+            (!contains(&branch->args, expr->body.as_var)))
+        {
+            kills[len].name = expr->body.as_var;
+            kills[len].branch = branch;
+            kills[len].next = inner;
+            inner = &kills[len];
+        }
+        ExprBranch* copy_branch = &copy->body.as_unpack.branches.items[i];
+        *copy_branch = *branch;
+        copy_branch->expr = simplify_expr(parse_memory,
+                                          fuse_memory,
+                                          inner,
+                                          branch->expr);
+    }
+    return copy;
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static const Expr* simplify_expr(ParseMemory<S, B, U, E, F>* parse_memory,
+                                 FuseMemory<C, N, R>*        fuse_memory,
+                                 const Known*                known,
+                                 const Expr*                 expr) {
+    switch (expr->tag) {
+    case EXPR_APP: {
+        const Expr* l = simplify_expr(parse_memory,
+                                      fuse_memory,
+                                      known,
+                                      expr->body.as_app[0]);
+        const Expr* r = simplify_expr(parse_memory,
+                                      fuse_memory,
+                                      known,
+                                      expr->body.as_app[1]);
+        if ((l == expr->body.as_app[0]) && (r == expr->body.as_app[1])) {
+            return expr;
+        }
+        return get_app(&parse_memory->exprs, l, r);
+    }
+    case EXPR_BINOP: {
+        const Expr* l = simplify_expr(parse_memory,
+                                      fuse_memory,
+                                      known,
+                                      expr->body.as_binop.args[0]);
+        const Expr* r = simplify_expr(parse_memory,
+                                      fuse_memory,
+                                      known,
+                                      expr->body.as_binop.args[1]);
+        if ((l == expr->body.as_binop.args[0]) &&
+            (r == expr->body.as_binop.args[1]))
+        {
+            return expr;
+        }
+        return get_binop(&parse_memory->exprs, expr->body.as_binop.op, l, r);
+    }
+    case EXPR_LET:
+    case EXPR_LETREC: {
+        const Span<ExprBinding>* bindings = &expr->body.as_let.bindings;
+        Known                    kills[CAP_BINDERS];
+        const usize              len = bindings->len;
+        EXIT_IF(CAP_BINDERS < len);
+        for (usize i = 0; i < len; ++i) {
+            kills[i].name = bindings->items[i].name;
+            kills[i].branch = null;
+            kills[i].next = i == 0 ? known : &kills[i - 1];
+        }
+        const Known* inner = len == 0 ? known : &kills[len - 1];
+        const Known* outer = expr->tag == EXPR_LET ? known : inner;
+        Expr*        copy = alloc(&parse_memory->exprs);
+        *copy = {};
+        copy->tag = expr->tag;
+        copy->body.as_let.bindings = {
+            alloc(&parse_memory->bindings, len),
+            len,
+        };
+        for (usize i = 0; i < len; ++i) {
+            ExprBinding* binding = &copy->body.as_let.bindings.items[i];
+            *binding = bindings->items[i];
+            binding->expr = simplify_expr(parse_memory,
+                                          fuse_memory,
+                                          outer,
+                                          bindings->items[i].expr);
+        }
+        copy->body.as_let.expr = simplify_expr(parse_memory,
+                                               fuse_memory,
+                                               inner,
+                                               expr->body.as_let.expr);
+        return copy;
+    }
+    case EXPR_UNPACK: {
+        return simplify_unpack(parse_memory,
+                               fuse_memory,
+                               known,
+                               simplify_expr(parse_memory,
+                                             fuse_memory,
+                                             known,
+                                             expr->body.as_unpack.expr),
+                               expr);
+    }
+    case EXPR_UNDEF:
+    case EXPR_PACK:
+    case EXPR_U32:
+    case EXPR_VAR: {
+        return expr;
+    }
+    }
+    EXIT();
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void simplify_program(ParseMemory<S, B, U, E, F>* parse_memory,
+                             FuseMemory<C, N, R>*        fuse_memory) {
+    for (usize i = 0; i < parse_memory->funcs.len; ++i) {
+        Func* func = &parse_memory->funcs.items[i];
+        Known       kills[CAP_BINDERS];
+        const usize len = func->args.len;
+        EXIT_IF(CAP_BINDERS < len);
+        for (usize j = 0; j < len; ++j) {
+            kills[j].name = func->args.items[j];
+            kills[j].branch = null;
+            kills[j].next = j == 0 ? null : &kills[j - 1];
+        }
+        fuse_memory->renames.len = 0;
+        func->expr = simplify_expr(parse_memory,
+                                   fuse_memory,
+                                   len == 0 ? null : &kills[len - 1],
+                                   func->expr);
+    }
+}
+
+template <usize C,
+          usize N,
+          usize R,
+          usize T,
+          usize S,
+          usize B,
+          usize U,
+          usize E,
+          usize F>
+static void test_simplify_program(Tokens<T>*                  tokens,
+                                  ParseMemory<S, B, U, E, F>* parse_memory,
+                                  FuseMemory<C, N, R>*        fuse_memory) {
+    {
+        set_tokens(GET_STRING("nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "f y {\n"
+                              "  unpack (cons y nil) { 1 = 0; 2 z zs = z }\n"
+                              "}\n"
+                              "g cons {\n"
+                              "  unpack (cons 1 2) { 1 = 0; 2 a b = a }\n"
+                              "}"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        simplify_program(parse_memory, fuse_memory);
+        EXIT_IF(!is_var(parse_memory->funcs.items[2].expr, GET_STRING("y")));
+        EXIT_IF(parse_memory->funcs.items[3].expr->tag != EXPR_UNPACK);
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("f xs {\n"
+                              "  unpack xs {\n"
+                              "    1 = 0;\n"
+                              "    2 y ys = unpack xs {\n"
+                              "      1 = 1;\n"
+                              "      2 a b = a + y\n"
+                              "    }\n"
+                              "  }\n"
+                              "}\n"
+                              "g xs {\n"
+                              "  unpack xs {\n"
+                              "    1 = 0;\n"
+                              "    2 y ys = let { ys = 1 } unpack xs {\n"
+                              "      1 = 1;\n"
+                              "      2 a b = b\n"
+                              "    }\n"
+                              "  }\n"
+                              "}"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        simplify_program(parse_memory, fuse_memory);
+        {
+            const Expr* expr = parse_memory->funcs.items[0]
+                                   .expr->body.as_unpack.branches.items[1]
+                                   .expr;
+            EXIT_IF(expr->tag != EXPR_BINOP);
+            EXIT_IF(!is_var(expr->body.as_binop.args[0], GET_STRING("y")));
+            EXIT_IF(!is_var(expr->body.as_binop.args[1], GET_STRING("y")));
+        }
+        {
+            const Expr* expr = parse_memory->funcs.items[1]
+                                   .expr->body.as_unpack.branches.items[1]
+                                   .expr;
+            EXIT_IF(expr->tag != EXPR_LET);
+            EXIT_IF(expr->body.as_let.expr->tag != EXPR_UNPACK);
+        }
+        fprintf(stderr, ".");
+    }
+    {
+        set_tokens(GET_STRING("nil { pack 1 0 }\n"
+                              "cons x xs { pack 2 2 x xs }\n"
+                              "f c xs {\n"
+                              "  unpack (if c nil (cons 1 xs)) {\n"
+                              "    1 = 0;\n"
+                              "    2 y ys = y\n"
+                              "  }\n"
+                              "}\n"
+                              "g xs {\n"
+                              "  unpack (unpack xs {\n"
+                              "    1 = nil;\n"
+                              "    2 y ys = cons y ys\n"
+                              "  }) { 1 = 0; 2 a b = a }\n"
+                              "}"),
+                   tokens);
+        parse_program(tokens, parse_memory);
+        simplify_program(parse_memory, fuse_memory);
+        {
+            const Spine spine = get_spine(parse_memory->funcs.items[2].expr);
+            EXIT_IF(!is_var(spine.head, GET_STRING("if")));
+            EXIT_IF(spine.len != 3);
+            EXIT_IF(spine.args[1]->body.as_u32 != 0);
+            EXIT_IF(spine.args[2]->tag != EXPR_LET);
+        }
+        {
+            const Expr* expr = parse_memory->funcs.items[3].expr;
+            EXIT_IF(expr->tag != EXPR_UNPACK);
+            EXIT_IF(!is_var(expr->body.as_unpack.expr, GET_STRING("xs")));
+            const ExprBranch* branch = find_branch(expr, 2);
+            EXIT_IF(!is_var(branch->expr, branch->args.items[0]));
+        }
+        fprintf(stderr, ".");
+    }
+    fprintf(stderr, "\n");
+}
+
+#endif